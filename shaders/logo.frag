@@ -6,6 +6,7 @@ in vec4 frag_vertex_lightspace;
 in vec3 frag_vertex_color;          // Color of this vertex
 in vec3 frag_normal;                // Translated normal
 flat in int frag_material;
+in vec2 frag_texcoord;              // Glide texture coordinates (0..256)
 
 // Out variables
 out vec4 frag_color;                // The output color of this fragment
@@ -14,6 +15,13 @@ out vec4 frag_color;                // The output color of this fragment
 uniform vec3 light0_position;
 uniform vec3 light1_position;
 uniform sampler2D shadow_map;
+uniform bool logo_textured;         // Apply the marbled texture to the 3D
+uniform bool logo_texture_indexed;  // The texture is raw indices into logo_palette
+uniform vec2 logo_texcoord_scale;   // Glide texture coordinates to UV
+uniform int logo_texture_levels;    // Number of mipmap levels of the logo texture
+uniform sampler2D logo_texture;
+uniform usampler2D logo_indices;
+uniform sampler2D logo_palette;
 
 // Locals
 vec3 light = vec3(-0.57735f, -0.57735f, -0.57735f);
@@ -44,8 +52,45 @@ float shadow(vec4 frag_pos_lightspace)
     return shadow;
 }
 
+vec4 palette_texel(ivec2 coord, int level)
+{
+    // Glide textures are powers of two, so masking wraps, negative coordinates included
+    ivec2 size = textureSize(logo_indices, level);
+    uint index = texelFetch(logo_indices, coord & (size - 1), level).r;
+    return texelFetch(logo_palette, ivec2(int(index), 0), 0);
+}
+
+// Derivatives are taken up front, as they are undefined inside of non-uniform control flow
+vec4 sample_logo_texture(vec2 uv, vec2 uv_dx, vec2 uv_dy)
+{
+    if(!logo_texture_indexed)
+        return textureGrad(logo_texture, uv, uv_dx, uv_dy);
+
+    // Pick the nearest mipmap level, then filter bilinearly by hand within it, as the indices
+    // themselves can't be filtered
+    vec2 size0 = vec2(textureSize(logo_indices, 0));
+    vec2 dx = uv_dx * size0;
+    vec2 dy = uv_dy * size0;
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+    int level = clamp(int(round(lod)), 0, logo_texture_levels - 1);
+
+    vec2 texel = uv * vec2(textureSize(logo_indices, level)) - 0.5;
+    ivec2 base = ivec2(floor(texel));
+    vec2 f = fract(texel);
+
+    vec4 t00 = palette_texel(base, level);
+    vec4 t10 = palette_texel(base + ivec2(1, 0), level);
+    vec4 t01 = palette_texel(base + ivec2(0, 1), level);
+    vec4 t11 = palette_texel(base + ivec2(1, 1), level);
+    return mix(mix(t00, t10, f.x), mix(t01, t11, f.x), f.y);
+}
+
 void main()
 {
+    vec2 logo_uv = frag_texcoord * logo_texcoord_scale;
+    vec2 logo_uv_dx = dFdx(logo_uv);
+    vec2 logo_uv_dy = dFdy(logo_uv);
+
     // Ambient lighting
     vec3 ambient = ambient_strength * light_color;
     vec3 diffuse = vec3(0, 0, 0);
@@ -59,8 +104,12 @@ void main()
     // This doens't work!
     if(frag_material == 0)
     {
+        vec3 base_color = frag_vertex_color;
+        if(logo_textured)
+            base_color *= sample_logo_texture(logo_uv, logo_uv_dx, logo_uv_dy).rgb;
+
         diffuse += calculate_diffuse(frag_normal, light1_position, light_color) * 0.5;
-        frag_color = vec4((ambient + diffuse) * 0.8 * frag_vertex_color, 1.0);
+        frag_color = vec4((ambient + diffuse) * 0.8 * base_color, 1.0);
     }
     else
     {    
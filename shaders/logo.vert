@@ -4,12 +4,15 @@ layout (location = 1) in vec3 normal_data;
 layout (location = 2) in vec2 texcoord_data;
 layout (location = 3) in vec3 color_data;
 layout (location = 4) in int material_index;
+layout (location = 5) in int color_index;
 
 // Uniforms
 uniform mat4 mat_projection;
 uniform mat4 mat_view;
 uniform mat4 mat_model;
 uniform mat4 mat_lightmatrix;
+uniform bool vertex_color_indexed;      // Compact vertices have an index into color_palette instead of a color
+uniform vec3 color_palette[8];
 
 // Out variables
 out vec3 frag_vertex;                   // Transformed vertex in eye space
@@ -17,6 +20,7 @@ out vec4 frag_vertex_lightspace;        // Fragment position in lightspace
 out vec3 frag_vertex_color;             // Color of this vertex
 out vec3 frag_normal;                   // Translated normal
 flat out int frag_material;
+out vec2 frag_texcoord;                 // Glide texture coordinates (0..256)
 
 void main()
 {
@@ -25,8 +29,9 @@ void main()
     frag_vertex = vec3(mat_model * vec4(vertex_data, 1.0)); // Transformed vertex position
     frag_vertex_lightspace = mat_lightmatrix * vec4(frag_vertex, 1.0);
     
-    frag_vertex_color = color_data;
+    frag_vertex_color = vertex_color_indexed ? color_palette[color_index] : color_data;
     frag_normal = mat3(transpose(mat_model)) * normal_data;
     frag_material = material_index;
+    frag_texcoord = texcoord_data;
     gl_Position = mat_mvp * vec4(vertex_data, 1.0);
 }
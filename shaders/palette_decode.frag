@@ -0,0 +1,14 @@
+#version 330 core
+
+// Out variables
+out vec4 frag_color;
+
+// Uniform variables
+uniform usampler2D indices;         // Raw 8-bit texel indices
+uniform sampler2D palette;          // 256x1 palette the indices point into
+
+void main()
+{
+    uint index = texelFetch(indices, ivec2(gl_FragCoord.xy), 0).r;
+    frag_color = texelFetch(palette, ivec2(int(index), 0), 0);
+}
@@ -0,0 +1,257 @@
+/**
+ * Memory mapped .3df texture files
+ */
+#include "3dffile.h"
+#include "log.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr std::size_t HEADER_MAX_SIZE = 256;    /* The 4 header lines are way shorter than this */
+
+static uint16_t read_be16(const uint8_t* p)
+{
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+static uint32_t read_be32(const uint8_t* p)
+{
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) | (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+/**
+ * LOD of a mipmap level from the length of its larger side, or -1 if it isn't a power of two up to 256
+ */
+static int lod_from_size(int size)
+{
+    for(int lod = static_cast<int>(GrLOD::GR_LOD_256); lod <= static_cast<int>(GrLOD::GR_LOD_1); lod++)
+    {
+        if(size == (256 >> lod))
+            return lod;
+    }
+
+    return -1;
+}
+
+/**
+ * Aspect ratio from the "aspect ratio: w h" header line, or -1 if it isn't one Glide supports
+ */
+static int aspect_from_ratio(int width, int height)
+{
+    static const int ratios[][2] = {{8, 1}, {4, 1}, {2, 1}, {1, 1}, {1, 2}, {1, 4}, {1, 8}};
+
+    for(int aspect = static_cast<int>(GrAspectRatio::GR_ASPECT_8x1); aspect <= static_cast<int>(GrAspectRatio::GR_ASPECT_1x8); aspect++)
+    {
+        if(ratios[aspect][0] == width && ratios[aspect][1] == height)
+            return aspect;
+    }
+
+    return -1;
+}
+
+static int format_from_name(const char* name)
+{
+    for(FxU32 format = 0; format <= static_cast<FxU32>(GrTextureFormat::GR_TEXFMT_RSVD4); format++)
+    {
+        const char* format_name = tex_format_name(format);
+
+        if(format_name != nullptr && strcasecmp(format_name, name) == 0)
+            return static_cast<int>(format);
+    }
+
+    return -1;
+}
+
+C3dfFile::~C3dfFile()
+{
+    close();
+}
+
+bool C3dfFile::open(const std::string& path)
+{
+    struct stat st;
+    int fd;
+
+    close();
+
+    fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        log(LogLevel::ERROR, "Unable to open %s: %s\n", path.c_str(), std::strerror(errno));
+        return false;
+    }
+
+    if(fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        log(LogLevel::ERROR, "Unable to stat %s, or it is empty\n", path.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    mapping_size = static_cast<std::size_t>(st.st_size);
+    mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // The mapping keeps its own reference to the file
+    if(mapping == MAP_FAILED)
+    {
+        log(LogLevel::ERROR, "Unable to map %s: %s\n", path.c_str(), std::strerror(errno));
+        mapping = nullptr;
+        mapping_size = 0;
+        return false;
+    }
+
+    if(!parse(path))
+    {
+        close();
+        return false;
+    }
+
+    log(LogLevel::INFO, "Mapped %s: %dx%d %s, %u bytes of texels%s\n", path.c_str(),
+                                                                       texinfo.header.width,
+                                                                       texinfo.header.height,
+                                                                       tex_format_name(texinfo.header.format),
+                                                                       texinfo.mem_required,
+                                                                       zero_copy() ? " (zero copy)" : " (byte swapped)");
+    return true;
+}
+
+void C3dfFile::close()
+{
+    if(mapping != nullptr)
+        munmap(mapping, mapping_size);
+
+    mapping = nullptr;
+    mapping_size = 0;
+    swapped.clear();
+    swapped.shrink_to_fit();
+    texinfo = {};
+}
+
+bool C3dfFile::parse(const std::string& path)
+{
+    const uint8_t* file = static_cast<const uint8_t*>(mapping);
+    char header[HEADER_MAX_SIZE + 1] = {};
+    char version[16];
+    char format_name[16];
+    int small_size, large_size, aspect_width, aspect_height;
+    std::size_t pos = 0;
+    int newlines = 0;
+
+    // The header is four lines of text, e.g
+    //  3df v1.1
+    //  yiq
+    //  lod range: 1 64
+    //  aspect ratio: 1 1
+    while(pos < mapping_size && pos < HEADER_MAX_SIZE && newlines < 4)
+    {
+        header[pos] = static_cast<char>(file[pos]);
+        if(file[pos++] == '\n')
+            newlines++;
+    }
+
+    if(newlines < 4 ||
+       std::sscanf(header, "3df v%15s %15s lod range: %d %d aspect ratio: %d %d", version, format_name, &small_size, &large_size, &aspect_width, &aspect_height) != 6)
+    {
+        log(LogLevel::ERROR, "%s is not a .3df file!\n", path.c_str());
+        return false;
+    }
+
+    Gu3dfHeader& hdr = texinfo.header;
+    int format = format_from_name(format_name);
+    int small_lod = lod_from_size(small_size);
+    int large_lod = lod_from_size(large_size);
+    int aspect = aspect_from_ratio(aspect_width, aspect_height);
+
+    if(format < 0 || small_lod < 0 || large_lod < 0 || aspect < 0)
+    {
+        log(LogLevel::ERROR, "%s: unsupported format %s, lod range %d %d or aspect ratio %d %d\n", path.c_str(), format_name, small_size, large_size, aspect_width, aspect_height);
+        return false;
+    }
+
+    hdr.format = static_cast<GrTextureFormat_t>(format);
+    hdr.small_lod = small_lod;
+    hdr.large_lod = large_lod;
+    hdr.aspect_ratio = aspect;
+
+    TexMipLevel levels[TEX_MAX_MIP_LEVELS];
+    int num_levels = tex_mip_levels(&hdr, levels);
+    if(num_levels == 0)
+    {
+        log(LogLevel::ERROR, "%s: invalid lod range %d %d\n", path.c_str(), small_size, large_size);
+        return false;
+    }
+
+    hdr.width = levels[0].width;
+    hdr.height = levels[0].height;
+    texinfo.mem_required = levels[num_levels - 1].offset + levels[num_levels - 1].size;
+
+    // Then comes the NCC table or palette, if the format has one
+    GuNccTable& ncc = texinfo.table.nccTable;
+    std::size_t table_size = 0;
+    switch(static_cast<GrTextureFormat>(hdr.format))
+    {
+    case GrTextureFormat::GR_TEXFMT_YIQ_422:
+    case GrTextureFormat::GR_TEXFMT_AYIQ_8422:
+        table_size = (16 + 12 + 12) * sizeof(FxI16);
+        break;
+    case GrTextureFormat::GR_TEXFMT_P_8:
+    case GrTextureFormat::GR_TEXFMT_AP_88:
+        table_size = 256 * sizeof(FxU32);
+        break;
+    default:
+        break;
+    }
+
+    if(pos + table_size + texinfo.mem_required > mapping_size)
+    {
+        log(LogLevel::ERROR, "%s is truncated (%zu bytes, expected %zu)\n", path.c_str(), mapping_size, pos + table_size + texinfo.mem_required);
+        return false;
+    }
+
+    if(table_size == (16 + 12 + 12) * sizeof(FxI16))
+    {
+        const uint8_t* table = file + pos;
+
+        for(int i = 0; i < 16; i++)
+            ncc.yRGB[i] = static_cast<FxU8>(read_be16(table + i * 2));
+        for(int i = 0; i < 12; i++)
+            ncc.iRGB[i / 3][i % 3] = static_cast<FxI16>(read_be16(table + 32 + i * 2));
+        for(int i = 0; i < 12; i++)
+            ncc.qRGB[i / 3][i % 3] = static_cast<FxI16>(read_be16(table + 56 + i * 2));
+
+        // Pack the table the way the hardware wants it, same as Glide does
+        for(int i = 0; i < 4; i++)
+        {
+            ncc.packed_data[i] = ncc.yRGB[i * 4] | (ncc.yRGB[i * 4 + 1] << 8) | (ncc.yRGB[i * 4 + 2] << 16) | (static_cast<FxU32>(ncc.yRGB[i * 4 + 3]) << 24);
+            ncc.packed_data[i + 4] = ((ncc.iRGB[i][0] & 0x1ff) << 18) | ((ncc.iRGB[i][1] & 0x1ff) << 9) | (ncc.iRGB[i][2] & 0x1ff);
+            ncc.packed_data[i + 8] = ((ncc.qRGB[i][0] & 0x1ff) << 18) | ((ncc.qRGB[i][1] & 0x1ff) << 9) | (ncc.qRGB[i][2] & 0x1ff);
+        }
+    }
+    else if(table_size != 0)
+    {
+        for(int i = 0; i < 256; i++)
+            texinfo.table.palette.data[i] = read_be32(file + pos + i * 4);
+    }
+    pos += table_size;
+
+    // Finally the texels, largest level first
+    const uint8_t* texels = file + pos;
+    if(tex_format_bpp(hdr.format) == 2)
+    {
+        swapped.resize(texinfo.mem_required / 2);
+        for(std::size_t i = 0; i < swapped.size(); i++)
+            swapped[i] = read_be16(texels + i * 2);
+        texinfo.data = swapped.data();
+    }
+    else
+    {
+        // Gu3dfInfo wants a mutable pointer, but nothing ever writes through it (the mapping is read only)
+        texinfo.data = const_cast<uint8_t*>(texels);
+    }
+
+    return true;
+}
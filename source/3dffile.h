@@ -0,0 +1,61 @@
+/**
+ * Memory mapped .3df texture files
+ */
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "3dftex.h"
+
+/**
+ * A .3df texture file mapped into memory.
+ *
+ * The ASCII header and the NCC table/palette after it are parsed into a @ref Gu3dfInfo, whose data
+ * pointer points straight into the mapping. Texels are only read (and paged in) when something
+ * decodes or uploads them.
+ *
+ * .3df files store everything big endian. 8-bit formats are used in place, but 16-bit texels have
+ * to be byte swapped into a buffer owned by the file on little endian hosts.
+ */
+class C3dfFile final
+{
+public:
+    C3dfFile() = default;
+    ~C3dfFile();
+
+    C3dfFile(const C3dfFile&) = delete;
+    C3dfFile& operator=(const C3dfFile&) = delete;
+
+    /**
+     * Map and parse a .3df file. Anything previously opened is closed first.
+     *
+     * @param path  Path of the file
+     *
+     * @return false (and logs why) if the file can't be mapped or isn't a valid .3df file.
+     */
+    bool open(const std::string& path);
+
+    /**
+     * Unmap the file. @ref info is invalid afterwards.
+     */
+    void close();
+
+    /**
+     * Texture info of the file. data points into the mapping (or the byte swapped copy of it).
+     */
+    Gu3dfInfo* info() { return &texinfo; }
+
+    /**
+     * Whether the texels are used straight from the mapping, without a copy.
+     */
+    bool zero_copy() const { return swapped.empty(); }
+
+private:
+    bool parse(const std::string& path);
+
+    Gu3dfInfo texinfo = {};
+    void* mapping = nullptr;                /**< Start of the mapped file */
+    std::size_t mapping_size = 0;           /**< Size of the mapping in bytes */
+    std::vector<uint16_t> swapped;          /**< Byte swapped texels of 16-bit formats */
+};
@@ -2,56 +2,975 @@
  *
  */
 #include "3dftex.h"
-#include <cstdio>
+#include "workers.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
 
-void yiq422_to_rgb888(const GuNccTable* ncc_table, const uint8_t* index_data, std::vector<uint32_t>& data, int num_bytes)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/**
+ * NCC table rearranged for the nibble shuffle kernels.
+ *
+ * The low nibble of an index selects one of 16 (I, Q) combinations, so we pre-add I and Q
+ * and split each 16-bit sum into a low and a high byte table that `pshufb` can look up.
+ */
+struct NccShuffleTables
 {
-    // First, we create a pallette based on the YIQ colours
-    // https://github.com/sezero/glide/blob/46226e7d142940f86d4960327e2932e0d21624fe/swlibs/texus/lib/texuslib.c#L296
+    alignas(16) uint8_t y[16];
+    alignas(16) uint8_t iq_lo[3][16];
+    alignas(16) uint8_t iq_hi[3][16];
+};
+
+static constexpr std::size_t NCC_PALETTE_CACHE_SIZE = 64;
+static constexpr int DECODE_TILE_TEXELS = 8192;    /* 8-32KiB in, 32KiB out. Fits in L2 on anything we care about */
+
+/**
+ * A cached NCC palette and the table it was expanded from
+ */
+struct NccPaletteCacheEntry
+{
+    GuNccTable table;
+    uint32_t palette[256];
+};
+
+static std::mutex ncc_palette_cache_lock;
+static std::vector<std::unique_ptr<NccPaletteCacheEntry>> ncc_palette_cache;
+
+/**
+ * I and Q entries are 9-bit two's complement values. .3df files store them without
+ * sign extension, so we do that here (this is a no-op for values already in range).
+ */
+static inline int ncc_iq(FxI16 value)
+{
+    return ((value & 0x1ff) ^ 0x100) - 0x100;
+}
+
+static bool ncc_table_equal(const GuNccTable* a, const GuNccTable* b)
+{
+    // packed_data is derived from the other fields, so it is not part of the key
+    return std::memcmp(a->yRGB, b->yRGB, sizeof(a->yRGB)) == 0 &&
+           std::memcmp(a->iRGB, b->iRGB, sizeof(a->iRGB)) == 0 &&
+           std::memcmp(a->qRGB, b->qRGB, sizeof(a->qRGB)) == 0;
+}
+
+/**
+ * I + Q is -512..510 and Y + I + Q -512..765, well inside a 16-bit lane, so nothing is clamped here:
+ * the kernel's saturating pack clamps to 0..255.
+ */
+static void build_ncc_shuffle_tables(const GuNccTable* ncc_table, NccShuffleTables& tables)
+{
+    for(int n = 0; n < 16; n++)
+    {
+        int ia = (n >> 2) & 0x3;
+        int ib = (n >> 0) & 0x3;
+
+        tables.y[n] = ncc_table->yRGB[n];
+        for(int c = 0; c < 3; c++)
+        {
+            int iq = ncc_iq(ncc_table->iRGB[ia][c]) + ncc_iq(ncc_table->qRGB[ib][c]);
+
+            tables.iq_lo[c][n] = static_cast<uint8_t>(iq & 0xff);
+            tables.iq_hi[c][n] = static_cast<uint8_t>((iq >> 8) & 0xff);
+        }
+    }
+}
+
+static void pal256_gather_scalar(const uint32_t* palette, const uint8_t* index_data, uint32_t* dst, int num_texels)
+{
+    int i = 0;
+    for(; i + 4 <= num_texels; i += 4)
+    {
+        dst[i + 0] = palette[index_data[i + 0]];
+        dst[i + 1] = palette[index_data[i + 1]];
+        dst[i + 2] = palette[index_data[i + 2]];
+        dst[i + 3] = palette[index_data[i + 3]];
+    }
+
+    for(; i < num_texels; i++)
+        dst[i] = palette[index_data[i]];
+}
+
+#ifdef HAVE_X86_SIMD
+/**
+ * Decode the last few texels that don't fill a whole SIMD register
+ */
+static void yiq422_decode_tail(const GuNccTable* ncc_table, const uint8_t* index_data, uint32_t* dst, int num_texels)
+{
+    if(num_texels > 0)
+    {
+        uint32_t palette[256];
+
+        ncc_palette_cached(ncc_table, palette);
+        pal256_gather_scalar(palette, index_data, dst, num_texels);
+    }
+}
+
+__attribute__((target("avx2")))
+static void pal256_gather_avx2(const uint32_t* palette, const uint8_t* index_data, uint32_t* dst, int num_texels)
+{
+    int i = 0;
+    for(; i + 8 <= num_texels; i += 8)
+    {
+        __m128i index = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(index_data + i));
+        __m256i texels = _mm256_i32gather_epi32(reinterpret_cast<const int*>(palette), _mm256_cvtepu8_epi32(index), 4);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), texels);
+    }
+
+    pal256_gather_scalar(palette, index_data + i, dst + i, num_texels - i);
+}
+
+__attribute__((target("avx2")))
+static void yiq422_decode_avx2(const GuNccTable* ncc_table, const uint8_t* index_data, uint32_t* dst, int num_texels)
+{
+    NccShuffleTables tables;
+    build_ncc_shuffle_tables(ncc_table, tables);
+
+    // vpshufb works on each 128-bit lane separately, so both lanes get a copy of the tables
+    const __m256i y_tab = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(tables.y)));
+    const __m256i nibble_mask = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alpha = _mm256_set1_epi8(-1);
+    __m256i iq_lo[3];
+    __m256i iq_hi[3];
+
+    for(int c = 0; c < 3; c++)
+    {
+        iq_lo[c] = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(tables.iq_lo[c])));
+        iq_hi[c] = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(tables.iq_hi[c])));
+    }
+
+    int i = 0;
+    for(; i + 32 <= num_texels; i += 32)
+    {
+        __m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index_data + i));
+        __m256i iq_index = _mm256_and_si256(index, nibble_mask);
+        __m256i y_index = _mm256_and_si256(_mm256_srli_epi16(index, 4), nibble_mask);
+
+        __m256i y = _mm256_shuffle_epi8(y_tab, y_index);
+        __m256i y_lo = _mm256_unpacklo_epi8(y, zero);
+        __m256i y_hi = _mm256_unpackhi_epi8(y, zero);
+
+        __m256i channel[3];
+        for(int c = 0; c < 3; c++)
+        {
+            __m256i lo = _mm256_shuffle_epi8(iq_lo[c], iq_index);
+            __m256i hi = _mm256_shuffle_epi8(iq_hi[c], iq_index);
+            __m256i sum_lo = _mm256_add_epi16(y_lo, _mm256_unpacklo_epi8(lo, hi));
+            __m256i sum_hi = _mm256_add_epi16(y_hi, _mm256_unpackhi_epi8(lo, hi));
+            channel[c] = _mm256_packus_epi16(sum_lo, sum_hi);
+        }
+
+        __m256i rg_lo = _mm256_unpacklo_epi8(channel[0], channel[1]);
+        __m256i rg_hi = _mm256_unpackhi_epi8(channel[0], channel[1]);
+        __m256i ba_lo = _mm256_unpacklo_epi8(channel[2], alpha);
+        __m256i ba_hi = _mm256_unpackhi_epi8(channel[2], alpha);
+
+        // Every register now holds 4 texels from the low lane (0..15) and 4 from the high lane (16..31)
+        __m256i p0 = _mm256_unpacklo_epi16(rg_lo, ba_lo);
+        __m256i p1 = _mm256_unpackhi_epi16(rg_lo, ba_lo);
+        __m256i p2 = _mm256_unpacklo_epi16(rg_hi, ba_hi);
+        __m256i p3 = _mm256_unpackhi_epi16(rg_hi, ba_hi);
+
+        __m256i* out = reinterpret_cast<__m256i*>(dst + i);
+        _mm256_storeu_si256(out + 0, _mm256_permute2x128_si256(p0, p1, 0x20));
+        _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(p2, p3, 0x20));
+        _mm256_storeu_si256(out + 2, _mm256_permute2x128_si256(p0, p1, 0x31));
+        _mm256_storeu_si256(out + 3, _mm256_permute2x128_si256(p2, p3, 0x31));
+    }
+
+    yiq422_decode_tail(ncc_table, index_data + i, dst + i, num_texels - i);
+}
+#endif
+
+// 16-bit kernels. Each texel is a host order 16-bit word.
+static inline uint32_t expand5(uint32_t v) { return (v << 3) | (v >> 2); }
+static inline uint32_t expand6(uint32_t v) { return (v << 2) | (v >> 4); }
+static inline uint32_t expand4(uint32_t v) { return (v << 4) | v; }
 
-    for(int i = 0; i < num_bytes; i++)
+static inline uint32_t rgba8(uint32_t r, uint32_t g, uint32_t b, uint32_t a)
+{
+    return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+static void rgb565_decode_scalar(const uint16_t* src, uint32_t* dst, int num_texels)
+{
+    for(int i = 0; i < num_texels; i++)
+    {
+        uint32_t v = src[i];
+        dst[i] = rgba8(expand5(v >> 11), expand6((v >> 5) & 0x3f), expand5(v & 0x1f), 0xff);
+    }
+}
+
+static void argb1555_decode_scalar(const uint16_t* src, uint32_t* dst, int num_texels)
+{
+    for(int i = 0; i < num_texels; i++)
+    {
+        uint32_t v = src[i];
+        dst[i] = rgba8(expand5((v >> 10) & 0x1f), expand5((v >> 5) & 0x1f), expand5(v & 0x1f), (v & 0x8000) ? 0xff : 0x00);
+    }
+}
+
+static void argb4444_decode_scalar(const uint16_t* src, uint32_t* dst, int num_texels)
+{
+    for(int i = 0; i < num_texels; i++)
+    {
+        uint32_t v = src[i];
+        dst[i] = rgba8(expand4((v >> 8) & 0xf), expand4((v >> 4) & 0xf), expand4(v & 0xf), expand4(v >> 12));
+    }
+}
+
+/**
+ * 8-bit alpha in the high byte, 8-bit palette index in the low byte (ARGB_8332, AYIQ_8422, AI88 and AP88)
+ */
+static void alpha_pal256_gather_scalar(const uint32_t* palette, const uint16_t* src, uint32_t* dst, int num_texels)
+{
+    for(int i = 0; i < num_texels; i++)
+        dst[i] = (palette[src[i] & 0xff] & 0x00ffffff) | (static_cast<uint32_t>(src[i] >> 8) << 24);
+}
+
+#ifdef HAVE_X86_SIMD
+/**
+ * Interleave four registers of 8 16-bit channel values (each 0..255) into 8 RGBA8888 texels
+ */
+__attribute__((target("sse4.1")))
+static inline void store_rgba8_sse41(uint32_t* dst, __m128i r, __m128i g, __m128i b, __m128i a)
+{
+    __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+    __m128i ba = _mm_or_si128(b, _mm_slli_epi16(a, 8));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst) + 0, _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst) + 1, _mm_unpackhi_epi16(rg, ba));
+}
+
+__attribute__((target("sse4.1")))
+static void rgb565_decode_sse41(const uint16_t* src, uint32_t* dst, int num_texels)
+{
+    const __m128i mask5 = _mm_set1_epi16(0x1f);
+    const __m128i mask6 = _mm_set1_epi16(0x3f);
+    const __m128i alpha = _mm_set1_epi16(0xff);
+
+    int i = 0;
+    for(; i + 8 <= num_texels; i += 8)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i r = _mm_srli_epi16(v, 11);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(v, 5), mask6);
+        __m128i b = _mm_and_si128(v, mask5);
+
+        r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+        g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+        b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+        store_rgba8_sse41(dst + i, r, g, b, alpha);
+    }
+
+    rgb565_decode_scalar(src + i, dst + i, num_texels - i);
+}
+
+__attribute__((target("sse4.1")))
+static void argb1555_decode_sse41(const uint16_t* src, uint32_t* dst, int num_texels)
+{
+    const __m128i mask5 = _mm_set1_epi16(0x1f);
+    const __m128i mask8 = _mm_set1_epi16(0xff);
+
+    int i = 0;
+    for(; i + 8 <= num_texels; i += 8)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i r = _mm_and_si128(_mm_srli_epi16(v, 10), mask5);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(v, 5), mask5);
+        __m128i b = _mm_and_si128(v, mask5);
+        __m128i a = _mm_and_si128(_mm_srai_epi16(v, 15), mask8);
+
+        r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+        g = _mm_or_si128(_mm_slli_epi16(g, 3), _mm_srli_epi16(g, 2));
+        b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+        store_rgba8_sse41(dst + i, r, g, b, a);
+    }
+
+    argb1555_decode_scalar(src + i, dst + i, num_texels - i);
+}
+
+__attribute__((target("sse4.1")))
+static void argb4444_decode_sse41(const uint16_t* src, uint32_t* dst, int num_texels)
+{
+    const __m128i mask4 = _mm_set1_epi16(0xf);
+
+    int i = 0;
+    for(; i + 8 <= num_texels; i += 8)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i r = _mm_and_si128(_mm_srli_epi16(v, 8), mask4);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(v, 4), mask4);
+        __m128i b = _mm_and_si128(v, mask4);
+        __m128i a = _mm_srli_epi16(v, 12);
+
+        r = _mm_or_si128(_mm_slli_epi16(r, 4), r);
+        g = _mm_or_si128(_mm_slli_epi16(g, 4), g);
+        b = _mm_or_si128(_mm_slli_epi16(b, 4), b);
+        a = _mm_or_si128(_mm_slli_epi16(a, 4), a);
+        store_rgba8_sse41(dst + i, r, g, b, a);
+    }
+
+    argb4444_decode_scalar(src + i, dst + i, num_texels - i);
+}
+
+__attribute__((target("avx2")))
+static void alpha_pal256_gather_avx2(const uint32_t* palette, const uint16_t* src, uint32_t* dst, int num_texels)
+{
+    const __m256i mask8 = _mm256_set1_epi32(0xff);
+    const __m256i rgb_mask = _mm256_set1_epi32(0x00ffffff);
+
+    int i = 0;
+    for(; i + 8 <= num_texels; i += 8)
+    {
+        __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+        __m256i rgb = _mm256_i32gather_epi32(reinterpret_cast<const int*>(palette), _mm256_and_si256(v, mask8), 4);
+        __m256i a = _mm256_slli_epi32(_mm256_srli_epi32(v, 8), 24);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_or_si256(_mm256_and_si256(rgb, rgb_mask), a));
+    }
+
+    alpha_pal256_gather_scalar(palette, src + i, dst + i, num_texels - i);
+}
+#endif
+
+static void rgba8_box_downsample_scalar(const uint32_t* src, int src_width, int src_height, uint32_t* dst)
+{
+    int dst_width = (src_width > 1) ? src_width / 2 : 1;
+    int dst_height = (src_height > 1) ? src_height / 2 : 1;
+    int x_step = (src_width > 1) ? 1 : 0;
+    int y_step = (src_height > 1) ? src_width : 0;
+
+    for(int y = 0; y < dst_height; y++)
+    {
+        const uint32_t* row = src + y * 2 * src_width;
+
+        for(int x = 0; x < dst_width; x++)
+        {
+            const uint32_t* texel = row + x * 2 * x_step;
+            uint32_t a = texel[0];
+            uint32_t b = texel[x_step];
+            uint32_t c = texel[y_step];
+            uint32_t d = texel[y_step + x_step];
+            uint32_t out = 0;
+
+            for(int shift = 0; shift < 32; shift += 8)
+            {
+                uint32_t sum = ((a >> shift) & 0xff) + ((b >> shift) & 0xff) + ((c >> shift) & 0xff) + ((d >> shift) & 0xff);
+                out |= ((sum + 2) >> 2) << shift;
+            }
+
+            dst[y * dst_width + x] = out;
+        }
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse4.1")))
+static void rgba8_box_downsample_sse41(const uint32_t* src, int src_width, int src_height, uint32_t* dst)
+{
+    // Only whole 2x2 blocks four texels wide are vectorized
+    if(src_width < 4 || src_height < 2)
+    {
+        rgba8_box_downsample_scalar(src, src_width, src_height, dst);
+        return;
+    }
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(2);
+    int dst_width = src_width / 2;
+    int dst_height = src_height / 2;
+
+    for(int y = 0; y < dst_height; y++)
+    {
+        const uint32_t* row0 = src + (y * 2) * src_width;
+        const uint32_t* row1 = row0 + src_width;
+        uint32_t* out = dst + y * dst_width;
+
+        int x = 0;
+        for(; x + 2 <= dst_width; x += 2)
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 2));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 2));
+
+            // Vertical sums of texels 0, 1 (lo) and 2, 3 (hi)
+            __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+            __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+
+            // Horizontal sums of each pair
+            lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+            hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+
+            __m128i sum = _mm_unpacklo_epi64(lo, hi);
+            sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(sum, zero));
+        }
+
+        for(; x < dst_width; x++)
+        {
+            uint32_t block[4] = {row0[x * 2], row0[x * 2 + 1], row1[x * 2], row1[x * 2 + 1]};
+            rgba8_box_downsample_scalar(block, 2, 2, out + x);
+        }
+    }
+}
+#endif
+
+SimdLevel simd_level_detect()
+{
+#ifdef HAVE_X86_SIMD
+    static const SimdLevel level = []()
+    {
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2"))
+            return SimdLevel::AVX2;
+        if(__builtin_cpu_supports("sse4.1"))
+            return SimdLevel::SSE41;
+        return SimdLevel::SCALAR;
+    }();
+
+    return level;
+#else
+    return SimdLevel::SCALAR;
+#endif
+}
+
+const char* simd_level_name(SimdLevel level)
+{
+    switch(level)
+    {
+    case SimdLevel::SCALAR:
+        return "scalar";
+    case SimdLevel::SSE41:
+        return "sse4.1";
+    case SimdLevel::AVX2:
+        return "avx2";
+    default:
+        return "unknown";
+    }
+}
+
+void ncc_to_palette(const GuNccTable* ncc_table, uint32_t* palette)
+{
+    // https://github.com/sezero/glide/blob/46226e7d142940f86d4960327e2932e0d21624fe/swlibs/texus/lib/texuslib.c#L296
+    for(int i = 0; i < 256; i++)
     {
         int iy, ia, ib, r, g, b;
-        
-        //std::printf("0x%x\n", index_data[i]);
-        iy = (index_data[i] >> 4) & 0xF;
-        ia = (index_data[i] >> 2) & 0x3;
-        ib = (index_data[i] >> 0) & 0x3;
-
-        r = ncc_table->yRGB[iy] + ncc_table->iRGB[ia][0] + ncc_table->qRGB[ib][0];
-        g = ncc_table->yRGB[iy] + ncc_table->iRGB[ia][1] + ncc_table->qRGB[ib][1];
-        b = ncc_table->yRGB[iy] + ncc_table->iRGB[ia][2] + ncc_table->qRGB[ib][2];
-        
-        if (r < 0) r = 0; 
+
+        iy = (i >> 4) & 0xF;
+        ia = (i >> 2) & 0x3;
+        ib = (i >> 0) & 0x3;
+
+        r = ncc_table->yRGB[iy] + ncc_iq(ncc_table->iRGB[ia][0]) + ncc_iq(ncc_table->qRGB[ib][0]);
+        g = ncc_table->yRGB[iy] + ncc_iq(ncc_table->iRGB[ia][1]) + ncc_iq(ncc_table->qRGB[ib][1]);
+        b = ncc_table->yRGB[iy] + ncc_iq(ncc_table->iRGB[ia][2]) + ncc_iq(ncc_table->qRGB[ib][2]);
+
+        if (r < 0) r = 0;
         if (r > 255) r = 255;
-        if (g < 0) g = 0; 
+        if (g < 0) g = 0;
         if (g > 255) g = 255;
-        if (b < 0) b = 0; 
+        if (b < 0) b = 0;
         if (b > 255) b = 255;
 
-        uint32_t pixel = (r | (g << 8) | (b << 16) | 0xff000000);
-        data.push_back(pixel);
-                        //OGL_LOAD_CREATE_TEXTURE( 4, GL_RGBA, GL_UNSIGNED_BYTE, m_tex_temp );
+        palette[i] = (r | (g << 8) | (b << 16) | 0xff000000);
     }
+}
+
+void ncc_palette_cached(const GuNccTable* ncc_table, uint32_t* palette)
+{
+    std::lock_guard<std::mutex> guard(ncc_palette_cache_lock);
+
+    for(const std::unique_ptr<NccPaletteCacheEntry>& entry : ncc_palette_cache)
+    {
+        if(ncc_table_equal(&entry->table, ncc_table))
+        {
+            std::memcpy(palette, entry->palette, sizeof(entry->palette));
+            return;
+        }
+    }
+
+    // Evict the oldest table once the cache is full
+    if(ncc_palette_cache.size() == NCC_PALETTE_CACHE_SIZE)
+        ncc_palette_cache.erase(ncc_palette_cache.begin());
 
-    FILE* pFile = fopen("out.raw", "wb");
-    fwrite(data.data(), 1, data.size(), pFile);
-    fclose(pFile);
+    std::unique_ptr<NccPaletteCacheEntry> entry(new NccPaletteCacheEntry);
+    entry->table = *ncc_table;
+    ncc_to_palette(ncc_table, entry->palette);
+    std::memcpy(palette, entry->palette, sizeof(entry->palette));
+    ncc_palette_cache.push_back(std::move(entry));
 }
 
-void pal256_to_rgb88(const GuTexPalette* pal, const uint8_t* index_data, std::vector<uint8_t>& data, int num_bytes)
+void pal256_gather(const uint32_t* palette, const uint8_t* index_data, uint32_t* dst, int num_texels, SimdLevel level)
+{
+    if(level > simd_level_detect())
+        level = simd_level_detect();
+
+    switch(level)
+    {
+#ifdef HAVE_X86_SIMD
+    case SimdLevel::AVX2:
+        pal256_gather_avx2(palette, index_data, dst, num_texels);
+        break;
+#endif
+    default:
+        pal256_gather_scalar(palette, index_data, dst, num_texels);
+        break;
+    }
+}
+
+void pal256_gather(const uint32_t* palette, const uint8_t* index_data, uint32_t* dst, int num_texels)
+{
+    pal256_gather(palette, index_data, dst, num_texels, simd_level_detect());
+}
+
+void yiq422_decode(const GuNccTable* ncc_table, const uint8_t* index_data, uint32_t* dst, int num_texels, SimdLevel level)
+{
+    if(level > simd_level_detect())
+        level = simd_level_detect();
+
+    switch(level)
+    {
+#ifdef HAVE_X86_SIMD
+    case SimdLevel::AVX2:
+        yiq422_decode_avx2(ncc_table, index_data, dst, num_texels);
+        break;
+#endif
+    // A 16 texel SSE4.1 shuffle kernel measured slower than the palette gather, so SSE4.1 gathers too
+    default:
+    {
+        uint32_t palette[256];
+
+        ncc_palette_cached(ncc_table, palette);
+        pal256_gather_scalar(palette, index_data, dst, num_texels);
+        break;
+    }
+    }
+}
+
+void yiq422_decode(const GuNccTable* ncc_table, const uint8_t* index_data, uint32_t* dst, int num_texels)
+{
+    yiq422_decode(ncc_table, index_data, dst, num_texels, simd_level_detect());
+}
+
+/**
+ * Per texture format decoder
+ */
+typedef void (*TexDecodeFunc)(const Gu3dfInfo* info, const void* src, uint32_t* dst, int num_texels, SimdLevel level);
+
+/**
+ * Texture format description, indexed by GrTextureFormat
+ */
+struct TexFormatInfo
+{
+    const char*     name;               /**< Name of this format in a .3df header */
+    int             bytes_per_texel;    /**< Size of a texel in bytes (0 for reserved formats) */
+    TexDecodeFunc   decode;             /**< Decoder to RGBA8888 */
+};
+
+// 256 entry palettes for the 8-bit formats that don't carry a table
+static const uint32_t* rgb332_palette()
+{
+    static const struct Palette
+    {
+        uint32_t data[256];
+        Palette()
+        {
+            for(uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t r = (i >> 5) & 0x7;
+                uint32_t g = (i >> 2) & 0x7;
+                uint32_t b = i & 0x3;
+                data[i] = rgba8((r << 5) | (r << 2) | (r >> 1), (g << 5) | (g << 2) | (g >> 1), b * 0x55, 0xff);
+            }
+        }
+    } palette;
+
+    return palette.data;
+}
+
+static const uint32_t* alpha8_palette()
+{
+    static const struct Palette
+    {
+        uint32_t data[256];
+        Palette()
+        {
+            for(uint32_t i = 0; i < 256; i++)
+                data[i] = rgba8(i, i, i, i);
+        }
+    } palette;
+
+    return palette.data;
+}
+
+static const uint32_t* intensity8_palette()
+{
+    static const struct Palette
+    {
+        uint32_t data[256];
+        Palette()
+        {
+            for(uint32_t i = 0; i < 256; i++)
+                data[i] = rgba8(i, i, i, 0xff);
+        }
+    } palette;
+
+    return palette.data;
+}
+
+static const uint32_t* ai44_palette()
+{
+    static const struct Palette
+    {
+        uint32_t data[256];
+        Palette()
+        {
+            for(uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t intensity = expand4(i & 0xf);
+                data[i] = rgba8(intensity, intensity, intensity, expand4(i >> 4));
+            }
+        }
+    } palette;
+
+    return palette.data;
+}
+
+/**
+ * Convert a Glide palette (0x00RRGGBB entries) to RGBA8888
+ */
+static void glide_palette_to_rgba8(const GuTexPalette* pal, uint32_t* palette)
 {
-    for(int i = 0; i < num_bytes; i++)
+    for(int i = 0; i < 256; i++)
     {
-        uint32_t pixel = pal->data[index_data[i]];
+        uint32_t entry = pal->data[i];
+        palette[i] = rgba8((entry >> 16) & 0xff, (entry >> 8) & 0xff, entry & 0xff, 0xff);
+    }
+}
+
+static void alpha_pal256_gather(const uint32_t* palette, const void* src, uint32_t* dst, int num_texels, SimdLevel level)
+{
+    const uint16_t* texels = reinterpret_cast<const uint16_t*>(src);
+
+#ifdef HAVE_X86_SIMD
+    if(level >= SimdLevel::AVX2)
+    {
+        alpha_pal256_gather_avx2(palette, texels, dst, num_texels);
+        return;
+    }
+#else
+    (void)level;
+#endif
+    alpha_pal256_gather_scalar(palette, texels, dst, num_texels);
+}
+
+static void decode_rgb332(const Gu3dfInfo*, const void* src, uint32_t* dst, int num_texels, SimdLevel level)
+{
+    pal256_gather(rgb332_palette(), reinterpret_cast<const uint8_t*>(src), dst, num_texels, level);
+}
+
+static void decode_yiq422(const Gu3dfInfo* info, const void* src, uint32_t* dst, int num_texels, SimdLevel level)
+{
+    yiq422_decode(&info->table.nccTable, reinterpret_cast<const uint8_t*>(src), dst, num_texels, level);
+}
+
+static void decode_alpha8(const Gu3dfInfo*, const void* src, uint32_t* dst, int num_texels, SimdLevel level)
+{
+    pal256_gather(alpha8_palette(), reinterpret_cast<const uint8_t*>(src), dst, num_texels, level);
+}
+
+static void decode_intensity8(const Gu3dfInfo*, const void* src, uint32_t* dst, int num_texels, SimdLevel level)
+{
+    pal256_gather(intensity8_palette(), reinterpret_cast<const uint8_t*>(src), dst, num_texels, level);
+}
+
+static void decode_ai44(const Gu3dfInfo*, const void* src, uint32_t* dst, int num_texels, SimdLevel level)
+{
+    pal256_gather(ai44_palette(), reinterpret_cast<const uint8_t*>(src), dst, num_texels, level);
+}
+
+static void decode_p8(const Gu3dfInfo* info, const void* src, uint32_t* dst, int num_texels, SimdLevel level)
+{
+    uint32_t palette[256];
+
+    glide_palette_to_rgba8(&info->table.palette, palette);
+    pal256_gather(palette, reinterpret_cast<const uint8_t*>(src), dst, num_texels, level);
+}
+
+static void decode_argb8332(const Gu3dfInfo*, const void* src, uint32_t* dst, int num_texels, SimdLevel level)
+{
+    alpha_pal256_gather(rgb332_palette(), src, dst, num_texels, level);
+}
+
+static void decode_ayiq8422(const Gu3dfInfo* info, const void* src, uint32_t* dst, int num_texels, SimdLevel level)
+{
+    uint32_t palette[256];
 
-        uint8_t r = (pixel >> 16) & 0xff;
-        uint8_t g = (pixel >> 8) & 0xff;
-        uint8_t b = pixel & 0xff;
+    ncc_palette_cached(&info->table.nccTable, palette);
+    alpha_pal256_gather(palette, src, dst, num_texels, level);
+}
+
+static void decode_rgb565(const Gu3dfInfo*, const void* src, uint32_t* dst, int num_texels, SimdLevel level)
+{
+    const uint16_t* texels = reinterpret_cast<const uint16_t*>(src);
 
-        data.push_back(b);
-        data.push_back(g);
-        data.push_back(r);
-        data.push_back(0xff);
+#ifdef HAVE_X86_SIMD
+    if(level >= SimdLevel::SSE41)
+    {
+        rgb565_decode_sse41(texels, dst, num_texels);
+        return;
     }
-}
\ No newline at end of file
+#else
+    (void)level;
+#endif
+    rgb565_decode_scalar(texels, dst, num_texels);
+}
+
+static void decode_argb1555(const Gu3dfInfo*, const void* src, uint32_t* dst, int num_texels, SimdLevel level)
+{
+    const uint16_t* texels = reinterpret_cast<const uint16_t*>(src);
+
+#ifdef HAVE_X86_SIMD
+    if(level >= SimdLevel::SSE41)
+    {
+        argb1555_decode_sse41(texels, dst, num_texels);
+        return;
+    }
+#else
+    (void)level;
+#endif
+    argb1555_decode_scalar(texels, dst, num_texels);
+}
+
+static void decode_argb4444(const Gu3dfInfo*, const void* src, uint32_t* dst, int num_texels, SimdLevel level)
+{
+    const uint16_t* texels = reinterpret_cast<const uint16_t*>(src);
+
+#ifdef HAVE_X86_SIMD
+    if(level >= SimdLevel::SSE41)
+    {
+        argb4444_decode_sse41(texels, dst, num_texels);
+        return;
+    }
+#else
+    (void)level;
+#endif
+    argb4444_decode_scalar(texels, dst, num_texels);
+}
+
+static void decode_ai88(const Gu3dfInfo*, const void* src, uint32_t* dst, int num_texels, SimdLevel level)
+{
+    alpha_pal256_gather(intensity8_palette(), src, dst, num_texels, level);
+}
+
+static void decode_ap88(const Gu3dfInfo* info, const void* src, uint32_t* dst, int num_texels, SimdLevel level)
+{
+    uint32_t palette[256];
+
+    glide_palette_to_rgba8(&info->table.palette, palette);
+    alpha_pal256_gather(palette, src, dst, num_texels, level);
+}
+
+static const TexFormatInfo tex_formats[16] =
+{
+    {"rgb332",      1, decode_rgb332},      // GR_TEXFMT_RGB_332
+    {"yiq",         1, decode_yiq422},      // GR_TEXFMT_YIQ_422
+    {"a8",          1, decode_alpha8},      // GR_TEXFMT_ALPHA_8
+    {"i8",          1, decode_intensity8},  // GR_TEXFMT_INTENSITY_8
+    {"ai44",        1, decode_ai44},        // GR_TEXFMT_ALPHA_INTENSITY_44
+    {"p8",          1, decode_p8},          // GR_TEXFMT_P_8
+    {nullptr,       0, nullptr},            // GR_TEXFMT_RSVD1
+    {nullptr,       0, nullptr},            // GR_TEXFMT_RSVD2
+    {"argb8332",    2, decode_argb8332},    // GR_TEXFMT_ARGB_8332
+    {"ayiq8422",    2, decode_ayiq8422},    // GR_TEXFMT_AYIQ_8422
+    {"rgb565",      2, decode_rgb565},      // GR_TEXFMT_RGB_565
+    {"argb1555",    2, decode_argb1555},    // GR_TEXFMT_ARGB_1555
+    {"argb4444",    2, decode_argb4444},    // GR_TEXFMT_ARGB_4444
+    {"ai88",        2, decode_ai88},        // GR_TEXFMT_ALPHA_INTENSITY_88
+    {"ap88",        2, decode_ap88},        // GR_TEXFMT_AP_88
+    {nullptr,       0, nullptr}             // GR_TEXFMT_RSVD4
+};
+
+static const TexFormatInfo* tex_format_info(GrTextureFormat_t format)
+{
+    if(format >= sizeof(tex_formats) / sizeof(tex_formats[0]) || tex_formats[format].decode == nullptr)
+        return nullptr;
+
+    return &tex_formats[format];
+}
+
+const char* tex_format_name(GrTextureFormat_t format)
+{
+    const TexFormatInfo* fmt = tex_format_info(format);
+    return (fmt != nullptr) ? fmt->name : nullptr;
+}
+
+int tex_format_bpp(GrTextureFormat_t format)
+{
+    const TexFormatInfo* fmt = tex_format_info(format);
+    return (fmt != nullptr) ? fmt->bytes_per_texel : 0;
+}
+
+int tex_mip_levels(const Gu3dfHeader* header, TexMipLevel* levels)
+{
+    int bpp = tex_format_bpp(header->format);
+    int large_lod = header->large_lod;
+    int small_lod = header->small_lod;
+    int aspect = header->aspect_ratio;
+    FxU32 offset = 0;
+
+    if(bpp == 0 ||
+       large_lod < static_cast<int>(GrLOD::GR_LOD_256) || small_lod > static_cast<int>(GrLOD::GR_LOD_1) || large_lod > small_lod ||
+       aspect < static_cast<int>(GrAspectRatio::GR_ASPECT_8x1) || aspect > static_cast<int>(GrAspectRatio::GR_ASPECT_1x8))
+        return 0;
+
+    // The LOD gives the larger side, the aspect ratio how many times smaller the other one is
+    int aspect_shift = (aspect < static_cast<int>(GrAspectRatio::GR_ASPECT_1x1)) ? static_cast<int>(GrAspectRatio::GR_ASPECT_1x1) - aspect
+                                                                                 : aspect - static_cast<int>(GrAspectRatio::GR_ASPECT_1x1);
+    bool wide = aspect < static_cast<int>(GrAspectRatio::GR_ASPECT_1x1);
+
+    for(int lod = large_lod; lod <= small_lod; lod++)
+    {
+        TexMipLevel& level = levels[lod - large_lod];
+        int large_side = 256 >> lod;
+        int small_side = (large_side >> aspect_shift) > 0 ? (large_side >> aspect_shift) : 1;
+
+        level.width = wide ? large_side : small_side;
+        level.height = wide ? small_side : large_side;
+        level.offset = offset;
+        level.size = level.width * level.height * bpp;
+        offset += level.size;
+    }
+
+    return small_lod - large_lod + 1;
+}
+
+void rgba8_box_downsample(const uint32_t* src, int src_width, int src_height, uint32_t* dst, SimdLevel level)
+{
+    if(level > simd_level_detect())
+        level = simd_level_detect();
+
+#ifdef HAVE_X86_SIMD
+    if(level >= SimdLevel::SSE41)
+    {
+        rgba8_box_downsample_sse41(src, src_width, src_height, dst);
+        return;
+    }
+#endif
+    rgba8_box_downsample_scalar(src, src_width, src_height, dst);
+}
+
+void rgba8_box_downsample(const uint32_t* src, int src_width, int src_height, uint32_t* dst)
+{
+    rgba8_box_downsample(src, src_width, src_height, dst, simd_level_detect());
+}
+
+bool tex_format_palette(const Gu3dfInfo* info, uint32_t* palette)
+{
+    switch(static_cast<GrTextureFormat>(info->header.format))
+    {
+    case GrTextureFormat::GR_TEXFMT_RGB_332:
+        std::memcpy(palette, rgb332_palette(), 256 * sizeof(uint32_t));
+        return true;
+    case GrTextureFormat::GR_TEXFMT_YIQ_422:
+        ncc_palette_cached(&info->table.nccTable, palette);
+        return true;
+    case GrTextureFormat::GR_TEXFMT_ALPHA_8:
+        std::memcpy(palette, alpha8_palette(), 256 * sizeof(uint32_t));
+        return true;
+    case GrTextureFormat::GR_TEXFMT_INTENSITY_8:
+        std::memcpy(palette, intensity8_palette(), 256 * sizeof(uint32_t));
+        return true;
+    case GrTextureFormat::GR_TEXFMT_ALPHA_INTENSITY_44:
+        std::memcpy(palette, ai44_palette(), 256 * sizeof(uint32_t));
+        return true;
+    case GrTextureFormat::GR_TEXFMT_P_8:
+        glide_palette_to_rgba8(&info->table.palette, palette);
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool decode_3df(const Gu3dfInfo* info, const void* src, uint32_t* dst, int num_texels, SimdLevel level)
+{
+    const TexFormatInfo* fmt = tex_format_info(info->header.format);
+
+    if(fmt == nullptr)
+        return false;
+
+    if(level > simd_level_detect())
+        level = simd_level_detect();
+
+    fmt->decode(info, src, dst, num_texels, level);
+    return true;
+}
+
+bool decode_3df(const Gu3dfInfo* info, const void* src, uint32_t* dst, int num_texels)
+{
+    return decode_3df(info, src, dst, num_texels, simd_level_detect());
+}
+
+bool decode_3df_parallel(const Gu3dfInfo* info, const void* src, uint32_t* dst, int num_texels, CWorkerPool& pool)
+{
+    int bpp = tex_format_bpp(info->header.format);
+    int width = std::max(static_cast<int>(info->header.width), 1);
+    int tile_texels = std::max(DECODE_TILE_TEXELS / width, 1) * width;
+    int num_tiles = (num_texels + tile_texels - 1) / tile_texels;
+
+    if(bpp == 0)
+        return false;
+
+    pool.parallel_for(num_tiles, [&](int tile)
+    {
+        int first = tile * tile_texels;
+        int count = std::min(tile_texels, num_texels - first);
+
+        decode_3df(info, static_cast<const uint8_t*>(src) + first * bpp, dst + first, count);
+    });
+
+    return true;
+}
+
+bool decode_3df_level(const Gu3dfInfo* info, const TexMipLevel& mip, void* dst, std::size_t dst_size, CWorkerPool* pool)
+{
+    std::size_t num_texels = static_cast<std::size_t>(mip.width) * mip.height;
+
+    if(dst_size < num_texels * sizeof(uint32_t))
+        return false;
+
+    // A header whose LOD range doesn't match the data would have us read past it
+    if(info->data == nullptr || static_cast<std::size_t>(mip.offset) + mip.size > info->mem_required)
+        return false;
+
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(info->data) + mip.offset;
+
+    if(pool != nullptr)
+        return decode_3df_parallel(info, src, static_cast<uint32_t*>(dst), static_cast<int>(num_texels), *pool);
+    return decode_3df(info, src, static_cast<uint32_t*>(dst), static_cast<int>(num_texels));
+}
+
+void yiq422_to_rgb888(const GuNccTable* ncc_table, const uint8_t* index_data, std::vector<uint32_t>& data, int num_bytes)
+{
+    std::size_t offset = data.size();
+
+    data.resize(offset + num_bytes);
+    yiq422_decode(ncc_table, index_data, data.data() + offset, num_bytes);
+}
+
+void pal256_to_rgb88(const GuTexPalette* pal, const uint8_t* index_data, std::vector<uint8_t>& data, int num_bytes)
+{
+    uint32_t palette[256];
+    std::size_t offset = data.size();
+
+    // Glide palette entries are 0x00RRGGBB, which is already B, G, R in memory
+    for(int i = 0; i < 256; i++)
+        palette[i] = (pal->data[i] & 0x00ffffff) | 0xff000000;
+
+    data.resize(offset + num_bytes * sizeof(uint32_t));
+    pal256_gather(palette, index_data, reinterpret_cast<uint32_t*>(data.data() + offset), num_bytes);
+}
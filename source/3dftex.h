@@ -3,6 +3,7 @@
  */
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
@@ -15,6 +16,18 @@ typedef int             FxBool;
 
 typedef FxI32 GrAspectRatio_t;
 enum class GrAspectRatio : FxI32
+{
+    GR_ASPECT_8x1   = 0x0,  /* 8W x 1H */
+    GR_ASPECT_4x1   = 0x1,  /* 4W x 1H */
+    GR_ASPECT_2x1   = 0x2,  /* 2W x 1H */
+    GR_ASPECT_1x1   = 0x3,  /* 1W x 1H */
+    GR_ASPECT_1x2   = 0x4,  /* 1W x 2H */
+    GR_ASPECT_1x4   = 0x5,  /* 1W x 4H */
+    GR_ASPECT_1x8   = 0x6   /* 1W x 8H */
+};
+
+typedef FxU32 GrTextureFormat_t;
+enum class GrTextureFormat : FxU32
 {
     GR_TEXFMT_8BIT                  = 0,               
     GR_TEXFMT_RGB_332               = GR_TEXFMT_8BIT,
@@ -36,8 +49,8 @@ enum class GrAspectRatio : FxI32
     GR_TEXFMT_RSVD4                 = 0xf
 };
 
-typedef FxU32 GrTextureFormat_t;
-enum class GrTextureFormat : FxU32
+typedef FxI32 GrLOD_t;
+enum class GrLOD : FxI32
 {
     GR_LOD_256      = 0x0,
     GR_LOD_128      = 0x1,
@@ -50,8 +63,6 @@ enum class GrTextureFormat : FxU32
     GR_LOD_1        = 0x8
 };
 
-typedef FxI32 GrLOD_t;
-
 /*
 ** 3DF texture file structs
 */
@@ -88,6 +99,182 @@ typedef struct
   FxU32        mem_required;    /* memory required for mip map in bytes. */
 } Gu3dfInfo;
 
+/*
+** Location of one mipmap level inside of Gu3dfInfo::data
+*/
+typedef struct
+{
+  int   width, height;
+  FxU32 offset;                 /* offset from the start of the texture data in bytes */
+  FxU32 size;                   /* size of this level in bytes */
+} TexMipLevel;
+
+static constexpr int TEX_MAX_MIP_LEVELS = 9;    /* 256x256 down to 1x1 */
+
+class CWorkerPool;
+
+
+/**
+ * SIMD instruction set used by the texture decoders
+ */
+enum class SimdLevel
+{
+    SCALAR = 0,
+    SSE41,
+    AVX2
+};
+
+/**
+ * Detect the best SIMD level supported by the host CPU. The result is cached after the first call.
+ */
+SimdLevel simd_level_detect();
+
+/**
+ * Human readable name of a SIMD level (for logging)
+ */
+const char* simd_level_name(SimdLevel level);
+
+/**
+ * Decode YIQ422 (NCC) indices into RGBA8888 texels (R in the lowest byte).
+ *
+ * The AVX2 kernel looks the Y and the combined I/Q terms up with nibble shuffles, while the
+ * scalar and SSE4.1 kernels are a gather from the table's cached 256 entry palette.
+ *
+ * @param ncc_table     NCC table the indices refer to
+ * @param index_data    Source indices, one byte per texel
+ * @param dst           Destination buffer. Must have room for @p num_texels texels
+ * @param num_texels    Number of texels to decode
+ * @param level         Kernel to use. Levels the CPU doesn't support fall back to the best one it does.
+ */
+void yiq422_decode(const GuNccTable* ncc_table, const uint8_t* index_data, uint32_t* dst, int num_texels, SimdLevel level);
+void yiq422_decode(const GuNccTable* ncc_table, const uint8_t* index_data, uint32_t* dst, int num_texels);
+
+/**
+ * Expand an NCC table into the 256 RGBA8888 texels its indices decode to.
+ *
+ * @param ncc_table NCC table to expand
+ * @param palette   Destination, 256 entries
+ */
+void ncc_to_palette(const GuNccTable* ncc_table, uint32_t* palette);
+
+/**
+ * Get the expanded palette of an NCC table.
+ *
+ * Palettes are cached by table contents, so textures that share an NCC table only pay for the
+ * expansion once.
+ *
+ * @param ncc_table NCC table to expand
+ * @param palette   Destination, 256 entries
+ */
+void ncc_palette_cached(const GuNccTable* ncc_table, uint32_t* palette);
 
+/**
+ * Look up every index in a 256 entry palette of 32-bit texels.
+ *
+ * @param palette       256 entry palette
+ * @param index_data    Source indices, one byte per texel
+ * @param dst           Destination buffer. Must have room for @p num_texels texels
+ * @param num_texels    Number of texels to decode
+ * @param level         Kernel to use. Levels the CPU doesn't support fall back to the best one it does.
+ */
+void pal256_gather(const uint32_t* palette, const uint8_t* index_data, uint32_t* dst, int num_texels, SimdLevel level);
+void pal256_gather(const uint32_t* palette, const uint8_t* index_data, uint32_t* dst, int num_texels);
+
+/**
+ * Name of a texture format as it appears in a .3df file header (e.g "yiq"), or nullptr
+ * if @p format is reserved.
+ */
+const char* tex_format_name(GrTextureFormat_t format);
+
+/**
+ * Size of one texel of @p format in bytes, or 0 if the format is reserved.
+ */
+int tex_format_bpp(GrTextureFormat_t format);
+
+/**
+ * Get the 256 entry RGBA8888 palette that the texels of an 8-bit texture format index into.
+ *
+ * @param info      Texture to get the palette of. NCC and P8 textures take it from @p info->table
+ * @param palette   Destination, 256 entries
+ *
+ * @return false if @p info isn't an 8-bit format.
+ */
+bool tex_format_palette(const Gu3dfInfo* info, uint32_t* palette);
+
+/**
+ * Work out the size and location of every mipmap level a .3df texture carries.
+ *
+ * Levels are stored largest first, from @p header->large_lod down to @p header->small_lod, and
+ * their sizes follow from the LOD and the aspect ratio.
+ *
+ * @param header    Texture header
+ * @param levels    Destination, room for @ref TEX_MAX_MIP_LEVELS levels
+ *
+ * @return Number of levels, or 0 if the header is invalid.
+ */
+int tex_mip_levels(const Gu3dfHeader* header, TexMipLevel* levels);
+
+/**
+ * Downsample an RGBA8888 image by 2x2 box filtering (one mipmap step).
+ *
+ * Each destination texel is the rounded average of the source texels it covers. A dimension that is
+ * already 1 stays 1.
+ *
+ * @param src           Source texels
+ * @param src_width     Source width
+ * @param src_height    Source height
+ * @param dst           Destination, room for max(src_width / 2, 1) * max(src_height / 2, 1) texels
+ * @param level         Kernel to use. Levels the CPU doesn't support fall back to the best one it does.
+ */
+void rgba8_box_downsample(const uint32_t* src, int src_width, int src_height, uint32_t* dst, SimdLevel level);
+void rgba8_box_downsample(const uint32_t* src, int src_width, int src_height, uint32_t* dst);
+
+/**
+ * Decode texels of any Glide texture format into RGBA8888 (R in the lowest byte).
+ *
+ * The decoder is picked from @p info->header.format. NCC and palette based formats take
+ * their table from @p info->table. 16-bit formats are read in host byte order.
+ *
+ * @param info          Texture the texels belong to
+ * @param src           Source texels (e.g @p info->data, or a single mipmap level of it)
+ * @param dst           Destination buffer. Must have room for @p num_texels texels
+ * @param num_texels    Number of texels to decode
+ * @param level         Kernel to use. Levels the CPU doesn't support fall back to the best one it does.
+ *
+ * @return false if the format is reserved and nothing was decoded.
+ */
+bool decode_3df(const Gu3dfInfo* info, const void* src, uint32_t* dst, int num_texels, SimdLevel level);
+bool decode_3df(const Gu3dfInfo* info, const void* src, uint32_t* dst, int num_texels);
+
+/**
+ * Decode texels of any Glide texture format on every thread of @p pool.
+ *
+ * The texels are split into tiles of whole rows of @p info->header.width, each small enough to stay
+ * in cache, which the pool hands out as threads become free. Every tile decodes the same way no matter
+ * which thread runs it, so the output is identical to @ref decode_3df for any number of threads.
+ * @p src may span several mipmap levels, as they are stored back to back.
+ *
+ * @return false if the format is reserved and nothing was decoded.
+ */
+bool decode_3df_parallel(const Gu3dfInfo* info, const void* src, uint32_t* dst, int num_texels, CWorkerPool& pool);
+
+/**
+ * Decode one mipmap level of a texture into a destination the caller owns, e.g a mapped pixel buffer.
+ *
+ * @param info      Texture the level belongs to. The texels are read from @p info->data
+ * @param mip       Level to decode, from @ref tex_mip_levels
+ * @param dst       Destination, tightly packed RGBA8888 rows
+ * @param dst_size  Size of @p dst in bytes
+ * @param pool      If not null, the level is decoded over it with @ref decode_3df_parallel
+ *
+ * @return false if @p dst is too small, @p mip lies outside @p info->mem_required bytes of data or the
+ * format is reserved, in which case nothing is written.
+ */
+bool decode_3df_level(const Gu3dfInfo* info, const TexMipLevel& mip, void* dst, std::size_t dst_size, CWorkerPool* pool = nullptr);
+
+/**
+ * Legacy decoders, appending to a vector. Use @ref decode_3df or @ref decode_3df_level instead, which
+ * write into a buffer the caller owns.
+ */
 void yiq422_to_rgb888(const GuNccTable* ncc_table, const uint8_t* index_data, std::vector<uint32_t>& data, int num_bytes);
 void pal256_to_rgb88(const GuTexPalette* pal, const uint8_t* index_data, std::vector<uint8_t>& data, int num_bytes);
\ No newline at end of file
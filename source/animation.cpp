@@ -0,0 +1,112 @@
+/**
+ * Keyframed splash animation, played back by time
+ */
+#include "animation.h"
+#include "log.hpp"
+#include <algorithm>
+#include <cmath>
+
+constexpr double CAnimation::KEYFRAME_RATE;
+
+/**
+ * Take a model matrix apart. It has to be an affine transform without any shear, which the splash
+ * matrices are (@ref CAnimation::verify checks).
+ */
+static KeyTransform decompose(const glm::mat4& m)
+{
+    KeyTransform key;
+    glm::mat3 basis(m);
+
+    key.translation = glm::vec3(m[3]);
+    key.scale = glm::vec3(glm::length(basis[0]), glm::length(basis[1]), glm::length(basis[2]));
+
+    // Keep the rotation proper, and put any reflection in the scale
+    if(glm::determinant(basis) < 0.0f)
+        key.scale.x = -key.scale.x;
+
+    for(int axis = 0; axis < 3; axis++)
+    {
+        if(key.scale[axis] != 0.0f)
+            basis[axis] = basis[axis] / key.scale[axis];
+    }
+
+    key.rotation = glm::normalize(glm::quat_cast(basis));
+    return key;
+}
+
+static glm::mat4 compose(const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale)
+{
+    glm::mat3 basis = glm::mat3_cast(rotation);
+    glm::mat4 m(1.0f);
+
+    for(int axis = 0; axis < 3; axis++)
+        m[axis] = glm::vec4(basis[axis] * scale[axis], 0.0f);
+    m[3] = glm::vec4(translation, 1.0f);
+    return m;
+}
+
+void CAnimation::load(const Matrix* matrices, int num_keyframes, int num_objects)
+{
+    keyframes = num_keyframes;
+    objects = num_objects;
+    keys.resize(static_cast<std::size_t>(num_keyframes) * num_objects);
+
+    for(std::size_t i = 0; i < keys.size(); i++)
+        keys[i] = decompose(matrices[i]);
+}
+
+double CAnimation::wrap(double position) const
+{
+    position = std::fmod(position, static_cast<double>(keyframes));
+    return position < 0.0 ? position + keyframes : position;
+}
+
+glm::mat4 CAnimation::sample(int object, double position) const
+{
+    position = wrap(position);
+
+    int keyframe = std::min(static_cast<int>(position), keyframes - 1);
+    float t = static_cast<float>(position - keyframe);
+    const KeyTransform& a = key(keyframe, object);
+
+    if(keyframe == keyframes - 1 || t == 0.0f)
+        return compose(a.translation, a.rotation, a.scale);
+
+    const KeyTransform& b = key(keyframe + 1, object);
+    glm::quat to = b.rotation;
+
+    // q and -q are the same rotation, so go the short way round
+    if(glm::dot(a.rotation, to) < 0.0f)
+        to = -to;
+
+    return compose(glm::mix(a.translation, b.translation, t), glm::slerp(a.rotation, to, t), glm::mix(a.scale, b.scale, t));
+}
+
+float CAnimation::verify(const Matrix* matrices) const
+{
+    float worst = 0.0f;
+
+    for(int keyframe = 0; keyframe < keyframes; keyframe++)
+    {
+        for(int object = 0; object < objects; object++)
+        {
+            const glm::mat4& original = matrices[keyframe * objects + object];
+            glm::mat4 sampled = sample(object, keyframe);
+            float largest = 0.0f;
+            float difference = 0.0f;
+
+            for(int c = 0; c < 4; c++)
+            {
+                for(int r = 0; r < 4; r++)
+                {
+                    largest = std::max(largest, std::fabs(original[c][r]));
+                    difference = std::max(difference, std::fabs(original[c][r] - sampled[c][r]));
+                }
+            }
+
+            worst = std::max(worst, largest > 0.0f ? difference / largest : difference);
+        }
+    }
+
+    return worst;
+}
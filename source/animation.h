@@ -0,0 +1,67 @@
+/**
+ * Keyframed splash animation, played back by time
+ */
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <vector>
+#include "types.h"
+
+/**
+ * A keyframe matrix taken apart. Negative scale on x stands for a reflection, which a rotation can't hold.
+ */
+struct KeyTransform
+{
+    glm::vec3 translation;
+    glm::quat rotation;
+    glm::vec3 scale;
+};
+
+/**
+ * The splash animation: a model matrix per object for every keyframe, decomposed into translation,
+ * rotation and scale when it's loaded so it can be sampled at any time in between.
+ *
+ * Positions are in keyframes, from 0 up to (not including) the number of keyframes. Sampling between
+ * two keyframes lerps the translation and scale and slerps the rotation. The last keyframe is held until
+ * the animation loops, like the original, which jumped straight back to the first.
+ */
+class CAnimation final
+{
+public:
+    static constexpr double KEYFRAME_RATE = 1000.0 / 30.0;     /**< Keyframes a second. The original showed one every 30ms */
+
+public:
+    /**
+     * Decompose every keyframe.
+     *
+     * @param matrices  num_keyframes * num_objects matrices, a row of objects per keyframe
+     */
+    void load(const Matrix* matrices, int num_keyframes, int num_objects);
+
+    int num_keyframes() const { return keyframes; }
+
+    /**
+     * Model matrix of @p object at @p position
+     */
+    glm::mat4 sample(int object, double position) const;
+
+    /**
+     * Check that sampling at every keyframe gives back the matrices it was loaded from.
+     *
+     * @return the largest difference of any element, relative to the largest element of its matrix
+     */
+    float verify(const Matrix* matrices) const;
+
+    /**
+     * Wrap a position into the animation
+     */
+    double wrap(double position) const;
+
+private:
+    const KeyTransform& key(int keyframe, int object) const { return keys[keyframe * objects + object]; }
+
+    int keyframes = 0;
+    int objects = 0;
+    std::vector<KeyTransform> keys;
+};
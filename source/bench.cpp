@@ -0,0 +1,296 @@
+/**
+ *
+ */
+#include "bench.h"
+#include "3dftex.h"
+#include "log.hpp"
+#include "videostream.h"
+#include "workers.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static constexpr int BENCH_WIDTH = 1024;
+static constexpr int BENCH_HEIGHT = 1024;
+static constexpr double BENCH_MIN_SECONDS = 0.25;
+static constexpr int BENCH_ATLAS_SIZE = 256;            /* 256x256 with every mipmap level, like the largest .3df */
+static constexpr int BENCH_ATLAS_COUNT = 64;            /* Textures decoded back to back per iteration */
+
+/**
+ * Run @p decode until at least @ref BENCH_MIN_SECONDS have passed, and return megatexels per second.
+ */
+template<typename F>
+static double measure_mtexels(int num_texels, F decode)
+{
+    using clock = std::chrono::steady_clock;
+
+    int iterations = 0;
+    clock::time_point start = clock::now();
+    std::chrono::duration<double> elapsed;
+
+    do
+    {
+        decode();
+        iterations++;
+        elapsed = clock::now() - start;
+    } while(elapsed.count() < BENCH_MIN_SECONDS);
+
+    return (static_cast<double>(num_texels) * iterations) / (elapsed.count() * 1e6);
+}
+
+static int bench_yiq422(std::mt19937& rng)
+{
+    const int num_texels = BENCH_WIDTH * BENCH_HEIGHT;
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::uniform_int_distribution<int> iq(-256, 255);
+    std::vector<uint8_t> indices(num_texels);
+    std::vector<uint32_t> reference(num_texels);
+    std::vector<uint32_t> output(num_texels);
+    GuNccTable table;
+    int ret = 0;
+
+    for(int i = 0; i < 16; i++)
+        table.yRGB[i] = static_cast<FxU8>(byte(rng));
+
+    for(int i = 0; i < 4; i++)
+    {
+        for(int c = 0; c < 3; c++)
+        {
+            table.iRGB[i][c] = static_cast<FxI16>(iq(rng));
+            table.qRGB[i][c] = static_cast<FxI16>(iq(rng));
+        }
+    }
+
+    for(uint8_t& index : indices)
+        index = static_cast<uint8_t>(byte(rng));
+
+    yiq422_decode(&table, indices.data(), reference.data(), num_texels, SimdLevel::SCALAR);
+    for(int l = static_cast<int>(SimdLevel::SCALAR); l <= static_cast<int>(simd_level_detect()); l++)
+    {
+        SimdLevel level = static_cast<SimdLevel>(l);
+        double mtexels = measure_mtexels(num_texels, [&]() { yiq422_decode(&table, indices.data(), output.data(), num_texels, level); });
+
+        if(std::memcmp(reference.data(), output.data(), num_texels * sizeof(uint32_t)) != 0)
+        {
+            log(LogLevel::ERROR, "yiq422 %s: output differs from the scalar decoder!\n", simd_level_name(level));
+            ret = 1;
+        }
+
+        log(LogLevel::INFO, "yiq422 %-8s %10.1f Mtexel/s\n", simd_level_name(level), mtexels);
+    }
+
+    return ret;
+}
+
+static int bench_pal256(std::mt19937& rng)
+{
+    const int num_texels = BENCH_WIDTH * BENCH_HEIGHT;
+    std::uniform_int_distribution<uint32_t> word;
+    std::vector<uint8_t> indices(num_texels);
+    std::vector<uint32_t> reference(num_texels);
+    std::vector<uint32_t> output(num_texels);
+    uint32_t palette[256];
+    int ret = 0;
+
+    for(uint32_t& entry : palette)
+        entry = word(rng);
+
+    for(uint8_t& index : indices)
+        index = static_cast<uint8_t>(word(rng));
+
+    pal256_gather(palette, indices.data(), reference.data(), num_texels, SimdLevel::SCALAR);
+    for(int l = static_cast<int>(SimdLevel::SCALAR); l <= static_cast<int>(simd_level_detect()); l++)
+    {
+        SimdLevel level = static_cast<SimdLevel>(l);
+        double mtexels = measure_mtexels(num_texels, [&]() { pal256_gather(palette, indices.data(), output.data(), num_texels, level); });
+
+        if(std::memcmp(reference.data(), output.data(), num_texels * sizeof(uint32_t)) != 0)
+        {
+            log(LogLevel::ERROR, "pal256 %s: output differs from the scalar gather!\n", simd_level_name(level));
+            ret = 1;
+        }
+
+        log(LogLevel::INFO, "pal256 %-8s %10.1f Mtexel/s\n", simd_level_name(level), mtexels);
+    }
+
+    return ret;
+}
+
+static int bench_formats(std::mt19937& rng)
+{
+    const int num_texels = BENCH_WIDTH * BENCH_HEIGHT;
+    std::uniform_int_distribution<uint32_t> word;
+    std::uniform_int_distribution<int> iq(-256, 255);
+    std::vector<uint8_t> texels(num_texels * 2);
+    std::vector<uint32_t> reference(num_texels);
+    std::vector<uint32_t> output(num_texels);
+    Gu3dfInfo info = {};
+    int ret = 0;
+
+    for(uint8_t& texel : texels)
+        texel = static_cast<uint8_t>(word(rng));
+
+    // Every format gets the same random table; NCC formats only look at the first part of it
+    for(uint32_t& entry : info.table.palette.data)
+        entry = word(rng);
+
+    for(int i = 0; i < 4; i++)
+    {
+        for(int c = 0; c < 3; c++)
+        {
+            info.table.nccTable.iRGB[i][c] = static_cast<FxI16>(iq(rng));
+            info.table.nccTable.qRGB[i][c] = static_cast<FxI16>(iq(rng));
+        }
+    }
+
+    info.header.width = BENCH_WIDTH;
+    info.header.height = BENCH_HEIGHT;
+    info.data = texels.data();
+
+    for(GrTextureFormat_t format = 0; format < 16; format++)
+    {
+        if(tex_format_bpp(format) == 0)
+            continue;
+
+        info.header.format = format;
+        decode_3df(&info, info.data, reference.data(), num_texels, SimdLevel::SCALAR);
+        for(int l = static_cast<int>(SimdLevel::SCALAR); l <= static_cast<int>(simd_level_detect()); l++)
+        {
+            SimdLevel level = static_cast<SimdLevel>(l);
+            double mtexels = measure_mtexels(num_texels, [&]() { decode_3df(&info, info.data, output.data(), num_texels, level); });
+
+            if(std::memcmp(reference.data(), output.data(), num_texels * sizeof(uint32_t)) != 0)
+            {
+                log(LogLevel::ERROR, "%s %s: output differs from the scalar decoder!\n", tex_format_name(format), simd_level_name(level));
+                ret = 1;
+            }
+
+            log(LogLevel::INFO, "%-8s %-8s %10.1f Mtexel/s\n", tex_format_name(format), simd_level_name(level), mtexels);
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Decode a batch of full 256x256 YIQ422 mipmap chains on 1..N threads, where N is at least the number of
+ * CPUs, and check that every thread count gives the same texels.
+ */
+static int bench_parallel(std::mt19937& rng)
+{
+    std::uniform_int_distribution<int> byte(0, 255);
+    Gu3dfInfo info = {};
+    TexMipLevel levels[TEX_MAX_MIP_LEVELS];
+    int ret = 0;
+
+    info.header.format = static_cast<GrTextureFormat_t>(GrTextureFormat::GR_TEXFMT_YIQ_422);
+    info.header.large_lod = static_cast<int>(GrLOD::GR_LOD_256);
+    info.header.small_lod = static_cast<int>(GrLOD::GR_LOD_1);
+    info.header.aspect_ratio = static_cast<GrAspectRatio_t>(GrAspectRatio::GR_ASPECT_1x1);
+    info.header.width = BENCH_ATLAS_SIZE;
+    info.header.height = BENCH_ATLAS_SIZE;
+
+    int num_levels = tex_mip_levels(&info.header, levels);
+    int texels_per_atlas = levels[num_levels - 1].offset + levels[num_levels - 1].size;
+    int num_texels = texels_per_atlas * BENCH_ATLAS_COUNT;
+    std::vector<uint8_t> indices(num_texels);
+    std::vector<uint32_t> reference(num_texels);
+    std::vector<uint32_t> output(num_texels);
+    int max_threads = std::max(4, static_cast<int>(std::thread::hardware_concurrency()));
+    double single_mtexels = 0.0;
+
+    for(int i = 0; i < 16; i++)
+        info.table.nccTable.yRGB[i] = static_cast<FxU8>(byte(rng));
+
+    for(uint8_t& index : indices)
+        index = static_cast<uint8_t>(byte(rng));
+
+    info.data = indices.data();
+    decode_3df(&info, info.data, reference.data(), num_texels);
+
+    log(LogLevel::INFO, "Decoding %d %dx%d yiq textures with every mipmap level, 1..%d threads\n", BENCH_ATLAS_COUNT, BENCH_ATLAS_SIZE, BENCH_ATLAS_SIZE, max_threads);
+    for(int threads = 1; threads <= max_threads; threads++)
+    {
+        CWorkerPool pool(threads);
+        double mtexels;
+
+        std::fill(output.begin(), output.end(), 0);
+        mtexels = measure_mtexels(num_texels, [&]()
+        {
+            // Tiles never span two textures, just like when converting a directory of them
+            for(int atlas = 0; atlas < BENCH_ATLAS_COUNT; atlas++)
+                decode_3df_parallel(&info, indices.data() + atlas * texels_per_atlas, output.data() + atlas * texels_per_atlas, texels_per_atlas, pool);
+        });
+
+        if(std::memcmp(reference.data(), output.data(), num_texels * sizeof(uint32_t)) != 0)
+        {
+            log(LogLevel::ERROR, "yiq422 on %d threads: output differs from the single threaded decoder!\n", threads);
+            ret = 1;
+        }
+
+        if(threads == 1)
+            single_mtexels = mtexels;
+
+        log(LogLevel::INFO, "yiq422 %2d threads %10.1f Mtexel/s %6.2fx\n", threads, mtexels, mtexels / single_mtexels);
+    }
+
+    return ret;
+}
+
+static int bench_yuv420(std::mt19937& rng)
+{
+    // Odd on purpose, so the edges get checked too
+    const int width = BENCH_WIDTH - 3;
+    const int height = BENCH_HEIGHT - 1;
+    const std::size_t luma_size = static_cast<std::size_t>(width) * height;
+    const std::size_t yuv_size = luma_size + 2 * static_cast<std::size_t>((width + 1) / 2) * ((height + 1) / 2);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::vector<uint8_t> rgba(luma_size * 4);
+    std::vector<uint8_t> reference(yuv_size);
+    std::vector<uint8_t> output(yuv_size);
+    int ret = 0;
+
+    for(uint8_t& channel : rgba)
+        channel = static_cast<uint8_t>(byte(rng));
+
+    auto convert = [&](std::vector<uint8_t>& yuv, SimdLevel level)
+    {
+        std::size_t chroma_size = (yuv_size - luma_size) / 2;
+        rgba_to_yuv420(rgba.data(), width, height, yuv.data(), yuv.data() + luma_size, yuv.data() + luma_size + chroma_size, level);
+    };
+
+    convert(reference, SimdLevel::SCALAR);
+    for(int l = static_cast<int>(SimdLevel::SCALAR); l <= static_cast<int>(simd_level_detect()); l++)
+    {
+        SimdLevel level = static_cast<SimdLevel>(l);
+        double mpixels = measure_mtexels(static_cast<int>(luma_size), [&]() { convert(output, level); });
+
+        if(reference != output)
+        {
+            log(LogLevel::ERROR, "yuv420 %s: output differs from the scalar conversion!\n", simd_level_name(level));
+            ret = 1;
+        }
+
+        log(LogLevel::INFO, "yuv420 %-8s %10.1f Mpixel/s\n", simd_level_name(level), mpixels);
+    }
+
+    return ret;
+}
+
+int bench_decoders()
+{
+    std::mt19937 rng(0x3df);
+    int ret = 0;
+
+    log(LogLevel::INFO, "Decoding %dx%d texels, best kernel is %s\n", BENCH_WIDTH, BENCH_HEIGHT, simd_level_name(simd_level_detect()));
+    ret |= bench_yiq422(rng);
+    ret |= bench_pal256(rng);
+    ret |= bench_formats(rng);
+    ret |= bench_parallel(rng);
+    ret |= bench_yuv420(rng);
+
+    return ret;
+}
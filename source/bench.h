@@ -0,0 +1,11 @@
+/**
+ * Texture decoder micro benchmarks
+ */
+#pragma once
+
+/**
+ * Run the decoder benchmarks and print the throughput of every kernel to the log.
+ *
+ * @return 0 if every kernel produced the same output as the scalar reference, 1 otherwise.
+ */
+int bench_decoders();
@@ -0,0 +1,222 @@
+/**
+ * Exporting rendered frames as images
+ */
+#include "frameexport.h"
+#include "log.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <zlib.h>
+
+bool parse_image_format(const char* name, ImageFormat& format)
+{
+    if(std::strcmp(name, "png") == 0)
+        format = ImageFormat::PNG;
+    else if(std::strcmp(name, "ppm") == 0)
+        format = ImageFormat::PPM;
+    else if(std::strcmp(name, "raw") == 0)
+        format = ImageFormat::RAW;
+    else
+        return false;
+
+    return true;
+}
+
+const char* image_format_extension(ImageFormat format)
+{
+    switch(format)
+    {
+    case ImageFormat::PNG:
+        return "png";
+    case ImageFormat::PPM:
+        return "ppm";
+    case ImageFormat::RAW:
+        return "raw";
+    }
+
+    return "";
+}
+
+static void put_be32(std::vector<uint8_t>& out, uint32_t value)
+{
+    out.push_back(static_cast<uint8_t>(value >> 24));
+    out.push_back(static_cast<uint8_t>(value >> 16));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+/**
+ * Append a PNG chunk: length, type, data and the CRC of the type and data
+ */
+static void put_png_chunk(std::vector<uint8_t>& out, const char* type, const uint8_t* data, std::size_t size)
+{
+    put_be32(out, static_cast<uint32_t>(size));
+    std::size_t start = out.size();
+
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + size);
+    put_be32(out, static_cast<uint32_t>(crc32(crc32(0, nullptr, 0), &out[start], static_cast<uInt>(size + 4))));
+}
+
+/**
+ * Encode a PNG. Rows are filtered with Up, which does well on the large flat areas of the splash.
+ */
+static bool encode_png(std::vector<uint8_t>& out, const uint8_t* rgba, int width, int height)
+{
+    static const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    const std::size_t stride = static_cast<std::size_t>(width) * 4;
+    static thread_local std::vector<uint8_t> filtered;     // Kept between frames, so the encoder threads don't allocate every time
+    static thread_local std::vector<uint8_t> compressed;
+    std::vector<uint8_t> header;
+
+    filtered.resize((stride + 1) * height);
+
+    for(int y = 0; y < height; y++)
+    {
+        const uint8_t* row = rgba + (height - 1 - y) * stride;
+        uint8_t* dst = &filtered[y * (stride + 1)];
+
+        dst[0] = (y == 0) ? 0 : 2;
+        if(y == 0)
+        {
+            std::memcpy(dst + 1, row, stride);
+        }
+        else
+        {
+            const uint8_t* above = row + stride;
+
+            for(std::size_t i = 0; i < stride; i++)
+                dst[i + 1] = static_cast<uint8_t>(row[i] - above[i]);
+        }
+    }
+
+    uLongf compressed_size = compressBound(static_cast<uLong>(filtered.size()));
+    compressed.resize(compressed_size);
+    if(compress2(compressed.data(), &compressed_size, filtered.data(), static_cast<uLong>(filtered.size()), Z_DEFAULT_COMPRESSION) != Z_OK)
+        return false;
+
+    put_be32(header, static_cast<uint32_t>(width));
+    put_be32(header, static_cast<uint32_t>(height));
+    header.push_back(8);    // Bits per channel
+    header.push_back(6);    // RGBA
+    header.push_back(0);    // Deflate
+    header.push_back(0);    // Adaptive filtering
+    header.push_back(0);    // Not interlaced
+
+    out.assign(signature, signature + sizeof(signature));
+    put_png_chunk(out, "IHDR", header.data(), header.size());
+    put_png_chunk(out, "IDAT", compressed.data(), compressed_size);
+    put_png_chunk(out, "IEND", nullptr, 0);
+    return true;
+}
+
+bool encode_image(ImageFormat format, const uint8_t* rgba, int width, int height, std::vector<uint8_t>& out)
+{
+    const std::size_t stride = static_cast<std::size_t>(width) * 4;
+
+    out.clear();
+    switch(format)
+    {
+    case ImageFormat::PNG:
+        return encode_png(out, rgba, width, height);
+    case ImageFormat::PPM:
+    {
+        char header[32];
+        int header_size = std::snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+
+        out.resize(header_size + static_cast<std::size_t>(width) * height * 3);
+        std::memcpy(out.data(), header, header_size);
+
+        uint8_t* dst = &out[header_size];
+        for(int y = height - 1; y >= 0; y--)
+        {
+            for(int x = 0; x < width; x++, dst += 3)
+                std::memcpy(dst, rgba + y * stride + x * 4, 3);
+        }
+        return true;
+    }
+    case ImageFormat::RAW:
+        out.resize(stride * height);
+        for(int y = 0; y < height; y++)
+            std::memcpy(&out[y * stride], rgba + (height - 1 - y) * stride, stride);
+        return true;
+    }
+
+    return false;
+}
+
+bool write_file(const std::string& path, const std::vector<uint8_t>& data)
+{
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if(file == nullptr)
+    {
+        log(LogLevel::ERROR, "Unable to open %s: %s\n", path.c_str(), std::strerror(errno));
+        return false;
+    }
+
+    bool written = (std::fwrite(data.data(), 1, data.size(), file) == data.size());
+    written &= (std::fclose(file) == 0);
+    if(!written)
+        log(LogLevel::ERROR, "Unable to write %s: %s\n", path.c_str(), std::strerror(errno));
+
+    return written;
+}
+
+CFrameReadback::CFrameReadback(GLsizei _width, GLsizei _height)
+: width(_width), height(_height)
+{
+    glGenBuffers(2, pbos);
+    for(GLuint pbo : pbos)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<GLsizeiptr>(width) * height * 4, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+CFrameReadback::~CFrameReadback()
+{
+    glDeleteBuffers(2, pbos);
+}
+
+void CFrameReadback::read(GLuint fbo, int frame, const Callback& done)
+{
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[current]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    frames[current] = frame;
+
+    // The other buffer was read a frame ago, so it's most likely there by now
+    current = 1 - current;
+    collect(current, done);
+}
+
+void CFrameReadback::finish(const Callback& done)
+{
+    collect(1 - current, done);
+    collect(current, done);
+}
+
+void CFrameReadback::collect(int buffer, const Callback& done)
+{
+    if(frames[buffer] < 0)
+        return;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[buffer]);
+    const uint8_t* pixels = static_cast<const uint8_t*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, static_cast<GLsizeiptr>(width) * height * 4, GL_MAP_READ_BIT));
+    if(pixels != nullptr)
+    {
+        done(frames[buffer], pixels);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    else
+    {
+        log(LogLevel::ERROR, "Unable to map the pixels of frame %d\n", frames[buffer]);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    frames[buffer] = -1;
+}
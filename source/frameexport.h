@@ -0,0 +1,80 @@
+/**
+ * Exporting rendered frames as images
+ */
+#pragma once
+
+#include <GL/glew.h>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+enum class ImageFormat
+{
+    PNG,
+    PPM,    /**< Binary (P6) RGB */
+    RAW     /**< Bare RGBA8, top row first */
+};
+
+/**
+ * Image format from its name ("png", "ppm" or "raw")
+ */
+bool parse_image_format(const char* name, ImageFormat& format);
+
+/**
+ * File extension for @p format, without the dot
+ */
+const char* image_format_extension(ImageFormat format);
+
+/**
+ * Encode an image into @p out. Safe to call from several threads at once.
+ *
+ * @param rgba  RGBA8 pixels, bottom row first the way glReadPixels returns them
+ */
+bool encode_image(ImageFormat format, const uint8_t* rgba, int width, int height, std::vector<uint8_t>& out);
+
+/**
+ * Write @p data to the file at @p path, replacing it
+ */
+bool write_file(const std::string& path, const std::vector<uint8_t>& data);
+
+/**
+ * Reads frames back from the GPU without waiting on them.
+ *
+ * Every frame is read into one of two pixel buffers, and handed over when the next frame is read,
+ * so the copy of one frame overlaps drawing the next instead of stalling until it's done.
+ */
+class CFrameReadback final
+{
+public:
+    /**
+     * Called with the pixels of a frame once they're back. They're only valid during the call.
+     */
+    using Callback = std::function<void(int frame, const uint8_t* rgba)>;
+
+public:
+    CFrameReadback(GLsizei width, GLsizei height);
+    ~CFrameReadback();
+
+    CFrameReadback(const CFrameReadback&) = delete;
+    CFrameReadback& operator=(const CFrameReadback&) = delete;
+
+    /**
+     * Start reading @p frame back from @p fbo, and hand over the frame read before it.
+     */
+    void read(GLuint fbo, int frame, const Callback& done);
+
+    /**
+     * Hand over the frame still being read
+     */
+    void finish(const Callback& done);
+
+private:
+    void collect(int buffer, const Callback& done);
+
+    GLsizei width;
+    GLsizei height;
+    GLuint pbos[2];
+    int frames[2] = {-1, -1};   /**< Frame each buffer holds, or -1 */
+    int current = 0;            /**< Buffer the next frame goes into */
+};
@@ -0,0 +1,109 @@
+/**
+ * Frame pacing
+ */
+#include "framepacer.h"
+#include "log.hpp"
+#include <algorithm>
+#include <thread>
+
+static constexpr std::chrono::seconds MISS_LOG_INTERVAL{1}; /* Late frames are logged at most this often */
+
+constexpr std::chrono::microseconds CFramePacer::SPIN_TIME;
+constexpr double CFramePacer::MISS_TOLERANCE;
+
+static const char* pacing_mode_name(PacingMode mode)
+{
+    switch(mode)
+    {
+    case PacingMode::FIXED_RATE:
+        return "fixed rate";
+    case PacingMode::VSYNC:
+        return "vsync";
+    case PacingMode::ADAPTIVE_VSYNC:
+        return "adaptive vsync";
+    case PacingMode::UNLIMITED:
+        return "unlimited";
+    }
+
+    return "unknown";
+}
+
+CFramePacer::CFramePacer(PacingMode _mode, double rate)
+: mode(_mode)
+{
+    if(rate <= 0.0)
+        mode = PacingMode::UNLIMITED;
+
+    period = mode == PacingMode::UNLIMITED ? Clock::duration::zero() : std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate));
+    start = Clock::now();
+    frame_start = start;
+    deadline = start + period;
+    last_miss_log = start;
+
+    if(mode == PacingMode::UNLIMITED)
+        log(LogLevel::INFO, "Frame pacing: unlimited\n");
+    else
+        log(LogLevel::INFO, "Frame pacing: %s at %.2f fps (%.2fms a frame)\n", pacing_mode_name(mode), rate, Duration(period).count());
+}
+
+void CFramePacer::end_frame()
+{
+    Clock::time_point now = Clock::now();
+
+    frames++;
+    if(mode == PacingMode::UNLIMITED)
+    {
+        worst_ms = std::max(worst_ms, Duration(now - frame_start).count());
+        frame_start = now;
+        return;
+    }
+
+    // Late? A fixed rate frame has to be done by its deadline, a vsynced one within a refresh or so
+    Duration frame_time = now - frame_start;
+    bool late = mode == PacingMode::FIXED_RATE ? now > deadline : frame_time > period * MISS_TOLERANCE;
+    if(late)
+    {
+        missed++;
+        missed_since_log++;
+        if(now - last_miss_log >= MISS_LOG_INTERVAL)
+        {
+            log(LogLevel::WARN, "Missed %ld frame deadline(s) in the last %.1fs, this frame took %.2fms of a %.2fms budget\n",
+                missed_since_log, Duration(now - last_miss_log).count() / 1000.0, frame_time.count(), Duration(period).count());
+            missed_since_log = 0;
+            last_miss_log = now;
+        }
+    }
+
+    if(mode == PacingMode::FIXED_RATE)
+    {
+        if(late)
+        {
+            deadline = now + period;
+        }
+        else
+        {
+            // Sleeps overshoot, so sleep for most of the time left and spin the rest
+            if(deadline - now > SPIN_TIME)
+                std::this_thread::sleep_for(deadline - now - SPIN_TIME);
+            while(Clock::now() < deadline)
+                std::this_thread::yield();
+
+            deadline += period;
+        }
+    }
+
+    now = Clock::now();
+    worst_ms = std::max(worst_ms, Duration(now - frame_start).count());
+    frame_start = now;
+}
+
+void CFramePacer::log_stats() const
+{
+    Duration elapsed = Clock::now() - start;
+
+    if(frames == 0)
+        return;
+
+    log(LogLevel::INFO, "Frame pacing: %ld frames in %.2fs (%.2f fps, %.2fms average, %.2fms worst), %ld missed deadline(s)\n",
+        frames, elapsed.count() / 1000.0, frames * 1000.0 / elapsed.count(), elapsed.count() / frames, worst_ms, missed);
+}
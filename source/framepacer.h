@@ -0,0 +1,69 @@
+/**
+ * Frame pacing
+ */
+#pragma once
+
+#include <chrono>
+
+/**
+ * How frames are paced
+ */
+enum class PacingMode
+{
+    FIXED_RATE,         /**< Sleep until the next frame is due */
+    VSYNC,              /**< The swap waits for the display */
+    ADAPTIVE_VSYNC,     /**< Like VSYNC, but a late frame is shown straight away instead of waiting a whole refresh */
+    UNLIMITED           /**< As fast as possible */
+};
+
+/**
+ * Keeps frames to a steady rate, and logs the ones that miss their deadline.
+ *
+ * In @ref PacingMode::FIXED_RATE the remaining budget of a frame is slept away, except the last
+ * @ref SPIN_TIME of it, which is spun out as sleeps overshoot by about that much. A frame that misses its
+ * deadline starts the next one from now, rather than trying to catch up.
+ *
+ * With vsync the swap does the waiting, and the refresh rate is only used to spot missed deadlines.
+ */
+class CFramePacer final
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr std::chrono::microseconds SPIN_TIME{1000};
+    static constexpr double MISS_TOLERANCE = 1.25;     /**< A frame is late once it takes this many periods */
+
+public:
+    /**
+     * Constructor
+     *
+     * @param mode  How to pace
+     * @param rate  Frames per second to aim for; with vsync, the refresh rate of the display
+     */
+    CFramePacer(PacingMode mode, double rate);
+
+    /**
+     * Call after each swap. Waits until the next frame is due (if pacing a fixed rate), and logs the frame if it was late.
+     */
+    void end_frame();
+
+    /**
+     * Log the frame rate, frame times and missed deadlines so far
+     */
+    void log_stats() const;
+
+private:
+    using Duration = std::chrono::duration<double, std::milli>;
+
+    PacingMode mode;
+    Clock::duration period;
+    Clock::time_point deadline;
+    Clock::time_point frame_start;
+    Clock::time_point start;
+    Clock::time_point last_miss_log;
+
+    long frames = 0;
+    long missed = 0;
+    long missed_since_log = 0;
+    double worst_ms = 0.0;
+};
@@ -0,0 +1,130 @@
+/**
+ * Encoding and writing frames on worker threads
+ */
+#include "framepipeline.h"
+#include "log.hpp"
+#include <algorithm>
+
+CFramePipeline::CFramePipeline(int num_threads, std::size_t frame_size, const Encoder& _encoder, const Writer& _writer)
+: encoder(_encoder), writer(_writer)
+{
+    if(num_threads <= 0)
+        num_threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+
+    // Two buffers a thread, so there's always a frame waiting for a thread that's done with the last one
+    slots.resize(num_threads * 2);
+    for(Slot& slot : slots)
+        slot.pixels.reset(new uint8_t[frame_size]);
+
+    for(int i = 0; i < num_threads; i++)
+        workers.emplace_back(&CFramePipeline::worker_main, this);
+}
+
+CFramePipeline::~CFramePipeline()
+{
+    finish();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+
+    work.notify_all();
+    for(std::thread& worker : workers)
+        worker.join();
+}
+
+uint8_t* CFramePipeline::acquire()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for(;;)
+    {
+        for(Slot& slot : slots)
+        {
+            if(slot.state == Slot::State::FREE)
+            {
+                slot.state = Slot::State::QUEUED;
+                return slot.pixels.get();
+            }
+        }
+
+        progress.wait(lock);
+    }
+}
+
+void CFramePipeline::submit(uint8_t* pixels, int frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Slot* slot = &*std::find_if(slots.begin(), slots.end(), [pixels](const Slot& s) { return s.pixels.get() == pixels; });
+
+        slot->frame = frame;
+        slot->sequence = next_sequence++;
+        queue.push_back(slot);
+    }
+
+    work.notify_one();
+}
+
+bool CFramePipeline::finish()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    progress.wait(lock, [this]() { return next_write == next_sequence; });
+    return !failed;
+}
+
+void CFramePipeline::write_encoded(std::unique_lock<std::mutex>& lock)
+{
+    writing = true;
+    for(;;)
+    {
+        auto next = std::find_if(slots.begin(), slots.end(), [this](const Slot& s) { return s.state == Slot::State::ENCODED && s.sequence == next_write; });
+        if(next == slots.end())
+            break;
+
+        // Write without the lock, so the others can carry on encoding. Once one has failed there's
+        // a hole in the output, so nothing after it is written
+        bool ok = next->ok && !failed;
+        lock.unlock();
+        if(ok)
+            ok = writer(next->frame, next->encoded);
+        lock.lock();
+
+        if(!ok)
+            failed = true;
+        next->state = Slot::State::FREE;
+        next_write++;
+        progress.notify_all();
+    }
+    writing = false;
+}
+
+void CFramePipeline::worker_main()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for(;;)
+    {
+        work.wait(lock, [this]() { return quit || !queue.empty(); });
+        if(quit)
+            return;
+
+        Slot& slot = *queue.front();
+        queue.pop_front();
+        slot.state = Slot::State::ENCODING;
+        lock.unlock();
+
+        slot.encoded.clear();
+        bool ok = encoder(slot.frame, slot.pixels.get(), slot.encoded);
+        if(!ok)
+            log(LogLevel::ERROR, "Unable to encode frame %d\n", slot.frame);
+
+        lock.lock();
+        slot.ok = ok;
+        slot.state = Slot::State::ENCODED;
+        if(!writing)
+            write_encoded(lock);
+    }
+}
@@ -0,0 +1,121 @@
+/**
+ * Encoding and writing frames on worker threads
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Encodes frames on a set of worker threads, and writes them out in the order they were submitted.
+ *
+ * Frames go into buffers from a fixed pool, two per thread, which is also what bounds the queue:
+ * @ref acquire blocks while every buffer is queued or being encoded, so the render thread can't get
+ * ahead of the encoders. Buffers (and whatever the encoder put in their output) are reused, so once
+ * the pool has warmed up nothing is allocated per frame.
+ *
+ * Whichever worker finishes the frame that's next in line writes it, along with any frames after it
+ * that are already done, so a slow frame holds up the writes but not the encoding of the frames behind it.
+ * After a frame fails to encode or write, the frames behind it are dropped.
+ */
+class CFramePipeline final
+{
+public:
+    /**
+     * Encodes the pixels of a frame into @p out. Called on the worker threads, several at once.
+     */
+    using Encoder = std::function<bool(int frame, const uint8_t* pixels, std::vector<uint8_t>& out)>;
+
+    /**
+     * Writes an encoded frame. Called once per frame, in the order they were submitted, never two at once.
+     */
+    using Writer = std::function<bool(int frame, const std::vector<uint8_t>& data)>;
+
+public:
+    /**
+     * Constructor
+     *
+     * @param num_threads   Encoder threads. 0 picks one per CPU.
+     * @param frame_size    Size of the pixel buffers
+     */
+    CFramePipeline(int num_threads, std::size_t frame_size, const Encoder& encoder, const Writer& writer);
+
+    /**
+     * Destructor. Waits for everything submitted to be written.
+     */
+    ~CFramePipeline();
+
+    CFramePipeline(const CFramePipeline&) = delete;
+    CFramePipeline& operator=(const CFramePipeline&) = delete;
+
+    /**
+     * Get a buffer to put the next frame's pixels in, waiting for one to be free if need be
+     */
+    uint8_t* acquire();
+
+    /**
+     * Queue the pixels of @p frame, in a buffer from @ref acquire, to be encoded and written
+     */
+    void submit(uint8_t* pixels, int frame);
+
+    /**
+     * Wait for every frame submitted to be written.
+     *
+     * @return false if any of them failed to encode or write
+     */
+    bool finish();
+
+    /**
+     * False once a frame has failed to encode or write, e.g because the reader of a stream went away
+     */
+    bool ok() const { return !failed; }
+
+    int num_threads() const { return static_cast<int>(workers.size()); }
+
+private:
+    /**
+     * A pixel buffer from the pool, and the frame it holds
+     */
+    struct Slot
+    {
+        enum class State
+        {
+            FREE,
+            QUEUED,
+            ENCODING,
+            ENCODED
+        };
+
+        std::unique_ptr<uint8_t[]> pixels;
+        std::vector<uint8_t> encoded;
+        State state = State::FREE;
+        int frame = 0;
+        uint64_t sequence = 0;
+        bool ok = false;
+    };
+
+    void worker_main();
+    void write_encoded(std::unique_lock<std::mutex>& lock);
+
+    Encoder encoder;
+    Writer writer;
+    std::vector<Slot> slots;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;                           /**< Protects everything below */
+    std::condition_variable work;               /**< A frame was queued, or we're quitting */
+    std::condition_variable progress;           /**< A slot was freed */
+    std::deque<Slot*> queue;
+    uint64_t next_sequence = 0;                 /**< Given to the next frame submitted */
+    uint64_t next_write = 0;                    /**< Frame that has to be written next */
+    bool writing = false;                       /**< A worker is writing, so the others leave it to them */
+    bool quit = false;
+    std::atomic<bool> failed{false};            /**< Set with the lock held, but read without it */
+};
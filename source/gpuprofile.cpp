@@ -0,0 +1,142 @@
+/**
+ * GPU timings of the render passes
+ */
+#include "gpuprofile.h"
+#include "log.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+CGpuProfiler::CGpuProfiler()
+{
+    for(FrameQueries& frame : frames)
+    {
+        glGenQueries(MAX_SCOPES * 2, frame.queries);
+        frame.used = 0;
+        frame.last_issued = -1;
+        frame.frame = 0;
+    }
+}
+
+CGpuProfiler::~CGpuProfiler()
+{
+    for(FrameQueries& frame : frames)
+        glDeleteQueries(MAX_SCOPES * 2, frame.queries);
+
+    if(csv != nullptr)
+        std::fclose(csv);
+}
+
+bool CGpuProfiler::open_csv(const std::string& path)
+{
+    csv = std::fopen(path.c_str(), "w");
+    if(csv == nullptr)
+    {
+        log(LogLevel::ERROR, "Unable to open %s for writing: %s\n", path.c_str(), std::strerror(errno));
+        return false;
+    }
+
+    std::fprintf(csv, "frame,scope,gpu_ms\n");
+    return true;
+}
+
+void CGpuProfiler::begin_frame(int frame)
+{
+    current = (current + 1) % FRAMES_IN_FLIGHT;
+    collect(frames[current]);
+
+    frames[current].used = 0;
+    frames[current].last_issued = -1;
+    frames[current].frame = frame;
+    frames[current].scopes.clear();
+    open_scopes.clear();
+}
+
+void CGpuProfiler::begin(const char* name, const char* detail)
+{
+    if(current < 0 || frames[current].used + 2 > MAX_SCOPES * 2)
+    {
+        open_scopes.push_back(-1);
+        return;
+    }
+
+    FrameQueries& frame = frames[current];
+
+    glQueryCounter(frame.queries[frame.used], GL_TIMESTAMP);
+    frame.last_issued = frame.used;
+    frame.scopes.push_back({name, detail, frame.used, -1});
+    open_scopes.push_back(static_cast<int>(frame.scopes.size()) - 1);
+    frame.used += 2; // Keep the end query next to it
+}
+
+void CGpuProfiler::end()
+{
+    if(open_scopes.empty())
+        return;
+
+    int scope = open_scopes.back();
+    open_scopes.pop_back();
+    if(scope < 0)
+        return;
+
+    Scope& s = frames[current].scopes[scope];
+    s.end_query = s.begin_query + 1;
+    glQueryCounter(frames[current].queries[s.end_query], GL_TIMESTAMP);
+    frames[current].last_issued = s.end_query;
+}
+
+void CGpuProfiler::collect(FrameQueries& frame)
+{
+    GLint available = GL_FALSE;
+
+    if(frame.last_issued < 0)
+        return;
+
+    // Queries finish in the order they were issued, so if the last one is done they all are. That's
+    // not the highest index: outer scopes end after the scopes nested in them.
+    glGetQueryObjectiv(frame.queries[frame.last_issued], GL_QUERY_RESULT_AVAILABLE, &available);
+    if(available == GL_FALSE)
+    {
+        dropped_frames++;
+        return;
+    }
+
+    for(const Scope& scope : frame.scopes)
+    {
+        GLuint64 begin_ns, end_ns;
+
+        if(scope.end_query < 0)
+            continue;
+
+        glGetQueryObjectui64v(frame.queries[scope.begin_query], GL_QUERY_RESULT, &begin_ns);
+        glGetQueryObjectui64v(frame.queries[scope.end_query], GL_QUERY_RESULT, &end_ns);
+
+        std::string name = scope.detail != nullptr ? std::string(scope.name) + ": " + scope.detail : std::string(scope.name);
+        double ms = end_ns >= begin_ns ? static_cast<double>(end_ns - begin_ns) / 1e6 : 0.0;
+        std::deque<double>& window = timings[name];
+
+        window.push_back(ms);
+        if(window.size() > WINDOW)
+            window.pop_front();
+
+        if(csv != nullptr)
+            std::fprintf(csv, "%d,%s,%.4f\n", frame.frame, name.c_str(), ms);
+    }
+}
+
+void CGpuProfiler::dump() const
+{
+    log(LogLevel::INFO, "GPU timings over the last %zu frames each (%d frames dropped as not ready in time):\n", WINDOW, dropped_frames);
+    for(const auto& scope : timings)
+    {
+        std::vector<double> sorted(scope.second.begin(), scope.second.end());
+        double total = 0.0;
+
+        std::sort(sorted.begin(), sorted.end());
+        for(double ms : sorted)
+            total += ms;
+
+        std::size_t p99 = std::min(sorted.size() - 1, sorted.size() * 99 / 100);
+        log(LogLevel::INFO, "  %-24s min %7.3fms  avg %7.3fms  p99 %7.3fms  (%zu samples)\n", scope.first.c_str(), sorted.front(), total / sorted.size(), sorted[p99], sorted.size());
+    }
+}
@@ -0,0 +1,93 @@
+/**
+ * GPU timings of the render passes
+ */
+#pragma once
+
+#include <GL/glew.h>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * Times scopes of GL commands on the GPU with pairs of GL_TIMESTAMP queries, so scopes can nest (a pass
+ * and each draw in it).
+ *
+ * Every frame gets its own set of queries, from a ring of @ref FRAMES_IN_FLIGHT, and a frame's results are
+ * read back when its set comes round again. By then the GPU is normally done with it; if it isn't, the
+ * frame's timings are dropped rather than waited for.
+ *
+ * Each scope keeps its last @ref WINDOW timings for @ref dump, and every timing can also be written to a CSV file.
+ */
+class CGpuProfiler final
+{
+public:
+    static constexpr int FRAMES_IN_FLIGHT = 3;
+    static constexpr int MAX_SCOPES = 32;       /**< Scopes timed in a frame. Any more just go untimed */
+    static constexpr std::size_t WINDOW = 256;  /**< Timings per scope that the statistics are over */
+
+public:
+    CGpuProfiler();
+    ~CGpuProfiler();
+
+    CGpuProfiler(const CGpuProfiler&) = delete;
+    CGpuProfiler& operator=(const CGpuProfiler&) = delete;
+
+    /**
+     * Also write every timing to @p path, as frame,scope,gpu_ms rows.
+     *
+     * @return false (and logs why) if the file can't be opened
+     */
+    bool open_csv(const std::string& path);
+
+    /**
+     * Start a frame, collecting the timings of the last frame that used its queries
+     *
+     * @param frame Frame of the animation, for the CSV
+     */
+    void begin_frame(int frame);
+
+    /**
+     * Start timing a scope. Scopes are named "name" or "name: detail", and both strings have to outlive
+     * the frame (string literals, or the mesh names).
+     */
+    void begin(const char* name, const char* detail = nullptr);
+
+    /**
+     * Stop timing the innermost scope
+     */
+    void end();
+
+    /**
+     * Log the min, average and 99th percentile of every scope
+     */
+    void dump() const;
+
+private:
+    struct Scope
+    {
+        const char* name;
+        const char* detail;
+        int begin_query;
+        int end_query;
+    };
+
+    struct FrameQueries
+    {
+        GLuint queries[MAX_SCOPES * 2];
+        int used;
+        int last_issued;                        /**< Query issued last, which the GPU finishes last. -1 for none */
+        int frame;
+        std::vector<Scope> scopes;
+    };
+
+    void collect(FrameQueries& frame);
+
+    FrameQueries frames[FRAMES_IN_FLIGHT];
+    int current = -1;
+    std::vector<int> open_scopes;               /**< Index into the current frame's scopes */
+    std::map<std::string, std::deque<double>> timings;
+    int dropped_frames = 0;
+    std::FILE* csv = nullptr;
+};
@@ -0,0 +1,184 @@
+/**
+ * Headless rendering, with no window or display
+ */
+#include "headless.h"
+#include "log.hpp"
+#include <EGL/eglext.h>
+#include <algorithm>
+#include <cstring>
+
+CHeadlessContext::~CHeadlessContext()
+{
+    if(display == EGL_NO_DISPLAY)
+        return;
+
+    if(context != EGL_NO_CONTEXT)
+    {
+        if(resolve_fbo != 0)
+        {
+            glDeleteFramebuffers(1, &msaa_fbo);
+            glDeleteFramebuffers(1, &resolve_fbo);
+            glDeleteRenderbuffers(2, msaa_renderbuffers);
+            glDeleteRenderbuffers(2, resolve_renderbuffers);
+        }
+
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(display, context);
+    }
+
+    eglTerminate(display);
+}
+
+/**
+ * True if @p name is in the space separated @p extensions
+ */
+static bool has_extension(const char* extensions, const char* name)
+{
+    std::size_t length = std::strlen(name);
+
+    for(const char* p = extensions; p != nullptr && (p = std::strstr(p, name)) != nullptr; p += length)
+    {
+        if((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0'))
+            return true;
+    }
+
+    return false;
+}
+
+bool CHeadlessContext::create_context()
+{
+    const char* client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    EGLint major, minor;
+
+    // Surfaceless needs no display server at all, the default display might want one
+    if(has_extension(client_extensions, "EGL_MESA_platform_surfaceless") && has_extension(client_extensions, "EGL_EXT_platform_base"))
+    {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+
+        if(get_platform_display != nullptr)
+            display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    }
+
+    if(display == EGL_NO_DISPLAY)
+    {
+        log(LogLevel::WARN, "EGL surfaceless platform isn't available, trying the default display\n");
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+
+    if(display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+    {
+        log(LogLevel::ERROR, "Unable to initialize EGL (error 0x%x)\n", eglGetError());
+        display = EGL_NO_DISPLAY;
+        return false;
+    }
+
+    if(!has_extension(eglQueryString(display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context"))
+    {
+        log(LogLevel::ERROR, "EGL %d.%d can't make a context current without a surface\n", major, minor);
+        return false;
+    }
+
+    if(!eglBindAPI(EGL_OPENGL_API))
+    {
+        log(LogLevel::ERROR, "EGL %d.%d doesn't support desktop OpenGL\n", major, minor);
+        return false;
+    }
+
+    // We never draw to a surface, so any config that does OpenGL will do
+    static const EGLint config_attribs[] =
+    {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    static const EGLint context_attribs[] =
+    {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLConfig config = nullptr;
+    EGLint num_configs = 0;
+
+    // EGL_KHR_no_config_context would let us skip this, but not every driver has it
+    if(!eglChooseConfig(display, config_attribs, &config, 1, &num_configs) || num_configs < 1)
+        config = nullptr;
+
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+    if(context == EGL_NO_CONTEXT)
+    {
+        log(LogLevel::ERROR, "Unable to create an OpenGL 3.3 core context (EGL error 0x%x)\n", eglGetError());
+        return false;
+    }
+
+    if(!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+    {
+        log(LogLevel::ERROR, "Unable to make the headless context current (EGL error 0x%x)\n", eglGetError());
+        return false;
+    }
+
+    log(LogLevel::INFO, "Headless: EGL %d.%d (%s)\n", major, minor, eglQueryString(display, EGL_VENDOR));
+    return true;
+}
+
+/**
+ * Framebuffer with a color and depth renderbuffer
+ */
+static bool create_renderbuffers(GLuint& fbo, GLuint* renderbuffers, GLsizei width, GLsizei height, GLsizei samples)
+{
+    glGenFramebuffers(1, &fbo);
+    glGenRenderbuffers(2, renderbuffers);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if(status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        log(LogLevel::ERROR, "Headless framebuffer (%dx%d, %d samples) is incomplete: 0x%x\n", width, height, samples, status);
+        return false;
+    }
+
+    return true;
+}
+
+bool CHeadlessContext::create_framebuffer(GLsizei width, GLsizei height, GLsizei _samples)
+{
+    GLint max_samples = 0;
+
+    glGetIntegerv(GL_MAX_SAMPLES, &max_samples);
+    fb_width = width;
+    fb_height = height;
+    samples = std::min<GLsizei>(_samples, max_samples);
+
+    if(!create_renderbuffers(resolve_fbo, resolve_renderbuffers, width, height, 0))
+        return false;
+    if(samples > 0 && !create_renderbuffers(msaa_fbo, msaa_renderbuffers, width, height, samples))
+        return false;
+
+    log(LogLevel::INFO, "Headless: drawing into a %dx%d framebuffer with %dx MSAA (%s)\n", width, height, samples, glGetString(GL_RENDERER));
+    return true;
+}
+
+void CHeadlessContext::present()
+{
+    if(samples > 0)
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, msaa_fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolve_fbo);
+        glBlitFramebuffer(0, 0, fb_width, fb_height, 0, 0, fb_width, fb_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Nothing waits on a swap, so make sure the frame actually gets going
+    glFlush();
+}
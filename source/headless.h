@@ -0,0 +1,69 @@
+/**
+ * Headless rendering, with no window or display
+ */
+#pragma once
+
+#include <GL/glew.h>
+#include <EGL/egl.h>
+
+/**
+ * An OpenGL 3.3 core context with no window, and a framebuffer to draw frames into instead.
+ *
+ * The context comes from EGL on Mesa's surfaceless platform (llvmpipe when there's no GPU), so it
+ * needs neither an X server nor a GPU. Falls back to the default EGL display if the surfaceless
+ * platform isn't there.
+ *
+ * Frames are drawn into a multisampled @ref framebuffer, and @ref present resolves them into a
+ * single sampled one, the way swapping would on a window.
+ */
+class CHeadlessContext final
+{
+public:
+    CHeadlessContext() = default;
+    ~CHeadlessContext();
+
+    CHeadlessContext(const CHeadlessContext&) = delete;
+    CHeadlessContext& operator=(const CHeadlessContext&) = delete;
+
+    /**
+     * Create the context and make it current
+     */
+    bool create_context();
+
+    /**
+     * Create the framebuffers. Needs the GL entry points, so call it after glewInit.
+     *
+     * @param samples   MSAA samples, clamped to what the driver supports. 0 turns MSAA off.
+     */
+    bool create_framebuffer(GLsizei width, GLsizei height, GLsizei samples);
+
+    /**
+     * Resolve the frame that was just drawn into @ref resolved_framebuffer
+     */
+    void present();
+
+    /**
+     * Framebuffer to draw frames into
+     */
+    GLuint framebuffer() const { return samples > 0 ? msaa_fbo : resolve_fbo; }
+
+    /**
+     * Framebuffer holding the last frame presented, to read it back from
+     */
+    GLuint resolved_framebuffer() const { return resolve_fbo; }
+
+    GLsizei width() const { return fb_width; }
+    GLsizei height() const { return fb_height; }
+
+private:
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+
+    GLuint msaa_fbo = 0;
+    GLuint msaa_renderbuffers[2] = {};     /**< Color and depth */
+    GLuint resolve_fbo = 0;
+    GLuint resolve_renderbuffers[2] = {};
+    GLsizei fb_width = 0;
+    GLsizei fb_height = 0;
+    GLsizei samples = 0;
+};
@@ -0,0 +1,244 @@
+/**
+ * Triangle and vertex reordering for the post-transform vertex cache
+ */
+#include "meshopt.h"
+#include <algorithm>
+#include <cmath>
+#include <deque>
+
+VertexCacheStats analyze_vertex_cache(const std::vector<uint32_t>& indices, std::size_t num_vertices, int cache_size)
+{
+    std::deque<uint32_t> cache;
+    std::size_t misses = 0;
+
+    for(uint32_t index : indices)
+    {
+        if(std::find(cache.begin(), cache.end(), index) != cache.end())
+            continue;
+
+        misses++;
+        cache.push_back(index);
+        if(static_cast<int>(cache.size()) > cache_size)
+            cache.pop_front();
+    }
+
+    VertexCacheStats stats;
+    stats.acmr = indices.empty() ? 0.0f : static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+    stats.atvr = num_vertices == 0 ? 0.0f : static_cast<float>(misses) / static_cast<float>(num_vertices);
+    return stats;
+}
+
+void optimize_vertex_cache(std::vector<uint32_t>& indices, std::size_t num_vertices, int cache_size, std::vector<std::size_t>* clusters)
+{
+    const std::size_t num_triangles = indices.size() / 3;
+    std::vector<uint32_t> adjacency_offset(num_vertices + 1, 0);
+    std::vector<uint32_t> adjacency(num_triangles * 3);
+    std::vector<int> live(num_vertices, 0);             // Triangles using a vertex that haven't been emitted yet
+    std::vector<int> timestamp(num_vertices, 0);        // When a vertex last went into the cache
+    std::vector<bool> emitted(num_triangles, false);
+    std::vector<uint32_t> dead_ends;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> output;
+    int time = cache_size + 1;
+    uint32_t cursor = 0;
+    int fan = 0;
+
+    if(clusters != nullptr)
+        clusters->clear();
+    if(num_triangles == 0)
+        return;
+
+    // Triangles around each vertex
+    for(uint32_t index : indices)
+        live[index]++;
+    for(std::size_t v = 0; v < num_vertices; v++)
+        adjacency_offset[v + 1] = adjacency_offset[v] + live[v];
+    {
+        std::vector<uint32_t> fill(adjacency_offset.begin(), adjacency_offset.end() - 1);
+
+        for(std::size_t i = 0; i < indices.size(); i++)
+            adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    output.reserve(indices.size());
+    if(clusters != nullptr)
+        clusters->push_back(0);
+
+    // Fan out from one vertex at a time, emitting every triangle around it, then move on to whichever
+    // vertex it touched that will still be in the cache once its own triangles are done
+    while(fan >= 0)
+    {
+        candidates.clear();
+
+        for(uint32_t a = adjacency_offset[fan]; a < adjacency_offset[fan + 1]; a++)
+        {
+            uint32_t triangle = adjacency[a];
+
+            if(emitted[triangle])
+                continue;
+
+            for(int corner = 0; corner < 3; corner++)
+            {
+                uint32_t v = indices[triangle * 3 + corner];
+
+                output.push_back(v);
+                dead_ends.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if(time - timestamp[v] > cache_size)
+                    timestamp[v] = time++;
+            }
+
+            emitted[triangle] = true;
+        }
+
+        int best = -1;
+        int best_priority = -1;
+        for(uint32_t v : candidates)
+        {
+            int priority = 0;
+
+            if(live[v] <= 0)
+                continue;
+
+            // Prefer the oldest vertex that will still be in the cache after fanning around it
+            if(time - timestamp[v] + 2 * live[v] <= cache_size)
+                priority = time - timestamp[v];
+
+            if(priority > best_priority)
+            {
+                best_priority = priority;
+                best = static_cast<int>(v);
+            }
+        }
+
+        if(best < 0)
+        {
+            // Dead end. Go back to something recent if we can, otherwise anything that's left
+            while(!dead_ends.empty() && best < 0)
+            {
+                uint32_t v = dead_ends.back();
+
+                dead_ends.pop_back();
+                if(live[v] > 0)
+                    best = static_cast<int>(v);
+            }
+
+            while(best < 0 && cursor < num_vertices)
+            {
+                if(live[cursor] > 0)
+                    best = static_cast<int>(cursor);
+                cursor++;
+            }
+
+            if(best >= 0 && clusters != nullptr)
+                clusters->push_back(output.size() / 3);
+        }
+
+        fan = best;
+    }
+
+    indices.swap(output);
+}
+
+bool optimize_overdraw(std::vector<uint32_t>& indices, const std::vector<std::size_t>& clusters, const float* positions, std::size_t stride,
+                       std::size_t num_vertices, float threshold)
+{
+    const std::size_t num_triangles = indices.size() / 3;
+    const uint8_t* position_bytes = reinterpret_cast<const uint8_t*>(positions);
+    std::vector<float> occlusion(clusters.size());
+    std::vector<std::size_t> order(clusters.size());
+    float mesh_centre[3] = {0.0f, 0.0f, 0.0f};
+    float mesh_area = 0.0f;
+
+    auto position = [&](uint32_t index) { return reinterpret_cast<const float*>(position_bytes + index * stride); };
+    auto cluster_end = [&](std::size_t c) { return c + 1 < clusters.size() ? clusters[c + 1] : num_triangles; };
+
+    if(clusters.size() < 2)
+        return true;
+
+    // Area weighted centroid and normal of every cluster
+    std::vector<float> centres(clusters.size() * 3, 0.0f);
+    std::vector<float> normals(clusters.size() * 3, 0.0f);
+    std::vector<float> areas(clusters.size(), 0.0f);
+    for(std::size_t c = 0; c < clusters.size(); c++)
+    {
+        for(std::size_t t = clusters[c]; t < cluster_end(c); t++)
+        {
+            const float* p0 = position(indices[t * 3 + 0]);
+            const float* p1 = position(indices[t * 3 + 1]);
+            const float* p2 = position(indices[t * 3 + 2]);
+            float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+            float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+            float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+            float area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]) * 0.5f;
+
+            for(int i = 0; i < 3; i++)
+            {
+                centres[c * 3 + i] += (p0[i] + p1[i] + p2[i]) / 3.0f * area;
+                normals[c * 3 + i] += n[i];
+            }
+            areas[c] += area;
+        }
+
+        for(int i = 0; i < 3; i++)
+            mesh_centre[i] += centres[c * 3 + i];
+        mesh_area += areas[c];
+    }
+
+    for(int i = 0; i < 3; i++)
+        mesh_centre[i] = mesh_area > 0.0f ? mesh_centre[i] / mesh_area : 0.0f;
+
+    // How far out of the mesh a cluster faces. Higher goes first
+    for(std::size_t c = 0; c < clusters.size(); c++)
+    {
+        float* n = &normals[c * 3];
+        float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+        occlusion[c] = 0.0f;
+        if(areas[c] <= 0.0f || length <= 0.0f)
+            continue;
+
+        for(int i = 0; i < 3; i++)
+            occlusion[c] += (centres[c * 3 + i] / areas[c] - mesh_centre[i]) * n[i] / length;
+    }
+
+    for(std::size_t c = 0; c < order.size(); c++)
+        order[c] = c;
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) { return occlusion[a] > occlusion[b]; });
+
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+    for(std::size_t c : order)
+        output.insert(output.end(), indices.begin() + clusters[c] * 3, indices.begin() + cluster_end(c) * 3);
+
+    // Clusters end on a dead end, but the one after it may have been picked to reuse what was still cached
+    if(analyze_vertex_cache(output, num_vertices).acmr > analyze_vertex_cache(indices, num_vertices).acmr * threshold)
+        return false;
+
+    indices.swap(output);
+    return true;
+}
+
+std::vector<uint32_t> optimize_vertex_fetch(std::vector<uint32_t>& indices, std::size_t num_vertices)
+{
+    static constexpr uint32_t UNUSED = ~0u;
+    std::vector<uint32_t> remap(num_vertices, UNUSED);
+    uint32_t next = 0;
+
+    for(uint32_t& index : indices)
+    {
+        if(remap[index] == UNUSED)
+            remap[index] = next++;
+
+        index = remap[index];
+    }
+
+    for(uint32_t& position : remap)
+    {
+        if(position == UNUSED)
+            position = next++;
+    }
+
+    return remap;
+}
@@ -0,0 +1,55 @@
+/**
+ * Triangle and vertex reordering for the post-transform vertex cache
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+static constexpr int VERTEX_CACHE_SIZE = 16;    /**< FIFO entries we optimize for and measure against */
+
+/**
+ * How well an index stream uses a FIFO post-transform vertex cache
+ */
+struct VertexCacheStats
+{
+    float acmr;     /**< Average cache miss ratio, vertices transformed per triangle (0.5 is ideal for big meshes, 3 is worst) */
+    float atvr;     /**< Average transform to vertex ratio, vertices transformed per vertex (1 is ideal) */
+};
+
+/**
+ * Simulate a FIFO vertex cache of @p cache_size entries over a triangle list.
+ *
+ * @param indices       Triangle list
+ * @param num_vertices  Number of vertices @p indices refers to
+ */
+VertexCacheStats analyze_vertex_cache(const std::vector<uint32_t>& indices, std::size_t num_vertices, int cache_size = VERTEX_CACHE_SIZE);
+
+/**
+ * Reorder triangles so neighbouring ones share vertices while they're still in the cache (Tipsify, from
+ * Sander, Nehab and Barczak's "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw").
+ *
+ * @param clusters  If not null, gets the index (into @p indices, in triangles) that each run of connected
+ *                  triangles starts at. Clusters can be moved about without hurting the cache much.
+ */
+void optimize_vertex_cache(std::vector<uint32_t>& indices, std::size_t num_vertices, int cache_size = VERTEX_CACHE_SIZE, std::vector<std::size_t>* clusters = nullptr);
+
+/**
+ * Sort the clusters from @ref optimize_vertex_cache so the ones facing out of the mesh, which are the most
+ * likely to hide the rest, are drawn first.
+ *
+ * @param positions Vertex positions, 3 floats each, @p stride bytes apart
+ * @param threshold How much worse the ACMR may get, e.g 1.05 for 5%
+ *
+ * @return false if the new order would cost more than @p threshold, in which case @p indices are left alone
+ */
+bool optimize_overdraw(std::vector<uint32_t>& indices, const std::vector<std::size_t>& clusters, const float* positions, std::size_t stride,
+                       std::size_t num_vertices, float threshold = 1.05f);
+
+/**
+ * Renumber vertices in the order the index stream first uses them, so they're fetched from memory in order.
+ *
+ * Rewrites @p indices and returns the new position of every vertex; vertices that aren't used go at the end.
+ */
+std::vector<uint32_t> optimize_vertex_fetch(std::vector<uint32_t>& indices, std::size_t num_vertices);
@@ -0,0 +1,40 @@
+/**
+ * Converts the built in splash data tables into a splash pack
+ */
+#include "log.hpp"
+#include "splashpack.h"
+#include "splashdat.cpp"
+
+/**
+ * The data tables store each texture as the raw bytes of a Gu3dfInfo, with the texels separately
+ */
+static SplashTexture texture_from_tables(const char* name, unsigned char* raw, unsigned char* image)
+{
+    Gu3dfInfo* texinfo = reinterpret_cast<Gu3dfInfo*>(raw);
+
+    texinfo->data = reinterpret_cast<void*>(image);
+    return {name, texinfo};
+}
+
+/**
+ * mkpack [output]
+ *
+ * Writes splash.pak (or @p output) from splashdat.cpp
+ */
+int main(int argc, char** argv)
+{
+    const char* path = argc > 1 ? argv[1] : "splash.pak";
+    const int num_objects = sizeof(num_verts) / sizeof(num_verts[0]);
+    std::vector<SplashObject> objects;
+    std::vector<SplashTexture> textures;
+
+    for(int i = 0; i < num_objects; i++)
+        objects.push_back({vert[i], num_verts[i], face[i], num_faces[i]});
+
+    textures.push_back(texture_from_tables("text", text_3dfinfo_raw, text_3dfinfo_image));
+    textures.push_back(texture_from_tables("hilite", hilite_3dfinfo_raw, hilite_3dfinfo_image));
+    textures.push_back(texture_from_tables("shadow", shadow_3dfinfo_raw, shadow_3dfinfo_image));
+
+    // mat has a row for every frame of the animation, including the last one
+    return write_splash_pack(path, objects, &mat[0][0], static_cast<int>(sizeof(mat) / sizeof(mat[0])), textures) ? 0 : 1;
+}
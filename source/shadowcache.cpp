@@ -0,0 +1,160 @@
+/**
+ * Cache of rendered shadow maps
+ */
+#include "shadowcache.h"
+#include "log.hpp"
+#include <algorithm>
+
+static constexpr int MAX_PENDING_QUERIES = 4;   /* Misses timed at once. Any more just go untimed */
+static constexpr GLuint64 MAX_QUERY_NS = 1000000000;   /* Anything longer than a second isn't a real result */
+
+// https://learnopengl.com/Advanced-Lighting/Shadows/Shadow-Mapping
+CShadowCache::CShadowCache(int num_entries, GLsizei width, GLsizei height)
+: entries(std::max(num_entries, 1)),
+  enabled(num_entries > 0),
+  queries(MAX_PENDING_QUERIES)
+{
+    for(Entry& entry : entries)
+    {
+        glGenFramebuffers(1, &entry.fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, entry.fbo);
+
+        // Depth texture. Slower than a depth buffer, but you can sample it later in your shader
+        glGenTextures(1, &entry.texture);
+        glBindTexture(GL_TEXTURE_2D, entry.texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT16, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, entry.texture, 0);
+        glDrawBuffer(GL_NONE);
+
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            log(LogLevel::ERROR, "error with framebuffer!!!\n");
+
+        entry.valid = false;
+        entry.last_used = 0;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    for(PendingQuery& pending : queries)
+    {
+        glGenQueries(1, &pending.query);
+        pending.busy = false;
+    }
+
+    log(LogLevel::INFO, "Shadow map cache: %d entries of %dx%d (%zu KiB)\n", enabled ? num_entries : 0, width, height,
+        enabled ? static_cast<std::size_t>(num_entries) * width * height * 2 / 1024 : 0);
+}
+
+CShadowCache::~CShadowCache()
+{
+    for(Entry& entry : entries)
+    {
+        glDeleteFramebuffers(1, &entry.fbo);
+        glDeleteTextures(1, &entry.texture);
+    }
+
+    for(PendingQuery& pending : queries)
+        glDeleteQueries(1, &pending.query);
+}
+
+bool CShadowCache::find(const std::vector<glm::mat4>& key, GLuint& fbo, GLuint& texture)
+{
+    Entry* victim = &entries[0];
+
+    clock++;
+    for(Entry& entry : entries)
+    {
+        if(enabled && entry.valid && entry.key == key)
+        {
+            entry.last_used = clock;
+            texture = entry.texture;
+            hit_count++;
+            return true;
+        }
+
+        if(!entry.valid || (victim->valid && entry.last_used < victim->last_used))
+            victim = &entry;
+    }
+
+    victim->key = key;
+    victim->valid = true;
+    victim->last_used = clock;
+    fbo = victim->fbo;
+    texture = victim->texture;
+    miss_count++;
+    return false;
+}
+
+void CShadowCache::begin_render()
+{
+    active_query = -1;
+    for(int i = 0; i < MAX_PENDING_QUERIES && active_query < 0; i++)
+    {
+        if(!queries[i].busy)
+            active_query = i;
+    }
+
+    if(active_query >= 0)
+        glBeginQuery(GL_TIME_ELAPSED, queries[active_query].query);
+}
+
+void CShadowCache::end_render()
+{
+    if(active_query < 0)
+        return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    queries[active_query].busy = true;
+    active_query = -1;
+}
+
+void CShadowCache::update()
+{
+    for(PendingQuery& pending : queries)
+    {
+        GLint available = GL_FALSE;
+        GLuint64 elapsed_ns;
+
+        if(!pending.busy)
+            continue;
+
+        glGetQueryObjectiv(pending.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available == GL_FALSE)
+            continue;
+
+        glGetQueryObjectui64v(pending.query, GL_QUERY_RESULT, &elapsed_ns);
+        pending.busy = false;
+
+        // Some drivers (llvmpipe for one) get the very first query wrong by hours
+        if(elapsed_ns > MAX_QUERY_NS)
+            continue;
+
+        miss_gpu_ms += static_cast<double>(elapsed_ns) / 1e6;
+        timed_misses++;
+    }
+}
+
+void CShadowCache::invalidate()
+{
+    for(Entry& entry : entries)
+        entry.valid = false;
+}
+
+double CShadowCache::gpu_ms_saved() const
+{
+    return timed_misses == 0 ? 0.0 : hit_count * (miss_gpu_ms / timed_misses);
+}
+
+void CShadowCache::log_stats() const
+{
+    int lookups = hit_count + miss_count;
+
+    log(LogLevel::INFO, "Shadow map cache: %d hits, %d misses (%.1f%% hit rate), a miss takes %.3fms on the GPU, %.2fms saved\n",
+        hit_count, miss_count, lookups == 0 ? 0.0 : 100.0 * hit_count / lookups, timed_misses == 0 ? 0.0 : miss_gpu_ms / timed_misses, gpu_ms_saved());
+}
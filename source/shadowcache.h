@@ -0,0 +1,99 @@
+/**
+ * Cache of rendered shadow maps
+ */
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+/**
+ * A small set of shadow maps, each remembering the matrices it was rendered with.
+ *
+ * The light and every model matrix make up the key, so a shadow map is reused whenever a frame puts
+ * everything back where a cached one had it (the animation is paused, a frame is shown again, or
+ * the same frame comes round on the next loop). Entries are replaced least recently used first.
+ *
+ * Misses are timed with GL_TIME_ELAPSED queries, which are read back a few frames later without
+ * waiting on the GPU. Hits are counted as saving the average time a miss took.
+ */
+class CShadowCache final
+{
+public:
+    /**
+     * Constructor
+     *
+     * @param entries   Shadow maps to keep. 0 turns the cache off, which still keeps one map to render into.
+     * @param width     Size of each shadow map
+     * @param height    Size of each shadow map
+     */
+    CShadowCache(int entries, GLsizei width, GLsizei height);
+    ~CShadowCache();
+
+    CShadowCache(const CShadowCache&) = delete;
+    CShadowCache& operator=(const CShadowCache&) = delete;
+
+    /**
+     * Find the shadow map for @p key.
+     *
+     * @param fbo       On a miss, the framebuffer to render the shadow map into
+     * @param texture   Depth texture holding (or about to hold) the shadow map
+     *
+     * @return true on a hit. On a miss, render into @p fbo between @ref begin_render and @ref end_render.
+     */
+    bool find(const std::vector<glm::mat4>& key, GLuint& fbo, GLuint& texture);
+
+    void begin_render();
+    void end_render();
+
+    /**
+     * Collect whichever timer queries have finished. Call once a frame.
+     */
+    void update();
+
+    /**
+     * Drop every cached shadow map, e.g if what's drawn into them changes
+     */
+    void invalidate();
+
+    int hits() const { return hit_count; }
+    int misses() const { return miss_count; }
+
+    /**
+     * GPU time the hits saved, going by the average time of the misses that have been measured
+     */
+    double gpu_ms_saved() const;
+
+    /**
+     * Log the counters
+     */
+    void log_stats() const;
+
+private:
+    struct Entry
+    {
+        GLuint fbo;
+        GLuint texture;
+        std::vector<glm::mat4> key;
+        bool valid;
+        uint64_t last_used;
+    };
+
+    struct PendingQuery
+    {
+        GLuint query;
+        bool busy;
+    };
+
+    std::vector<Entry> entries;
+    bool enabled;
+    uint64_t clock = 0;                         /**< Bumped on every lookup, for finding the least recently used entry */
+    int hit_count = 0;
+    int miss_count = 0;
+
+    std::vector<PendingQuery> queries;
+    int active_query = -1;
+    int timed_misses = 0;
+    double miss_gpu_ms = 0.0;                   /**< Total of the timed misses */
+};
@@ -0,0 +1,567 @@
+/**
+ * Tile based software rasterizer
+ */
+#include "softraster.h"
+#include "workers.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// World position, lightspace position, normal and color, interpolated across a triangle
+static constexpr int NUM_VARYINGS = 13;
+
+// Extra room either side of the viewport, in pixels, that triangles can reach into before they
+// have to be clipped. Keeps snapped coordinates well inside 18 bits.
+static constexpr int GUARD_BAND = 4096;
+
+// Snapped coordinates are in 1/16ths of a pixel
+static constexpr int SUBPIXEL_BITS = 4;
+static constexpr int SUBPIXEL_SCALE = 1 << SUBPIXEL_BITS;
+
+// Edge functions at the start of a row are clamped to this before being stepped in 32 bits. Across a
+// tile they change by less than 2^28, so a clamped value never changes sign where the real one wouldn't.
+static constexpr int64_t EDGE_LIMIT = int64_t(1) << 30;
+
+// Near, far, left, right, bottom and top; bit n of an outcode is plane n
+static constexpr int NUM_CLIP_PLANES = 6;
+
+struct CSoftRenderer::Vertex
+{
+    glm::vec4 clip;
+    float varyings[NUM_VARYINGS];
+    int material;
+};
+
+/**
+ * A triangle in window coordinates, ready to rasterize
+ */
+struct CSoftRenderer::Triangle
+{
+    int32_t edge_a[3];                      /**< Edge functions a * x + b * y + c, in subpixels */
+    int32_t edge_b[3];
+    int64_t edge_c[3];                      /**< Less one for edges the fill rule leaves out */
+    float inv_area;                         /**< 1 / (twice the area), turning edge functions into barycentrics */
+    float z[3];
+    float inv_w[3];
+    float varyings[3][NUM_VARYINGS];
+    int min_x, min_y, max_x, max_y;         /**< Pixels that could be covered, inclusive */
+    int material;
+    bool write_depth;
+    bool depth_test;
+};
+
+/**
+ * The triangles set up from a run of the input, and which of them touch each tile
+ */
+struct CSoftRenderer::Chunk
+{
+    std::vector<Triangle> triangles;
+    std::vector<std::vector<int>> bins;     /**< Per tile, indices into triangles in submission order */
+};
+
+CSoftRenderer::CSoftRenderer(int width, int height, int _shadow_width, int _shadow_height, CWorkerPool& _pool)
+: pool(_pool), target_width(width), target_height(height), shadow_width(_shadow_width), shadow_height(_shadow_height)
+{
+    depth.resize(static_cast<std::size_t>(width) * height);
+    shadow_map.resize(static_cast<std::size_t>(shadow_width) * shadow_height);
+
+    // A few chunks a thread, so a chunk that's mostly off screen doesn't leave the others idle
+    chunks.resize(pool.size() * 4);
+
+    int max_tiles = std::max(((width + TILE_SIZE - 1) / TILE_SIZE) * ((height + TILE_SIZE - 1) / TILE_SIZE),
+                             ((shadow_width + TILE_SIZE - 1) / TILE_SIZE) * ((shadow_height + TILE_SIZE - 1) / TILE_SIZE));
+    for(Chunk& chunk : chunks)
+        chunk.bins.resize(max_tiles);
+}
+
+CSoftRenderer::~CSoftRenderer() = default;
+
+void CSoftRenderer::render(const SoftScene& scene, uint8_t* rgba)
+{
+    mesh_first_vertex.resize(scene.num_meshes + 1);
+    mesh_first_triangle.resize(scene.num_meshes + 1);
+    mesh_first_vertex[0] = 0;
+    mesh_first_triangle[0] = 0;
+    for(int i = 0; i < scene.num_meshes; i++)
+    {
+        mesh_first_vertex[i + 1] = mesh_first_vertex[i] + scene.meshes[i].num_vertices;
+        mesh_first_triangle[i + 1] = mesh_first_triangle[i] + scene.meshes[i].num_indices / 3;
+    }
+    vertices.resize(mesh_first_vertex[scene.num_meshes]);
+
+    Pass shadow_pass;
+    shadow_pass.shadow = true;
+    shadow_pass.width = shadow_width;
+    shadow_pass.height = shadow_height;
+    shadow_pass.depth = shadow_map.data();
+    shadow_pass.rgba = nullptr;
+    shadow_pass.view_projection = scene.light_projection * scene.light_view;
+    run_pass(scene, shadow_pass);
+
+    Pass main_pass;
+    main_pass.shadow = false;
+    main_pass.width = target_width;
+    main_pass.height = target_height;
+    main_pass.depth = depth.data();
+    main_pass.rgba = rgba;
+    main_pass.view_projection = scene.projection * scene.view;
+    run_pass(scene, main_pass);
+}
+
+void CSoftRenderer::run_pass(const SoftScene& scene, Pass& pass)
+{
+    pass.tiles_x = (pass.width + TILE_SIZE - 1) / TILE_SIZE;
+    pass.tiles_y = (pass.height + TILE_SIZE - 1) / TILE_SIZE;
+
+    transform(scene, pass);
+
+    // Split the triangles into runs, set up and bin in parallel. Each tile then goes through the
+    // chunks in order, so triangles are still drawn in the order they were submitted
+    const int num_triangles = mesh_first_triangle[scene.num_meshes];
+    const int num_chunks = static_cast<int>(chunks.size());
+    pool.parallel_for(num_chunks, [&](int i)
+    {
+        int first = static_cast<int>(static_cast<int64_t>(num_triangles) * i / num_chunks);
+        int last = static_cast<int>(static_cast<int64_t>(num_triangles) * (i + 1) / num_chunks);
+        setup_chunk(scene, pass, chunks[i], first, last);
+    });
+
+    pool.parallel_for(pass.tiles_x * pass.tiles_y, [&](int tile)
+    {
+        raster_tile(scene, pass, tile);
+    });
+}
+
+void CSoftRenderer::transform(const SoftScene& scene, const Pass& pass)
+{
+    static constexpr int BLOCK_SIZE = 256;
+    const int num_vertices = static_cast<int>(vertices.size());
+    const glm::mat4 lightspace = scene.light_projection * scene.light_view;
+
+    pool.parallel_for((num_vertices + BLOCK_SIZE - 1) / BLOCK_SIZE, [&](int block)
+    {
+        int first = block * BLOCK_SIZE;
+        int last = std::min(first + BLOCK_SIZE, num_vertices);
+        int mesh_index = static_cast<int>(std::upper_bound(mesh_first_vertex.begin(), mesh_first_vertex.end(), first) - mesh_first_vertex.begin()) - 1;
+
+        for(int i = first; i < last; i++)
+        {
+            while(i >= mesh_first_vertex[mesh_index + 1])
+                mesh_index++;
+
+            const SoftMesh& mesh = scene.meshes[mesh_index];
+            const glm::mat4& model = scene.models[mesh_index];
+            const std::size_t offset = static_cast<std::size_t>(i - mesh_first_vertex[mesh_index]) * mesh.stride;
+            const float* position = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(mesh.positions) + offset);
+            Vertex& out = vertices[i];
+
+            glm::vec4 world = model * glm::vec4(position[0], position[1], position[2], 1.0f);
+            out.clip = pass.view_projection * world;
+            if(pass.shadow)
+                continue;
+
+            // The same as logo.vert
+            const float* normal = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(mesh.normals) + offset);
+            const float* color = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(mesh.colors) + offset);
+            glm::vec4 ls = lightspace * world;
+            glm::vec3 n = glm::mat3(glm::transpose(model)) * glm::vec3(normal[0], normal[1], normal[2]);
+            float* v = out.varyings;
+
+            v[0] = world.x; v[1] = world.y; v[2] = world.z;
+            v[3] = ls.x; v[4] = ls.y; v[5] = ls.z; v[6] = ls.w;
+            v[7] = n.x; v[8] = n.y; v[9] = n.z;
+            v[10] = color[0]; v[11] = color[1]; v[12] = color[2];
+            out.material = *reinterpret_cast<const int*>(reinterpret_cast<const uint8_t*>(mesh.materials) + offset);
+        }
+    });
+}
+
+/**
+ * Signed distance of a clip space position from a plane, positive inside
+ */
+static inline float clip_distance(const glm::vec4& p, int plane, float guard_x, float guard_y)
+{
+    switch(plane)
+    {
+    case 0:  return p.z + p.w;
+    case 1:  return p.w - p.z;
+    case 2:  return p.x + guard_x * p.w;
+    case 3:  return guard_x * p.w - p.x;
+    case 4:  return p.y + guard_y * p.w;
+    default: return guard_y * p.w - p.y;
+    }
+}
+
+static inline int clip_outcode(const glm::vec4& p, float guard_x, float guard_y)
+{
+    int code = 0;
+    for(int plane = 0; plane < NUM_CLIP_PLANES; plane++)
+    {
+        if(clip_distance(p, plane, guard_x, guard_y) < 0.0f)
+            code |= 1 << plane;
+    }
+    return code;
+}
+
+void CSoftRenderer::setup_chunk(const SoftScene& scene, const Pass& pass, Chunk& chunk, int first, int last)
+{
+    chunk.triangles.clear();
+    for(int i = 0; i < pass.tiles_x * pass.tiles_y; i++)
+        chunk.bins[i].clear();
+
+    // NDC that reaches the edge of the guard band
+    const float guard_x = 1.0f + 2.0f * GUARD_BAND / pass.width;
+    const float guard_y = 1.0f + 2.0f * GUARD_BAND / pass.height;
+    const float half_width = pass.width * 0.5f;
+    const float half_height = pass.height * 0.5f;
+
+    // The shadow pass only writes depth from the first mesh that casts a shadow on, and from then on
+    // with the depth test off, the same as draw_frame leaves the GL state
+    int first_shadow_mesh = scene.num_meshes;
+    for(int i = 0; i < scene.num_meshes; i++)
+    {
+        if(scene.meshes[i].casts_shadow)
+        {
+            first_shadow_mesh = i;
+            break;
+        }
+    }
+
+    int mesh_index = static_cast<int>(std::upper_bound(mesh_first_triangle.begin(), mesh_first_triangle.end(), first) - mesh_first_triangle.begin()) - 1;
+    Vertex polygon[2][3 + NUM_CLIP_PLANES];
+
+    for(int t = first; t < last; t++)
+    {
+        while(t >= mesh_first_triangle[mesh_index + 1])
+            mesh_index++;
+
+        if(pass.shadow && mesh_index < first_shadow_mesh)
+            continue;
+
+        const SoftMesh& mesh = scene.meshes[mesh_index];
+        const uint32_t* index = mesh.indices + static_cast<std::size_t>(t - mesh_first_triangle[mesh_index]) * 3;
+        const Vertex* corner[3];
+        int outcode[3];
+
+        for(int k = 0; k < 3; k++)
+        {
+            corner[k] = &vertices[mesh_first_vertex[mesh_index] + index[k]];
+            outcode[k] = clip_outcode(corner[k]->clip, guard_x, guard_y);
+        }
+
+        if(outcode[0] & outcode[1] & outcode[2])
+            continue;
+
+        // Sutherland-Hodgman, against only the planes the triangle crosses
+        int count = 3;
+        Vertex* poly = polygon[0];
+        for(int k = 0; k < 3; k++)
+            poly[k] = *corner[k];
+
+        const int crossed = outcode[0] | outcode[1] | outcode[2];
+        for(int plane = 0; plane < NUM_CLIP_PLANES && count >= 3; plane++)
+        {
+            if(!(crossed & (1 << plane)))
+                continue;
+
+            Vertex* out = (poly == polygon[0]) ? polygon[1] : polygon[0];
+            int out_count = 0;
+
+            for(int k = 0; k < count; k++)
+            {
+                const Vertex& a = poly[k];
+                const Vertex& b = poly[(k + 1) % count];
+                float da = clip_distance(a.clip, plane, guard_x, guard_y);
+                float db = clip_distance(b.clip, plane, guard_x, guard_y);
+
+                if(da >= 0.0f)
+                    out[out_count++] = a;
+
+                if((da >= 0.0f) != (db >= 0.0f))
+                {
+                    float f = da / (da - db);
+                    Vertex& v = out[out_count++];
+                    v.clip = a.clip + (b.clip - a.clip) * f;
+                    for(int j = 0; j < NUM_VARYINGS; j++)
+                        v.varyings[j] = a.varyings[j] + (b.varyings[j] - a.varyings[j]) * f;
+                }
+            }
+
+            poly = out;
+            count = out_count;
+        }
+
+        if(count < 3)
+            continue;
+
+        // To window coordinates, snapped to the subpixel grid
+        int32_t sx[3 + NUM_CLIP_PLANES];
+        int32_t sy[3 + NUM_CLIP_PLANES];
+        float sz[3 + NUM_CLIP_PLANES];
+        float inv_w[3 + NUM_CLIP_PLANES];
+
+        for(int k = 0; k < count; k++)
+        {
+            const glm::vec4& c = poly[k].clip;
+            inv_w[k] = 1.0f / c.w;
+            sx[k] = static_cast<int32_t>(std::lround((c.x * inv_w[k] + 1.0f) * half_width * SUBPIXEL_SCALE));
+            sy[k] = static_cast<int32_t>(std::lround((c.y * inv_w[k] + 1.0f) * half_height * SUBPIXEL_SCALE));
+            sz[k] = c.z * inv_w[k] * 0.5f + 0.5f;
+        }
+
+        // The clipped polygon is convex, so fan it out from the first vertex
+        for(int k = 1; k + 1 < count; k++)
+        {
+            const int v[3] = {0, k, k + 1};
+            const int64_t area = static_cast<int64_t>(sx[v[1]] - sx[v[0]]) * (sy[v[2]] - sy[v[0]]) -
+                                 static_cast<int64_t>(sy[v[1]] - sy[v[0]]) * (sx[v[2]] - sx[v[0]]);
+
+            // Back facing (clockwise, with y up) or empty
+            if(area <= 0)
+                continue;
+
+            Triangle tri;
+            int32_t min_sx = sx[v[0]], max_sx = sx[v[0]];
+            int32_t min_sy = sy[v[0]], max_sy = sy[v[0]];
+
+            for(int e = 0; e < 3; e++)
+            {
+                const int a = v[e];
+                const int b = v[(e + 1) % 3];
+                const int32_t dx = sx[b] - sx[a];
+                const int32_t dy = sy[b] - sy[a];
+
+                tri.edge_a[e] = -dy;
+                tri.edge_b[e] = dx;
+                tri.edge_c[e] = static_cast<int64_t>(dy) * sx[a] - static_cast<int64_t>(dx) * sy[a];
+
+                // Top-left fill rule: pixels exactly on an edge belong to the triangle only if it's a
+                // left edge (going down, as we go counter clockwise) or a top edge (flat, going left)
+                const bool top_left = dy < 0 || (dy == 0 && dx < 0);
+                if(!top_left)
+                    tri.edge_c[e] -= 1;
+
+                tri.z[e] = sz[v[e]];
+                tri.inv_w[e] = inv_w[v[e]];
+                if(!pass.shadow)
+                    std::memcpy(tri.varyings[e], poly[v[e]].varyings, sizeof(tri.varyings[e]));
+
+                min_sx = std::min(min_sx, sx[v[e]]);
+                max_sx = std::max(max_sx, sx[v[e]]);
+                min_sy = std::min(min_sy, sy[v[e]]);
+                max_sy = std::max(max_sy, sy[v[e]]);
+            }
+
+            // Pixels whose centres fall inside the bounds
+            const int half = SUBPIXEL_SCALE / 2;
+            tri.min_x = std::max((min_sx - half + SUBPIXEL_SCALE - 1) >> SUBPIXEL_BITS, 0);
+            tri.min_y = std::max((min_sy - half + SUBPIXEL_SCALE - 1) >> SUBPIXEL_BITS, 0);
+            tri.max_x = std::min((max_sx - half) >> SUBPIXEL_BITS, pass.width - 1);
+            tri.max_y = std::min((max_sy - half) >> SUBPIXEL_BITS, pass.height - 1);
+            if(tri.min_x > tri.max_x || tri.min_y > tri.max_y)
+                continue;
+
+            // Flat shaded attributes come from the last vertex of the original triangle
+            tri.inv_area = 1.0f / static_cast<float>(area);
+            tri.material = pass.shadow ? 0 : corner[2]->material;
+            tri.write_depth = true;
+            tri.depth_test = !pass.shadow && scene.depth_test;
+
+            const int index_in_chunk = static_cast<int>(chunk.triangles.size());
+            chunk.triangles.push_back(tri);
+
+            for(int ty = tri.min_y / TILE_SIZE; ty <= tri.max_y / TILE_SIZE; ty++)
+            {
+                for(int tx = tri.min_x / TILE_SIZE; tx <= tri.max_x / TILE_SIZE; tx++)
+                    chunk.bins[ty * pass.tiles_x + tx].push_back(index_in_chunk);
+            }
+        }
+    }
+}
+
+void CSoftRenderer::raster_tile(const SoftScene& scene, const Pass& pass, int tile)
+{
+    const int tile_x0 = (tile % pass.tiles_x) * TILE_SIZE;
+    const int tile_y0 = (tile / pass.tiles_x) * TILE_SIZE;
+    const int tile_x1 = std::min(tile_x0 + TILE_SIZE, pass.width) - 1;
+    const int tile_y1 = std::min(tile_y0 + TILE_SIZE, pass.height) - 1;
+
+    // Clear to what glClear would: black and opaque, and the far plane
+    for(int y = tile_y0; y <= tile_y1; y++)
+    {
+        float* depth_row = pass.depth + static_cast<std::size_t>(y) * pass.width;
+        std::fill(depth_row + tile_x0, depth_row + tile_x1 + 1, 1.0f);
+
+        if(pass.rgba)
+        {
+            uint8_t* color_row = pass.rgba + (static_cast<std::size_t>(y) * pass.width + tile_x0) * 4;
+            for(int x = tile_x0; x <= tile_x1; x++, color_row += 4)
+            {
+                color_row[0] = color_row[1] = color_row[2] = 0;
+                color_row[3] = 255;
+            }
+        }
+    }
+
+    for(const Chunk& chunk : chunks)
+    {
+        for(int index : chunk.bins[tile])
+        {
+            const Triangle& tri = chunk.triangles[index];
+            const int x0 = std::max(tri.min_x, tile_x0);
+            const int x1 = std::min(tri.max_x, tile_x1);
+            const int y0 = std::max(tri.min_y, tile_y0);
+            const int y1 = std::min(tri.max_y, tile_y1);
+            const int64_t step[3] = {int64_t(tri.edge_a[0]) * SUBPIXEL_SCALE, int64_t(tri.edge_a[1]) * SUBPIXEL_SCALE, int64_t(tri.edge_a[2]) * SUBPIXEL_SCALE};
+
+            for(int y = y0; y <= y1; y++)
+            {
+                const int64_t py = static_cast<int64_t>(y) * SUBPIXEL_SCALE + SUBPIXEL_SCALE / 2;
+                const int64_t px = static_cast<int64_t>(x0) * SUBPIXEL_SCALE + SUBPIXEL_SCALE / 2;
+                int64_t row[3];
+                int32_t start[3];
+
+                for(int e = 0; e < 3; e++)
+                {
+                    row[e] = tri.edge_a[e] * px + tri.edge_b[e] * py + tri.edge_c[e];
+                    start[e] = static_cast<int32_t>(std::min(std::max(row[e], -EDGE_LIMIT), EDGE_LIMIT));
+                }
+
+                float* depth_row = pass.depth + static_cast<std::size_t>(y) * pass.width;
+                uint8_t* color_row = pass.rgba ? pass.rgba + static_cast<std::size_t>(y) * pass.width * 4 : nullptr;
+
+                // Shade one covered pixel. The 32 bit edge functions only decide coverage; barycentrics
+                // come from the exact 64 bit ones, which big triangles need
+                auto fragment = [&](int x)
+                {
+                    const int64_t dx = x - x0;
+                    const float e1 = static_cast<float>(row[1] + step[1] * dx);
+                    const float e2 = static_cast<float>(row[2] + step[2] * dx);
+
+                    // Edge 1 runs from vertex 1 to 2, so it weights vertex 0, and so on. The weights have
+                    // to add up to exactly 1: with everything crowded up against the far plane, the fill
+                    // rule's bias alone would be enough to move a small triangle in front of its neighbours
+                    const float l0 = e1 * tri.inv_area;
+                    const float l1 = e2 * tri.inv_area;
+                    const float l2 = 1.0f - l0 - l1;
+                    const float z = l0 * tri.z[0] + l1 * tri.z[1] + l2 * tri.z[2];
+
+                    if(tri.depth_test && z > depth_row[x])
+                        return;
+                    if(tri.write_depth)
+                        depth_row[x] = z;
+                    if(!color_row)
+                        return;
+
+                    float weights[3] = {l0 * tri.inv_w[0], l1 * tri.inv_w[1], l2 * tri.inv_w[2]};
+                    const float inv_sum = 1.0f / (weights[0] + weights[1] + weights[2]);
+                    weights[0] *= inv_sum;
+                    weights[1] *= inv_sum;
+                    weights[2] *= inv_sum;
+                    shade(scene, tri, weights, color_row + x * 4);
+                };
+
+#if defined(__SSE2__)
+                // Four pixels at a time: a pixel is in if none of its edge functions are negative
+                __m128i e[3];
+                __m128i e_step[3];
+                for(int k = 0; k < 3; k++)
+                {
+                    const int32_t a = tri.edge_a[k] * SUBPIXEL_SCALE;
+                    // No 32 bit multiply in SSE2, but a * lane is just 0, a, 2a, 3a
+                    const __m128i offsets = _mm_setr_epi32(0, a, a * 2, a * 3);
+                    e[k] = _mm_add_epi32(_mm_set1_epi32(start[k]), offsets);
+                    e_step[k] = _mm_set1_epi32(a * 4);
+                }
+
+                for(int x = x0; x <= x1; x += 4)
+                {
+                    const __m128i any = _mm_or_si128(e[0], _mm_or_si128(e[1], e[2]));
+                    int mask = ~_mm_movemask_ps(_mm_castsi128_ps(any)) & 0xF;
+                    if(x1 - x < 3)
+                        mask &= (1 << (x1 - x + 1)) - 1;
+
+                    while(mask)
+                    {
+                        const int bit = __builtin_ctz(mask);
+                        fragment(x + bit);
+                        mask &= mask - 1;
+                    }
+
+                    e[0] = _mm_add_epi32(e[0], e_step[0]);
+                    e[1] = _mm_add_epi32(e[1], e_step[1]);
+                    e[2] = _mm_add_epi32(e[2], e_step[2]);
+                }
+#else
+                int32_t e[3] = {start[0], start[1], start[2]};
+                for(int x = x0; x <= x1; x++)
+                {
+                    if((e[0] | e[1] | e[2]) >= 0)
+                        fragment(x);
+
+                    for(int k = 0; k < 3; k++)
+                        e[k] += tri.edge_a[k] * SUBPIXEL_SCALE;
+                }
+#endif
+            }
+        }
+    }
+}
+
+static inline float diffuse(const glm::vec3& normal, const glm::vec3& light_position, const glm::vec3& position)
+{
+    return std::max(glm::dot(normal, glm::normalize(light_position - position)), 0.0f);
+}
+
+static inline uint8_t to_unorm8(float value)
+{
+    return static_cast<uint8_t>(std::lround(std::min(std::max(value, 0.0f), 1.0f) * 255.0f));
+}
+
+void CSoftRenderer::shade(const SoftScene& scene, const Triangle& tri, const float* weights, uint8_t* out) const
+{
+    float v[NUM_VARYINGS];
+    for(int k = 0; k < NUM_VARYINGS; k++)
+        v[k] = weights[0] * tri.varyings[0][k] + weights[1] * tri.varyings[1][k] + weights[2] * tri.varyings[2][k];
+
+    const glm::vec3 position(v[0], v[1], v[2]);
+    const glm::vec3 normal = glm::normalize(glm::vec3(v[7], v[8], v[9]));
+    const glm::vec3 color(v[10], v[11], v[12]);
+    const float ambient = 0.3f;
+    glm::vec3 result;
+
+    // The same as logo.frag, less the texture
+    if(tri.material == 0)
+    {
+        const float light = diffuse(normal, scene.light0_position, position) + diffuse(normal, scene.light1_position, position) * 0.5f;
+        result = (ambient + light) * 0.8f * color;
+    }
+    else
+    {
+        // logo.frag divides by z rather than w, which makes the depth it compares always 1: anywhere
+        // the shadow caster drew is in shadow
+        const float ls_z = v[5];
+        const float u = v[3] / ls_z * 0.5f + 0.5f;
+        const float t = v[4] / ls_z * 0.5f + 0.5f;
+        const float current = ls_z / ls_z * 0.5f + 0.5f;
+
+        // Nearest texel, clamped to the edge
+        int texel_x = std::isfinite(u) ? static_cast<int>(std::floor(std::min(std::max(u, 0.0f), 1.0f) * shadow_width)) : 0;
+        int texel_y = std::isfinite(t) ? static_cast<int>(std::floor(std::min(std::max(t, 0.0f), 1.0f) * shadow_height)) : 0;
+        texel_x = std::min(texel_x, shadow_width - 1);
+        texel_y = std::min(texel_y, shadow_height - 1);
+
+        const float closest = shadow_map[static_cast<std::size_t>(texel_y) * shadow_width + texel_x];
+        const float shadow = current > closest ? 1.0f : 0.0f;
+        result = (ambient + (1.0f - shadow * 0.25f)) * diffuse(normal, scene.light0_position, position) * 0.7f * color;
+    }
+
+    out[0] = to_unorm8(result.r);
+    out[1] = to_unorm8(result.g);
+    out[2] = to_unorm8(result.b);
+    out[3] = 255;
+}
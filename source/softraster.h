@@ -0,0 +1,121 @@
+/**
+ * Tile based software rasterizer
+ */
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class CWorkerPool;
+
+/**
+ * A mesh for the software rasterizer, read straight out of an interleaved vertex array
+ */
+struct SoftMesh
+{
+    const float* positions;     /**< xyz of the first vertex */
+    const float* normals;       /**< Normal of the first vertex */
+    const float* colors;        /**< rgb of the first vertex */
+    const float* texcoords;     /**< Glide s and t of the first vertex. Only the Voodoo renderer uses them */
+    const int* materials;       /**< Material of the first vertex */
+    std::size_t stride;         /**< Bytes from one vertex to the next */
+    int num_vertices;
+    const uint32_t* indices;    /**< Triangles, counter clockwise facing out */
+    int num_indices;
+    bool casts_shadow;          /**< Writes depth in the shadow pass */
+};
+
+/**
+ * Everything a frame needs, the same as the shaders get
+ */
+struct SoftScene
+{
+    const SoftMesh* meshes;     /**< Drawn in order */
+    const glm::mat4* models;    /**< One per mesh */
+    int num_meshes;
+    glm::mat4 projection;
+    glm::mat4 view;
+    glm::mat4 light_projection;
+    glm::mat4 light_view;
+    glm::vec3 light0_position;
+    glm::vec3 light1_position;
+    bool depth_test;            /**< LEQUAL depth test in the main pass, otherwise everything is drawn in order */
+};
+
+/**
+ * Renders the splash on the CPU, the way the shadow and logo shaders do on the GPU: a shadow map
+ * pass from the light, then the lit scene, one sample per pixel.
+ *
+ * Each pass transforms the vertices, sets the triangles up and bins them into 64x64 tiles, then
+ * rasterizes the tiles, all spread over a @ref CWorkerPool. Triangles are clipped against the
+ * near and far planes and a guard band, snapped to 1/16th of a pixel and tested with integer edge
+ * functions (four pixels at a time with SSE2) and the top-left fill rule, so shared edges are
+ * watertight. Binning keeps the triangles of each tile in submission order, so drawing without a
+ * depth test comes out the same however the work is split.
+ */
+class CSoftRenderer final
+{
+public:
+    static constexpr int TILE_SIZE = 64;
+
+public:
+    /**
+     * Constructor
+     *
+     * @param pool  Threads to render on. Must outlive the renderer.
+     */
+    CSoftRenderer(int width, int height, int shadow_width, int shadow_height, CWorkerPool& pool);
+    ~CSoftRenderer();
+
+    CSoftRenderer(const CSoftRenderer&) = delete;
+    CSoftRenderer& operator=(const CSoftRenderer&) = delete;
+
+    /**
+     * Render a frame into @p rgba: width * height RGBA8 pixels, bottom row first like glReadPixels
+     */
+    void render(const SoftScene& scene, uint8_t* rgba);
+
+    int width() const { return target_width; }
+    int height() const { return target_height; }
+
+private:
+    struct Vertex;
+    struct Triangle;
+    struct Chunk;
+
+    /**
+     * A pass draws into either the shadow map (depth only) or the frame
+     */
+    struct Pass
+    {
+        bool shadow;
+        int width;
+        int height;
+        int tiles_x;
+        int tiles_y;
+        float* depth;
+        uint8_t* rgba;
+        glm::mat4 view_projection;
+    };
+
+    void run_pass(const SoftScene& scene, Pass& pass);
+    void transform(const SoftScene& scene, const Pass& pass);
+    void setup_chunk(const SoftScene& scene, const Pass& pass, Chunk& chunk, int first, int last);
+    void raster_tile(const SoftScene& scene, const Pass& pass, int tile);
+    void shade(const SoftScene& scene, const Triangle& tri, const float* weights, uint8_t* out) const;
+
+    CWorkerPool& pool;
+    int target_width;
+    int target_height;
+    int shadow_width;
+    int shadow_height;
+    std::vector<float> depth;
+    std::vector<float> shadow_map;
+
+    std::vector<Vertex> vertices;               /**< Every mesh's vertices, transformed */
+    std::vector<int> mesh_first_vertex;
+    std::vector<int> mesh_first_triangle;
+    std::vector<Chunk> chunks;
+};
@@ -5,18 +5,49 @@
 #include <GL/glew.h>
 #include <GL/gl.h>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 #include <SDL2/SDL.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
 #include <vector>
+#include "3dffile.h"
 #include "3dftex.h"
+#include "animation.h"
+#include "bench.h"
+#include "framepacer.h"
+#include "frameexport.h"
+#include "framepipeline.h"
+#include "gpuprofile.h"
+#include "headless.h"
 #include "log.hpp"
+#include "meshopt.h"
 #include "shader.h"
+#include "shadowcache.h"
+#include "softraster.h"
+#include "splashpack.h"
+#include "texstream.h"
+#include "texture.h"
 #include "types.h"
+#include "videostream.h"
+#include "voodoo.h"
+#include "workers.h"
 
 #define VERTEX_ATTRIB 0
 #define NORMAL_ATTRIB 1
 #define ST_ATTRIB 2
 #define COLOR_ATTRIB 3
 #define MATERIAL_NUMBER_ATTRIB 4
+#define COLOR_INDEX_ATTRIB 5
 
 #define SHIELD_INDEX_WHITE 0
 #define LOGO_INDEX 1
@@ -27,27 +58,108 @@
 
 static constexpr GLsizei scr_width = 640;
 static constexpr GLsizei scr_height = 480;
+static GLsizei render_width = scr_width;    // Size the main pass draws at
+static GLsizei render_height = scr_height;
 
-static GLuint logo_vao, logo_vbo, logo_color_buffer, logo_material_buffer, logo_ibo;
-static GLuint shield_cyan_vao, shield_cyan_vbo, shield_cyan_color_buffer, shield_cyan_material_buffer, shield_cyan_ibo;
-static GLuint shield_white_vao, shield_white_vbo, shield_white_color_buffer, shield_white_material_buffer, shield_white_ibo;
+/**
+ * One vertex of the splash vertex buffer. Every mesh is interleaved into the same buffer.
+ */
+struct SplashVertex
+{
+    float x, y, z;
+    float nx, ny, nz;
+    float s, t;
+    float r, g, b;
+    GLint material;
+};
+
+/**
+ * Compact version of @ref SplashVertex: a packed normal, half float texture coordinates and
+ * an index into the material colors instead of the color itself. Indices are 16-bit.
+ */
+struct CompactSplashVertex
+{
+    float x, y, z;
+    GLuint normal;              /**< GL_INT_2_10_10_10_REV, w unused */
+    GLushort s, t;              /**< Half floats */
+    GLbyte color_index;         /**< Into the material colors (always the same as material) */
+    GLbyte material;
+    GLbyte pad[2];
+};
+
+/**
+ * An object in the splash. Objects are loaded and drawn in table order.
+ */
+struct MeshDesc
+{
+    const char* name;
+    int object;                 /**< Index into vert[], face[], num_verts[], num_faces[] and the columns of mat[] */
+    bool casts_shadow;          /**< Writes depth in the shadow pass */
+};
+
+static const MeshDesc splash_meshes[] =
+{
+    {"cyan shield",     SHIELD_INDEX_CYAN,  false},
+    {"white shield",    SHIELD_INDEX_WHITE, false},
+    {"logo",            LOGO_INDEX,         true},
+};
+
+static constexpr int NUM_MESHES = sizeof(splash_meshes) / sizeof(splash_meshes[0]);
+
+/**
+ * Where a mesh lives in the splash vertex and index buffers
+ */
+struct MeshRange
+{
+    GLint base_vertex;          /**< First vertex of the mesh, added to each of its indices */
+    GLsizei vertex_count;
+    GLsizei first_index;
+    GLsizei index_count;
+};
+
+/**
+ * GL calls made while drawing a frame
+ */
+struct GlCallStats
+{
+    int vao_binds;
+    int draws;
+    int per_mesh_binds;     /**< VAO (and IBO) binds the same draws would need with a VAO and IBO per mesh */
+    int per_mesh_bound;     /**< Mesh the per-mesh layout would have bound, -1 at the start of a pass */
+};
+
+static GLuint splash_vao, splash_vbo, splash_ibo;
+static GLuint splash_compact_vao, splash_compact_vbo, splash_compact_ibo;
+static bool compact_vertices = false;
+static bool optimize_meshes = false;
+static MeshRange mesh_ranges[NUM_MESHES];
+static std::vector<SplashVertex> splash_vertices;     // What's in splash_vbo, kept for the software renderer
+static std::vector<GLuint> splash_indices;
+static SoftMesh soft_meshes[NUM_MESHES];                // The splash geometry, for the CPU renderers
+static GlCallStats frame_stats;
 
 static GLuint light_vao, light_vbo;
 
 static Texture logo_3d_texture;
 static Texture specular_texture;
 static Texture shadow_texture;
+static C3dfFile logo_3df_file;
+static CSplashPack splash_pack;
+static int total_num_frames = 0;   // Last frame of the animation
+static CAnimation animation;
 
-GLsizei logo_index_count;
-GLsizei shield_cyan_index_count;
-GLsizei shield_white_index_count;
-
-#include "splashdat.cpp"
+static CVoodooTexture voodoo_logo_texture;
+static CVoodooTexture voodoo_hilite_texture;
+static CVoodooTexture voodoo_shadow_texture;
+static GrDepthBufferMode voodoo_depth_mode = GrDepthBufferMode::GR_DEPTHBUFFER_WBUFFER;
 
 glm::mat4 projection;
 glm::mat4 view;
 glm::mat4 model;
 glm::mat4 mvp;
+glm::mat4 light_projection;
+glm::mat4 light_view;
+glm::mat4 mat_lightspace;
 
 // Lighting
 std::vector<glm::vec3> materials;
@@ -68,8 +180,7 @@ glm::vec3 light_colors[NUM_LIGHTS] =
 // Shadowing stuff
 static constexpr unsigned int SHADOW_WIDTH = 1024;
 static constexpr unsigned int SHADOW_HEIGHT = 1024;
-unsigned int depth_map_fbo;
-unsigned int depth_map;
+static int shadow_cache_entries = 8;
 
 
 void setup_materials()
@@ -97,197 +208,262 @@ void setup_materials()
     materials.push_back(color);
 }
 
-// https://learnopengl.com/Advanced-Lighting/Shadows/Shadow-Mapping
-void setup_shadowing()
+/**
+ * Set up the camera and light matrices, for a main pass of render_width x render_height
+ */
+static void setup_camera()
 {
-    glGenFramebuffers(1, &depth_map_fbo);
-    glBindFramebuffer(GL_FRAMEBUFFER, depth_map_fbo);
+    // Let's set up the projection matrix
+    projection = glm::perspective(glm::radians(30.0f), static_cast<float>(render_width) / render_height, 1.0f, 100000.0f);
+    view = glm::lookAt
+    (
+        glm::vec3(-10, 0, -450), // Camera is at (4,3,3), in World Space
+        glm::vec3(0, 0, 0), // and looks at the origin
+        glm::vec3(0,1,0)  // Head is up (set to 0,-1,0 to look upside-down)
+    );
 
-    // Depth texture. Slower than a depth buffer, but you can sample it later in your shader
-    glGenTextures(1, &depth_map);
-    glBindTexture(GL_TEXTURE_2D, depth_map);
-    glTexImage2D(GL_TEXTURE_2D, 0,GL_DEPTH_COMPONENT16, 1024, 1024, 0,GL_DEPTH_COMPONENT, GL_FLOAT, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // This makes everything draw correctly for some reason?
+    // If this is removed, everything stops working?
+    view = glm::scale(view, glm::vec3(-1, 1, 1));
 
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_map, 0);
+    // Light matrices
+    light_projection = glm::ortho(-850.0f, 850.0f, -850.0f, 850.0f, 1.0f, 2700.0f);
+    light_view = glm::lookAt
+    (
+        light_positions[1],
+        glm::vec3(500.0f, -600.0f, 1271.0f),
+        glm::vec3(0.0f, 1.0f, 0.0f)
+    );
+    light_view = glm::scale(light_view, glm::vec3(-1, 1, 1));
+    mat_lightspace = light_projection * light_view;
+}
 
-    glDrawBuffer(GL_NONE);
+/**
+ * Pack a normal into GL_INT_2_10_10_10_REV, 0 for w.
+ *
+ * This packs with the GL 4.2 rule, c = round(x * 511), but a GL 3.3 driver may decode with the older
+ * f = (2c + 1) / 1023. The two disagree by at most 2/1023 per component, and logo.frag normalizes
+ * the normal again, so lighting moves by well under a degree: far inside verify_compact_vertices'
+ * 8/255 tolerance.
+ */
+static GLuint pack_snorm_2_10_10_10(float x, float y, float z)
+{
+    auto pack = [](float v) { return static_cast<GLuint>(static_cast<GLint>(std::round(glm::clamp(v, -1.0f, 1.0f) * 511.0f))) & 0x3ff; };
 
-    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-        log(LogLevel::ERROR, "error with framebuffer!!!\n");
+    return pack(x) | (pack(y) << 10) | (pack(z) << 20);
 }
 
-void setup_geometry()
+/**
+ * Build the compact copy of the splash geometry out of the full float one
+ */
+static void setup_compact_geometry(const std::vector<SplashVertex>& vertices, const std::vector<GLuint>& indices)
 {
-    std::vector<int> logo_indices;
-    std::vector<int> shield_cyan_indices;
-    std::vector<int> shield_white_indices;
+    std::vector<CompactSplashVertex> compact(vertices.size());
+    std::vector<GLushort> compact_indices(indices.size());
+
+    for(std::size_t i = 0; i < vertices.size(); i++)
+    {
+        const SplashVertex& v = vertices[i];
+
+        compact[i] = {v.x, v.y, v.z, pack_snorm_2_10_10_10(v.nx, v.ny, v.nz), glm::packHalf1x16(v.s), glm::packHalf1x16(v.t), static_cast<GLbyte>(v.material), static_cast<GLbyte>(v.material), {0, 0}};
+    }
+
+    // Indices are relative to the first vertex of their mesh, so they only have to fit the largest mesh
+    for(std::size_t i = 0; i < indices.size(); i++)
+    {
+        if(indices[i] > 0xffff)
+        {
+            log(LogLevel::ERROR, "Mesh has too many vertices for 16-bit indices, compact vertices are unavailable\n");
+            return;
+        }
 
-    std::vector<glm::vec3> colors;
-    std::vector<GLint> material_indices;
+        compact_indices[i] = static_cast<GLushort>(indices[i]);
+    }
 
-    // Let's set up the 3Dfx logo first
-    glGenVertexArrays(1, &logo_vao);
-    glGenBuffers(1, &logo_vbo);
-    glGenBuffers(1, &logo_color_buffer);
-    glGenBuffers(1, &logo_material_buffer);
-    glGenBuffers(1, &logo_ibo);
-    glBindVertexArray(logo_vao);
-    glBindBuffer(GL_ARRAY_BUFFER, logo_vbo);
+    glGenVertexArrays(1, &splash_compact_vao);
+    glGenBuffers(1, &splash_compact_vbo);
+    glGenBuffers(1, &splash_compact_ibo);
+    glBindVertexArray(splash_compact_vao);
 
-    glBufferData(GL_ARRAY_BUFFER, num_verts[LOGO_INDEX] * sizeof(Vert), reinterpret_cast<void*>(vert[LOGO_INDEX]), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, splash_compact_vbo);
+    glBufferData(GL_ARRAY_BUFFER, compact.size() * sizeof(CompactSplashVertex), compact.data(), GL_STATIC_DRAW);
     glEnableVertexAttribArray(VERTEX_ATTRIB);
     glEnableVertexAttribArray(NORMAL_ATTRIB);
     glEnableVertexAttribArray(ST_ATTRIB);
-    glVertexAttribPointer(VERTEX_ATTRIB, 3, GL_FLOAT, GL_FALSE, sizeof(Vert), reinterpret_cast<void*>(offsetof(Vert, Vert::x)));
-    glVertexAttribPointer(NORMAL_ATTRIB, 3, GL_FLOAT, GL_FALSE, sizeof(Vert), reinterpret_cast<void*>(offsetof(Vert, Vert::nx)));
-    glVertexAttribPointer(ST_ATTRIB, 2, GL_FLOAT, GL_FALSE, sizeof(Vert), reinterpret_cast<void*>(offsetof(Vert, Vert::s)));
-
-
-    colors.resize(num_verts[LOGO_INDEX]);
-    material_indices.resize(num_verts[LOGO_INDEX]);
-    for(int i = 0 ; i < num_faces[LOGO_INDEX]; i++)
-    {
-        Face f = face[LOGO_INDEX][i];
-        logo_indices.push_back(f.v[0]);
-        logo_indices.push_back(f.v[1]);
-        logo_indices.push_back(f.v[2]);
-
-        colors[f.v[0]] = materials[f.mat_index];
-        colors[f.v[1]] = materials[f.mat_index];
-        colors[f.v[2]] = materials[f.mat_index];
-                
-        material_indices[f.v[0]] = f.mat_index;
-        material_indices[f.v[1]] = f.mat_index;
-        material_indices[f.v[2]] = f.mat_index;
-    }
-    glBindBuffer(GL_ARRAY_BUFFER, logo_material_buffer);
-    glBufferData(GL_ARRAY_BUFFER, material_indices.size() * sizeof(GLint), &material_indices[0], GL_STATIC_DRAW);
-    glVertexAttribPointer(MATERIAL_NUMBER_ATTRIB, 1, GL_INT, GL_FALSE,  sizeof(GLint), reinterpret_cast<void*>(0));
+    glEnableVertexAttribArray(COLOR_INDEX_ATTRIB);
     glEnableVertexAttribArray(MATERIAL_NUMBER_ATTRIB);
-
-    glBindBuffer(GL_ARRAY_BUFFER, logo_color_buffer);
-    glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(glm::vec3), &colors[0], GL_STATIC_DRAW);
-    glVertexAttribPointer(COLOR_ATTRIB, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), reinterpret_cast<void*>(0));
-    glEnableVertexAttribArray(COLOR_ATTRIB);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, logo_ibo);
-    logo_index_count = logo_indices.size();
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, logo_indices.size() * sizeof(int), &logo_indices[0], GL_STATIC_DRAW);
+    glVertexAttribPointer(VERTEX_ATTRIB, 3, GL_FLOAT, GL_FALSE, sizeof(CompactSplashVertex), reinterpret_cast<void*>(offsetof(CompactSplashVertex, x)));
+    glVertexAttribPointer(NORMAL_ATTRIB, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(CompactSplashVertex), reinterpret_cast<void*>(offsetof(CompactSplashVertex, normal)));
+    glVertexAttribPointer(ST_ATTRIB, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(CompactSplashVertex), reinterpret_cast<void*>(offsetof(CompactSplashVertex, s)));
+    glVertexAttribIPointer(COLOR_INDEX_ATTRIB, 1, GL_BYTE, sizeof(CompactSplashVertex), reinterpret_cast<void*>(offsetof(CompactSplashVertex, color_index)));
+    glVertexAttribIPointer(MATERIAL_NUMBER_ATTRIB, 1, GL_BYTE, sizeof(CompactSplashVertex), reinterpret_cast<void*>(offsetof(CompactSplashVertex, material)));
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, splash_compact_ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, compact_indices.size() * sizeof(GLushort), compact_indices.data(), GL_STATIC_DRAW);
+    glBindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
-    colors.clear();
-    material_indices.clear();
-
-    // Now we'll set up the cyan shield
-    glGenVertexArrays(1, &shield_cyan_vao);
-    glGenBuffers(1, &shield_cyan_vbo);
-    glGenBuffers(1, &shield_cyan_color_buffer);
-    glGenBuffers(1, &shield_cyan_material_buffer);
-    glGenBuffers(1, &shield_cyan_ibo);
-    glBindVertexArray(shield_cyan_vao);
-    glBindBuffer(GL_ARRAY_BUFFER, shield_cyan_vbo);
 
-    glEnableVertexAttribArray(VERTEX_ATTRIB);
-    glEnableVertexAttribArray(NORMAL_ATTRIB);
-    glEnableVertexAttribArray(ST_ATTRIB);
+    std::size_t full_size = vertices.size() * sizeof(SplashVertex) + indices.size() * sizeof(GLuint);
+    std::size_t compact_size = compact.size() * sizeof(CompactSplashVertex) + compact_indices.size() * sizeof(GLushort);
+    log(LogLevel::INFO, "Vertex layouts: full %zu bytes/vertex + %zu bytes/index, compact %zu bytes/vertex + %zu bytes/index (%zu -> %zu bytes)\n",
+        sizeof(SplashVertex), sizeof(GLuint), sizeof(CompactSplashVertex), sizeof(GLushort), full_size, compact_size);
+}
+
+/**
+ * Reorder a mesh's triangles for the vertex cache and overdraw, then its vertices for fetching,
+ * and log how much the cache misses before and after.
+ */
+static void optimize_mesh(int mesh, std::vector<SplashVertex>& vertices, std::vector<GLuint>& indices)
+{
+    const std::size_t count = vertices.size();
+    VertexCacheStats before = analyze_vertex_cache(indices, count);
+    std::vector<std::size_t> clusters;
+
+    optimize_vertex_cache(indices, count, VERTEX_CACHE_SIZE, &clusters);
+    bool overdraw = optimize_overdraw(indices, clusters, &vertices[0].x, sizeof(SplashVertex), count);
 
-    glVertexAttribPointer(VERTEX_ATTRIB, 3, GL_FLOAT, GL_FALSE, sizeof(Vert), reinterpret_cast<void*>(offsetof(Vert, Vert::x)));
-    glVertexAttribPointer(NORMAL_ATTRIB, 3, GL_FLOAT, GL_FALSE, sizeof(Vert), reinterpret_cast<void*>(offsetof(Vert, Vert::nx)));
-    glVertexAttribPointer(ST_ATTRIB, 2, GL_FLOAT, GL_FALSE, sizeof(Vert), reinterpret_cast<void*>(offsetof(Vert, Vert::s)));
+    std::vector<uint32_t> remap = optimize_vertex_fetch(indices, count);
+    std::vector<SplashVertex> old_vertices(vertices);
+    for(std::size_t i = 0; i < count; i++)
+        vertices[remap[i]] = old_vertices[i];
 
-    glBufferData(GL_ARRAY_BUFFER, num_verts[SHIELD_INDEX_CYAN] * sizeof(Vert), reinterpret_cast<void*>(vert[SHIELD_INDEX_CYAN]), GL_STATIC_DRAW);
+    VertexCacheStats after = analyze_vertex_cache(indices, count);
+    log(LogLevel::INFO, "Mesh %s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (%d entry FIFO, %zu clusters%s)\n", splash_meshes[mesh].name, before.acmr, after.acmr, before.atvr, after.atvr,
+        VERTEX_CACHE_SIZE, clusters.size(), overdraw ? " sorted for overdraw" : ", overdraw order would cost too many misses");
+}
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, shield_cyan_ibo);
-    colors.resize(num_verts[SHIELD_INDEX_CYAN]);
-    material_indices.resize(num_verts[SHIELD_INDEX_CYAN]);
-    for(int i = 0 ; i < num_faces[SHIELD_INDEX_CYAN]; i++)
+/**
+ * Build the vertices and indices of one mesh from its object in the splash pack.
+ *
+ * Vertices shared by faces of different materials are split, so every face gets its own material's
+ * color. The vertices are in the order the faces first use them.
+ */
+static bool load_mesh(const MeshDesc& desc, std::vector<SplashVertex>& vertices, std::vector<GLuint>& indices, int& split)
+{
+    static constexpr GLuint UNUSED = ~0u;
+    const SplashObject& object = splash_pack.object(desc.object);
+    const Vert* object_verts = object.verts;
+    const Face* object_faces = object.faces;
+    const int object_num_verts = object.num_verts;
+    std::vector<GLuint> vertex_for_material(object_num_verts * materials.size(), UNUSED);
+    std::vector<bool> used(object_num_verts, false);
+
+    for(int i = 0; i < object.num_faces; i++)
     {
-        Face f = face[SHIELD_INDEX_CYAN][i];
-        shield_cyan_indices.push_back(f.v[0]);
-        shield_cyan_indices.push_back(f.v[1]);
-        shield_cyan_indices.push_back(f.v[2]);
+        const Face& f = object_faces[i];
+
+        if(f.mat_index < 0 || f.mat_index >= static_cast<int>(materials.size()))
+        {
+            log(LogLevel::ERROR, "Mesh %s: face %d has an unknown material %d!\n", desc.name, i, f.mat_index);
+            return false;
+        }
+
+        for(int corner = 0; corner < 3; corner++)
+        {
+            int index = f.v[corner];
+
+            if(index < 0 || index >= object_num_verts)
+            {
+                log(LogLevel::ERROR, "Mesh %s: face %d uses vertex %d, but there are only %d!\n", desc.name, i, index, object_num_verts);
+                return false;
+            }
+
+            GLuint& out = vertex_for_material[index * materials.size() + f.mat_index];
+            if(out == UNUSED)
+            {
+                const Vert& v = object_verts[index];
+                const glm::vec3& color = materials[f.mat_index];
 
-        colors[f.v[0]] = materials[f.mat_index];
-        colors[f.v[1]] = materials[f.mat_index];
-        colors[f.v[2]] = materials[f.mat_index];
+                if(used[index])
+                    split++;
+                used[index] = true;
 
-        material_indices[f.v[0]] = f.mat_index;
-        material_indices[f.v[1]] = f.mat_index;
-        material_indices[f.v[2]] = f.mat_index;
+                out = static_cast<GLuint>(vertices.size());
+                vertices.push_back({v.x, v.y, v.z, v.nx, v.ny, v.nz, v.s, v.t, color.r, color.g, color.b, f.mat_index});
+            }
+
+            indices.push_back(out);
+        }
     }
-    glBindBuffer(GL_ARRAY_BUFFER, shield_cyan_material_buffer);
-    glBufferData(GL_ARRAY_BUFFER, material_indices.size() * sizeof(GLint), &material_indices[0], GL_STATIC_DRAW);
-    glVertexAttribPointer(MATERIAL_NUMBER_ATTRIB, 1, GL_INT, GL_FALSE, sizeof(GLint), reinterpret_cast<void*>(0));
-    glEnableVertexAttribArray(MATERIAL_NUMBER_ATTRIB);
 
-    glBindBuffer(GL_ARRAY_BUFFER, shield_cyan_color_buffer);
-    glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(glm::vec3), &colors[0], GL_STATIC_DRAW);
-    glVertexAttribPointer(COLOR_ATTRIB, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), reinterpret_cast<void*>(0));
-    glEnableVertexAttribArray(COLOR_ATTRIB);
+    return true;
+}
+
+/**
+ * Load every mesh into @ref splash_vertices and @ref splash_indices. Needs no GL, so the software
+ * renderer can use it as is.
+ */
+static void build_geometry()
+{
+    std::vector<SplashVertex>& vertices = splash_vertices;
+    std::vector<GLuint>& indices = splash_indices;
+    int split = 0;
+
+    // Every mesh is appended to the same vertex and index buffers, with its indices left relative to
+    // its own first vertex so they can be drawn with glDrawElementsBaseVertex
+    for(int mesh = 0; mesh < NUM_MESHES; mesh++)
+    {
+        MeshRange& range = mesh_ranges[mesh];
+        std::vector<SplashVertex> mesh_vertices;
+        std::vector<GLuint> mesh_indices;
+
+        if(!load_mesh(splash_meshes[mesh], mesh_vertices, mesh_indices, split))
+        {
+            range = {0, 0, 0, 0};
+            continue;
+        }
+
+        if(optimize_meshes)
+            optimize_mesh(mesh, mesh_vertices, mesh_indices);
+
+        range.base_vertex = static_cast<GLint>(vertices.size());
+        range.vertex_count = static_cast<GLsizei>(mesh_vertices.size());
+        range.first_index = static_cast<GLsizei>(indices.size());
+        range.index_count = static_cast<GLsizei>(mesh_indices.size());
+        vertices.insert(vertices.end(), mesh_vertices.begin(), mesh_vertices.end());
+        indices.insert(indices.end(), mesh_indices.begin(), mesh_indices.end());
+    }
+
+    log(LogLevel::INFO, "Split %d vertices shared between materials\n", split);
+}
+
+void setup_geometry()
+{
+    const std::vector<SplashVertex>& vertices = splash_vertices;
+    const std::vector<GLuint>& indices = splash_indices;
 
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, shield_cyan_indices.size() * sizeof(int), &shield_cyan_indices[0], GL_STATIC_DRAW);
-    shield_cyan_index_count = shield_cyan_indices.size();
-    colors.clear();
-    material_indices.clear();
+    build_geometry();
 
-    // Finally set up the white and yellow shield
-    glGenVertexArrays(1, &shield_white_vao);
-    glGenBuffers(1, &shield_white_vbo);
-    glGenBuffers(1, &shield_white_color_buffer);
-    glGenBuffers(1, &shield_white_material_buffer);
-    glGenBuffers(1, &shield_white_ibo);
-    glBindVertexArray(shield_white_vao);
-    glBindBuffer(GL_ARRAY_BUFFER, shield_white_vbo);
+    glGenVertexArrays(1, &splash_vao);
+    glGenBuffers(1, &splash_vbo);
+    glGenBuffers(1, &splash_ibo);
+    glBindVertexArray(splash_vao);
 
+    glBindBuffer(GL_ARRAY_BUFFER, splash_vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(SplashVertex), vertices.data(), GL_STATIC_DRAW);
     glEnableVertexAttribArray(VERTEX_ATTRIB);
     glEnableVertexAttribArray(NORMAL_ATTRIB);
     glEnableVertexAttribArray(ST_ATTRIB);
-
-    glVertexAttribPointer(VERTEX_ATTRIB, 3, GL_FLOAT, GL_FALSE, sizeof(Vert), reinterpret_cast<void*>(offsetof(Vert, Vert::x)));
-    glVertexAttribPointer(NORMAL_ATTRIB, 3, GL_FLOAT, GL_FALSE, sizeof(Vert), reinterpret_cast<void*>(offsetof(Vert, Vert::nx)));
-    glVertexAttribPointer(ST_ATTRIB, 2, GL_FLOAT, GL_FALSE, sizeof(Vert), reinterpret_cast<void*>(offsetof(Vert, Vert::s)));
-
-    glBufferData(GL_ARRAY_BUFFER, num_verts[SHIELD_INDEX_WHITE] * sizeof(Vert), reinterpret_cast<void*>(vert[SHIELD_INDEX_WHITE]), GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, shield_white_ibo);
-    colors.resize(num_verts[SHIELD_INDEX_WHITE]);
-    material_indices.resize(num_verts[SHIELD_INDEX_WHITE]);
-    for(int i = 0 ; i < num_faces[SHIELD_INDEX_WHITE]; i++)
-    {
-        Face f = face[SHIELD_INDEX_WHITE][i];
-        shield_white_indices.push_back(f.v[0]);
-        shield_white_indices.push_back(f.v[1]);
-        shield_white_indices.push_back(f.v[2]);
-
-        // This is a very dirty hack
-        if(colors[f.v[0]].r == 0)
-            colors[f.v[0]] = materials[f.mat_index];
-        if(colors[f.v[1]].r == 0)
-            colors[f.v[1]] = materials[f.mat_index];
-        if(colors[f.v[2]].r == 0)
-            colors[f.v[2]] = materials[f.mat_index];
-
-        material_indices[f.v[0]] = f.mat_index;
-        material_indices[f.v[1]] = f.mat_index;
-        material_indices[f.v[2]] = f.mat_index;
-    }
-    glBindBuffer(GL_ARRAY_BUFFER, shield_white_material_buffer);
-    glBufferData(GL_ARRAY_BUFFER, material_indices.size() * sizeof(GLint), &material_indices[0], GL_STATIC_DRAW);
-    glVertexAttribPointer(MATERIAL_NUMBER_ATTRIB, 1, GL_INT, GL_FALSE, sizeof(GLint), reinterpret_cast<void*>(0));
+    glEnableVertexAttribArray(COLOR_ATTRIB);
     glEnableVertexAttribArray(MATERIAL_NUMBER_ATTRIB);
+    glVertexAttribPointer(VERTEX_ATTRIB, 3, GL_FLOAT, GL_FALSE, sizeof(SplashVertex), reinterpret_cast<void*>(offsetof(SplashVertex, x)));
+    glVertexAttribPointer(NORMAL_ATTRIB, 3, GL_FLOAT, GL_FALSE, sizeof(SplashVertex), reinterpret_cast<void*>(offsetof(SplashVertex, nx)));
+    glVertexAttribPointer(ST_ATTRIB, 2, GL_FLOAT, GL_FALSE, sizeof(SplashVertex), reinterpret_cast<void*>(offsetof(SplashVertex, s)));
+    glVertexAttribPointer(COLOR_ATTRIB, 3, GL_FLOAT, GL_FALSE, sizeof(SplashVertex), reinterpret_cast<void*>(offsetof(SplashVertex, r)));
+    glVertexAttribIPointer(MATERIAL_NUMBER_ATTRIB, 1, GL_INT, sizeof(SplashVertex), reinterpret_cast<void*>(offsetof(SplashVertex, material)));
+
+    // The index buffer binding is part of the VAO, so it never has to be bound again
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, splash_ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-    glBindBuffer(GL_ARRAY_BUFFER, shield_white_color_buffer);
-    glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(glm::vec3), &colors[0], GL_STATIC_DRAW);
-    glVertexAttribPointer(COLOR_ATTRIB, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), reinterpret_cast<void*>(0));
-    glEnableVertexAttribArray(COLOR_ATTRIB);
+    log(LogLevel::INFO, "Packed %d meshes into 1 VAO, 1 vertex buffer (%zu vertices, %zu bytes) and 1 index buffer (%zu indices, %zu bytes)\n",
+        NUM_MESHES, vertices.size(), vertices.size() * sizeof(SplashVertex), indices.size(), indices.size() * sizeof(GLuint));
 
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, shield_white_indices.size() * sizeof(int), &shield_white_indices[0], GL_STATIC_DRAW);
-    shield_white_index_count = shield_white_indices.size();
+    setup_compact_geometry(vertices, indices);
 
     // Now let's set up the geometry for the lights (so we can draw them)
     glm::vec3 data = {1.0f, 1.0f, 1.0f};
@@ -299,254 +475,1375 @@ void setup_geometry()
     glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3), &data[0], GL_STATIC_DRAW);
 }
 
-void create_textures()
+/**
+ * Bind the splash geometry for a pass. The VAO holds every mesh, so this is the only bind a pass needs.
+ */
+static void bind_geometry()
 {
-    // The 3Dfx logo "marbled" texture
-    glGenTextures(1, &logo_3d_texture.tex);
-    logo_3d_texture.texinfo = reinterpret_cast<Gu3dfInfo*>(text_3dfinfo_raw);
-    logo_3d_texture.texinfo->data = reinterpret_cast<void*>(text_3dfinfo_image);
-    log(LogLevel::INFO, "Created a new texture! format == 0x%x, width = %d height = %d slod 0x%x, llod 0x%x\n",     logo_3d_texture.texinfo->header.format, 
-                                                                                                                    logo_3d_texture.texinfo->header.width, 
-                                                                                                                    logo_3d_texture.texinfo->header.height,
-                                                                                                                    logo_3d_texture.texinfo->header.small_lod,
-                                                                                                                    logo_3d_texture.texinfo->header.large_lod);
-}
-
-void download_texture(Texture& tex)
-{
-    std::vector<uint32_t> data;
-    // First we need to work out what format the texture is, and then do some
-    // fuckery like 'decompressing' the texture. What kind of fucked up
-    // format is this shit??
-    yiq422_to_rgb888(&tex.texinfo->table.nccTable, reinterpret_cast<const uint8_t*>(tex.texinfo->data), data, tex.texinfo->header.width * tex.texinfo->header.height);
-    glBindTexture(GL_TEXTURE_2D, tex.tex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex.texinfo->header.width, tex.texinfo->header.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data.data());
-    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindVertexArray(compact_vertices ? splash_compact_vao : splash_vao);
+    frame_stats.vao_binds++;
+    frame_stats.per_mesh_bound = -1;
 }
 
 /**
- * 3Dfx Splash
- * 
- * Draws the iconic 3Dfx splash screen (the pre-STB logo) in OpenGl 3.3
+ * Draw one of the meshes (an index into @ref splash_meshes) out of the bound splash geometry
  */
-int main(int argc, char** argv)
+static void draw_mesh(int mesh)
 {
-    // TODO: ARGUMENTS RELATED TO WHICH FRAME TO RENDER HERE!!
-
-    // OpenGL setup
-    SDL_Init(SDL_INIT_VIDEO);
-    SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
-    SDL_GL_SetAttribute(SDL_GL_ACCELERATED_VISUAL, 1);
-    SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
-    SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
-    SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 8);
-    SDL_GL_SetAttribute(SDL_GL_ALPHA_SIZE, 8);
-
-    SDL_GL_SetAttribute( SDL_GL_CONTEXT_MAJOR_VERSION, 3 );
-    SDL_GL_SetAttribute( SDL_GL_CONTEXT_MINOR_VERSION, 3 );
-    SDL_GL_SetAttribute( SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE );
-
-    // Enable MSAA
-    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 1);
-    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 16); // 16x MSAA
-
-    SDL_Window* hwnd = SDL_CreateWindow("3Dfx Splash", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, scr_width, scr_height, SDL_WINDOW_OPENGL);
-    SDL_GLContext context = SDL_GL_CreateContext(hwnd);
-    glewInit();
-
-    // Do OpenGL setup
-    glShadeModel(GL_FLAT);
-    glPointSize(5.0f);
-
-    // Enable Depth Testing
-    glEnable(GL_DEPTH_TEST);
-
-    // Enable backface culling
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
-    glFrontFace(GL_CCW);
+    const MeshRange& range = mesh_ranges[mesh];
 
-    // Enable MSAA
-    glEnable(GL_MULTISAMPLE);
+    if(compact_vertices)
+        glDrawElementsBaseVertex(GL_TRIANGLES, range.index_count, GL_UNSIGNED_SHORT, reinterpret_cast<void*>(range.first_index * sizeof(GLushort)), range.base_vertex);
+    else
+        glDrawElementsBaseVertex(GL_TRIANGLES, range.index_count, GL_UNSIGNED_INT, reinterpret_cast<void*>(range.first_index * sizeof(GLuint)), range.base_vertex);
+    frame_stats.draws++;
 
-    // Set up 3Dfx geometry
-    setup_materials();
-    create_textures();
-    setup_geometry();
-    setup_shadowing();
+    // With a VAO and IBO per mesh, drawing a different mesh than last time meant binding both of its buffers
+    if(mesh != frame_stats.per_mesh_bound)
+    {
+        frame_stats.per_mesh_binds++;
+        frame_stats.per_mesh_bound = mesh;
+    }
+}
 
-    download_texture(logo_3d_texture);
+/**
+ * Model matrix of every mesh at @p position (in keyframes). Keyframes come straight from the pack, and
+ * anything in between is interpolated.
+ */
+static void pose_meshes(double position, glm::mat4* models)
+{
+    int keyframe = static_cast<int>(position);
 
-    bool running = true;
-    bool wireframe = false;
-    bool play = true;
-    int frame = 1;
-    SDL_Event event;
-    CShader shadow_pass_shader("shaders/shadow");
-    CShader pass2("shaders/logo");
+    for(int mesh = 0; mesh < NUM_MESHES; mesh++)
+    {
+        if(position == keyframe)
+            models[mesh] = splash_pack.matrix(keyframe, splash_meshes[mesh].object);
+        else
+            models[mesh] = animation.sample(splash_meshes[mesh].object, position);
+    }
+}
 
-    // Let's set up the projection matrix
-    projection = glm::perspective(glm::radians(30.0f), 4.0f / 3.0f, 1.0f, 100000.0f);
-    glm::mat4 view = glm::lookAt
-    (
-        glm::vec3(-10, 0, -450), // Camera is at (4,3,3), in World Space
-        glm::vec3(0, 0, 0), // and looks at the origin
-        glm::vec3(0,1,0)  // Head is up (set to 0,-1,0 to look upside-down)
-    );
+/**
+ * Draw one frame of the animation: the shadow map first, then the lit scene into @p target_fbo
+ *
+ * @param frame     Keyframe the animation is on (or just past)
+ * @param models    Model matrix of every mesh
+ */
+static void draw_frame(CShader& shadow_pass_shader, CShader& pass2, CShadowCache& shadow_cache, CGpuProfiler& profiler, int frame, const glm::mat4* models,
+                       bool logo_textured, GLuint target_fbo)
+{
+    static std::vector<glm::mat4> shadow_key;
+    GLuint shadow_fbo = 0;
+    GLuint shadow_map = 0;
 
-    // This makes everything draw correctly for some reason?
-    // If this is removed, everything stops working?
-    view = glm::scale(view, glm::vec3(-1, 1, 1));
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
-    // Light matrices
-    glm::mat4 light_projection = glm::ortho(-850.0f, 850.0f, -850.0f, 850.0f, 1.0f, 2700.0f);
-    glm::mat4 light_view = glm::lookAt
-    (
-        light_positions[1],
-        glm::vec3(500.0f, -600.0f, 1271.0f),
-        glm::vec3(0.0f, 1.0f, 0.0f)
-    );
-    light_view = glm::scale(light_view, glm::vec3(-1, 1, 1));
-    glm::mat4 mat_lightspace = light_projection * light_view;
-    glm::mat4 mvp;
+    // The shadow map only depends on where the light and the meshes are
+    shadow_key.clear();
+    shadow_key.push_back(mat_lightspace);
+    for(int mesh = 0; mesh < NUM_MESHES; mesh++)
+        shadow_key.push_back(models[mesh]);
 
-    while(running)
+    // Draw the shields with color values multiplied by normals
+    for(int pass = 1; pass < 3; pass++)
     {
-        while(SDL_PollEvent(&event))
+        // First pass is rendering to the shadowmap, unless it's cached
+        if(pass == 1 && shadow_cache.find(shadow_key, shadow_fbo, shadow_map))
         {
-            if(event.type == SDL_QUIT)
-                running = false;
-
-            if(event.type == SDL_KEYDOWN)
+            glBindFramebuffer(GL_FRAMEBUFFER, target_fbo);
+        }
+        else if(pass == 1)
+        {
+            glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+
+            // Disable writes to the depth buffer because for some reason the shield gets
+            // written to it....
+            glBindFramebuffer(GL_FRAMEBUFFER, shadow_fbo);
+            profiler.begin("shadow");
+            shadow_cache.begin_render();
+            glClear(GL_DEPTH_BUFFER_BIT);
+            glDepthMask(false); 
+            shadow_pass_shader.bind();
+
+            shadow_pass_shader.set_uniform<const glm::mat4&>("mat_projection", light_projection);
+            shadow_pass_shader.set_uniform<const glm::mat4&>("mat_view", light_view);
+
+            bind_geometry();
+            for(int mesh = 0; mesh < NUM_MESHES; mesh++)
             {
-                if(event.key.keysym.sym == SDLK_w)
+                if(splash_meshes[mesh].casts_shadow)
                 {
-                    if(!wireframe)
-                        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-                    else
-                        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
-                    wireframe = !wireframe;
+                    glDepthMask(true);
+                    glDepthFunc(GL_ALWAYS);
                 }
 
-                if(event.key.keysym.sym == SDLK_SPACE)
-                {
-                    if(frame > total_num_frames)
-                        frame = 0;
-                    else
-                        frame++;
-                }
+                model = models[mesh];
+                shadow_pass_shader.set_uniform<const glm::mat4&>("mat_model", model);
+                profiler.begin("shadow", splash_meshes[mesh].name);
+                draw_mesh(mesh);
+                profiler.end();
+            }
+            glDepthMask(true);
+            shadow_cache.end_render();
+            profiler.end();
 
-                if(event.key.keysym.sym == SDLK_p)
-                {
-                    play = !play;
-                }
+            glBindFramebuffer(GL_FRAMEBUFFER, target_fbo);
+            shadow_pass_shader.unbind();
+        }
+        else if(pass == 2) // Shadow mapping
+        {
+            glViewport(0, 0, render_width, render_height);
+            profiler.begin("main");
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glDepthFunc(GL_ALWAYS);
+
+            if(frame > 20)
+                glDepthFunc(GL_LEQUAL);
+
+
+            pass2.bind();
+            pass2.set_uniform<const glm::mat4&>("mat_projection", projection);
+            pass2.set_uniform<const glm::mat4&>("mat_view", view);
+            
+
+            // Lighting setup
+            pass2.set_uniform<const glm::vec3&>("light0_position", light_positions[0]);
+            pass2.set_uniform<const glm::vec3&>("light1_position", light_positions[1]);
+            pass2.set_uniform<const glm::mat4&>("mat_lightmatrix", mat_lightspace);
+            pass2.set_uniform<GLint>("vertex_color_indexed", compact_vertices);
+
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, shadow_map);
+            pass2.set_uniform<GLint>("shadow_map", 0);
+
+            // The marbled texture is either decoded already, or indices + palette we decode in the shader.
+            // Every sampler gets its own unit, as samplers of different types may not share one
+            const Gu3dfHeader& logo_header = logo_3d_texture.texinfo->header;
+            GLfloat logo_texture_size = static_cast<GLfloat>(std::max(logo_header.width, logo_header.height));
+            pass2.set_uniform<GLint>("logo_textured", logo_textured && logo_3d_texture.ready);
+            pass2.set_uniform<GLint>("logo_texture_indexed", logo_3d_texture.indexed);
+            pass2.set_uniform<GLint>("logo_texture_levels", logo_3d_texture.levels);
+            pass2.set_uniform<GLfloat, GLfloat>("logo_texcoord_scale", logo_texture_size / (256.0f * logo_header.width), logo_texture_size / (256.0f * logo_header.height));
+            pass2.set_uniform<GLint>("logo_texture", 1);
+            pass2.set_uniform<GLint>("logo_indices", 2);
+            pass2.set_uniform<GLint>("logo_palette", 3);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, logo_3d_texture.indexed ? 0 : logo_3d_texture.tex);
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_2D, logo_3d_texture.indexed ? logo_3d_texture.tex : 0);
+            glActiveTexture(GL_TEXTURE3);
+            glBindTexture(GL_TEXTURE_2D, logo_3d_texture.palette);
+            glActiveTexture(GL_TEXTURE0);
+
+            bind_geometry();
+            for(int mesh = 0; mesh < NUM_MESHES; mesh++)
+            {
+                model = models[mesh];
+                pass2.set_uniform<const glm::mat4&>("mat_model", model);
+                profiler.begin("main", splash_meshes[mesh].name);
+                draw_mesh(mesh);
+                profiler.end();
             }
+
+            pass2.unbind();
+            profiler.end();
         }
+    }
+}
+
+/**
+ * Render every frame of the animation (textured) with both vertex layouts and compare the results.
+ *
+ * @return true if the compact layout looks the same, i.e no more than 0.1% of the pixels of any
+ * frame are off by more than 8/255 in any channel.
+ */
+static bool verify_compact_vertices(CShader& shadow_pass_shader, CShader& pass2, CShadowCache& shadow_cache, CGpuProfiler& profiler)
+{
+    static constexpr int MAX_DIFFERENCE = 8;
+    const int num_pixels = render_width * render_height;
+    std::vector<uint8_t> full(num_pixels * 4);
+    std::vector<uint8_t> compact(num_pixels * 4);
+    GLuint fbo, color, depth;
+    int worst_frame = 0;
+    int worst_pixels = 0;
+    int max_difference = 0;
+
+    if(splash_compact_vao == 0)
+        return false;
+
+    glGenFramebuffers(1, &fbo);
+    glGenTextures(1, &color);
+    glGenRenderbuffers(1, &depth);
+    glBindTexture(GL_TEXTURE_2D, color);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, render_width, render_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, render_width, render_height);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
 
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    for(int frame = 0; frame <= total_num_frames; frame++)
+    {
+        glm::mat4 models[NUM_MESHES];
+        int differing = 0;
 
-        // Draw the shields with color values multiplied by normals
-        for(int pass = 1; pass < 3; pass++)
+        pose_meshes(frame, models);
+        for(int layout = 0; layout < 2; layout++)
         {
-            // First pass is rendering to the shadowmap
-            if(pass == 1)
-            {
-                glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+            // The poses are the same, so without this the second layout would reuse the first's shadow maps
+            shadow_cache.invalidate();
+            compact_vertices = (layout == 1);
+            profiler.begin_frame(frame);
+            draw_frame(shadow_pass_shader, pass2, shadow_cache, profiler, frame, models, true, fbo);
+            glReadPixels(0, 0, render_width, render_height, GL_RGBA, GL_UNSIGNED_BYTE, compact_vertices ? compact.data() : full.data());
+        }
 
-                // Disable writes to the depth buffer because for some reason the shield gets
-                // written to it....
-                glBindFramebuffer(GL_FRAMEBUFFER, depth_map_fbo);
-                glClear(GL_DEPTH_BUFFER_BIT);
-                glDepthMask(false); 
-                shadow_pass_shader.bind();
+        for(int i = 0; i < num_pixels; i++)
+        {
+            int difference = 0;
 
-                shadow_pass_shader.set_uniform<const glm::mat4&>("mat_projection", light_projection);
-                shadow_pass_shader.set_uniform<const glm::mat4&>("mat_view", light_view);
+            for(int c = 0; c < 3; c++)
+                difference = std::max(difference, std::abs(full[i * 4 + c] - compact[i * 4 + c]));
 
-                model = mat[frame][SHIELD_INDEX_CYAN];
-                shadow_pass_shader.set_uniform<const glm::mat4&>("mat_model", model);
-                glBindVertexArray(shield_cyan_vao);
-                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, shield_cyan_ibo);
-                glDrawElements(GL_TRIANGLES, shield_cyan_index_count, GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
+            max_difference = std::max(max_difference, difference);
+            if(difference > MAX_DIFFERENCE)
+                differing++;
+        }
 
-                // Draw the white part of the shield
-                model = mat[frame][SHIELD_INDEX_WHITE];
-                shadow_pass_shader.set_uniform<const glm::mat4&>("mat_model", model);
-                glBindVertexArray(shield_white_vao);
-                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, shield_white_ibo);
-                glDrawElements(GL_TRIANGLES, shield_white_index_count, GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
-
-                glDepthMask(true); 
-                glDepthFunc(GL_ALWAYS);
-                // Get the transformation matrix for the text part of the logo and then draw it
-                model = mat[frame][LOGO_INDEX];
-                shadow_pass_shader.set_uniform<const glm::mat4&>("mat_model", model);
-                glBindVertexArray(logo_vao);
-                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, logo_ibo);
-                glDrawElements(GL_TRIANGLES, logo_index_count, GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
+        if(differing > worst_pixels)
+        {
+            worst_pixels = differing;
+            worst_frame = frame;
+        }
+    }
 
-                glBindFramebuffer(GL_FRAMEBUFFER, 0);
-                shadow_pass_shader.unbind();
-            }
-            else if(pass == 2) // Shadow mapping
-            {
-                glViewport(0, 0, 640, 480);
-                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-                glDepthFunc(GL_ALWAYS);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(1, &color);
+    glDeleteRenderbuffers(1, &depth);
+    compact_vertices = false;
 
-                if(frame > 20)
-                    glDepthFunc(GL_LEQUAL);
+    bool same = (worst_pixels * 1000 <= num_pixels);
+    log(same ? LogLevel::INFO : LogLevel::ERROR, "Compact vertices: largest difference %d/255, worst frame %d has %d pixels off by more than %d/255\n",
+        max_difference, worst_frame, worst_pixels, MAX_DIFFERENCE);
+    return same;
+}
 
+/**
+ * Point @ref soft_meshes at the splash geometry, a mesh for each of @ref splash_meshes
+ */
+static void setup_soft_meshes()
+{
+    for(int mesh = 0; mesh < NUM_MESHES; mesh++)
+    {
+        const MeshRange& range = mesh_ranges[mesh];
+        const SplashVertex* first = splash_vertices.data() + range.base_vertex;
 
-                pass2.bind();
-                pass2.set_uniform<const glm::mat4&>("mat_projection", projection);
-                pass2.set_uniform<const glm::mat4&>("mat_view", view);
-                
+        soft_meshes[mesh] = {&first->x, &first->nx, &first->r, &first->s, &first->material, sizeof(SplashVertex), range.vertex_count,
+                        splash_indices.data() + range.first_index, range.index_count, splash_meshes[mesh].casts_shadow};
+    }
+}
 
-                // Lighting setup
-                pass2.set_uniform<const glm::vec3&>("light0_position", light_positions[0]);
-                pass2.set_uniform<const glm::vec3&>("light1_position", light_positions[1]);
-                pass2.set_uniform<const glm::mat4&>("mat_lightmatrix", mat_lightspace);
+/**
+ * What draw_frame gives the shaders for @p frame, for the software renderer
+ */
+static SoftScene soft_scene(const glm::mat4* models, int frame)
+{
+    SoftScene scene;
+
+    scene.meshes = soft_meshes;
+    scene.models = models;
+    scene.num_meshes = NUM_MESHES;
+    scene.projection = projection;
+    scene.view = view;
+    scene.light_projection = light_projection;
+    scene.light_view = light_view;
+    scene.light0_position = light_positions[0];
+    scene.light1_position = light_positions[1];
+    scene.depth_test = frame > 20;
+    return scene;
+}
 
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, depth_map);
+/**
+ * Render every frame of the animation with the software renderer and the GPU, and compare them.
+ * The GPU renders without MSAA, as the software renderer takes one sample a pixel.
+ *
+ * @return true if they look the same, i.e no more than 1% of the pixels of any frame are off by more
+ * than 16/255 in any channel. Edges can land on different pixels, and the GPU's shadow map is 16-bit
+ * (GL_DEPTH_COMPONENT16) rather than float. Over the light's 2699 unit depth range that's a step of
+ * about 0.04 units, so a surface within that of its occluder can land on either side of the shadow
+ * test and be off by the whole shadow (a quarter of its colour, well past 16/255). There are only a
+ * few of those, which is what the 1% allows for.
+ */
+static bool verify_soft_renderer(CShader& shadow_pass_shader, CShader& pass2, CShadowCache& shadow_cache, CGpuProfiler& profiler)
+{
+    static constexpr int MAX_DIFFERENCE = 16;
+    const int num_pixels = render_width * render_height;
+    std::vector<uint8_t> gpu(num_pixels * 4);
+    std::vector<uint8_t> cpu(num_pixels * 4);
+    CWorkerPool pool;
+    CSoftRenderer renderer(render_width, render_height, SHADOW_WIDTH, SHADOW_HEIGHT, pool);
+    GLuint fbo, color, depth;
+    int worst_frame = 0;
+    int worst_pixels = 0;
+    double total_difference = 0.0;
+
+    glGenFramebuffers(1, &fbo);
+    glGenTextures(1, &color);
+    glGenRenderbuffers(1, &depth);
+    glBindTexture(GL_TEXTURE_2D, color);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, render_width, render_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, render_width, render_height);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+
+    setup_soft_meshes();
+    for(int frame = 0; frame <= total_num_frames; frame++)
+    {
+        glm::mat4 models[NUM_MESHES];
+        int differing = 0;
 
-                // Draw the cyan part of the shield
-                model = mat[frame][SHIELD_INDEX_CYAN];
-                pass2.set_uniform<const glm::mat4&>("mat_model", model);
-                glBindVertexArray(shield_cyan_vao);
-                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, shield_cyan_ibo);
-                glDrawElements(GL_TRIANGLES, shield_cyan_index_count, GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
+        pose_meshes(frame, models);
+        profiler.begin_frame(frame);
+        draw_frame(shadow_pass_shader, pass2, shadow_cache, profiler, frame, models, false, fbo);
+        glReadPixels(0, 0, render_width, render_height, GL_RGBA, GL_UNSIGNED_BYTE, gpu.data());
+        renderer.render(soft_scene(models, frame), cpu.data());
 
-                // Draw the white part of the shield
-                model = mat[frame][SHIELD_INDEX_WHITE];
-                pass2.set_uniform<const glm::mat4&>("mat_model", model);
-                glBindVertexArray(shield_white_vao);
-                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, shield_white_ibo);
-                glDrawElements(GL_TRIANGLES, shield_white_index_count, GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
+        for(int i = 0; i < num_pixels; i++)
+        {
+            int difference = 0;
 
-                // Get the transformation matrix for the text part of the logo and then draw it
-                model = mat[frame][LOGO_INDEX];
-                pass2.set_uniform<const glm::mat4&>("mat_model", model);
-                glBindVertexArray(logo_vao);
-                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, logo_ibo);
-                glDrawElements(GL_TRIANGLES, logo_index_count, GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
+            for(int c = 0; c < 3; c++)
+                difference = std::max(difference, std::abs(gpu[i * 4 + c] - cpu[i * 4 + c]));
 
-                pass2.unbind();
-            }
+            total_difference += difference;
+            if(difference > MAX_DIFFERENCE)
+                differing++;
         }
 
-        if(frame > total_num_frames)
+        if(differing > worst_pixels)
         {
-            frame = 0;
+            worst_pixels = differing;
+            worst_frame = frame;
+        }
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(1, &color);
+    glDeleteRenderbuffers(1, &depth);
+
+    bool same = (worst_pixels * 100 <= num_pixels);
+    log(same ? LogLevel::INFO : LogLevel::ERROR, "Software renderer: mean difference %.3f/255, worst frame %d has %d pixels (%.2f%%) off by more than %d/255\n",
+        total_difference / (static_cast<double>(num_pixels) * (total_num_frames + 1)), worst_frame, worst_pixels, worst_pixels * 100.0 / num_pixels, MAX_DIFFERENCE);
+    return same;
+}
+
+template<typename T>
+static const T* vertex_attribute(const T* first, int index, std::size_t stride)
+{
+    return reinterpret_cast<const T*>(reinterpret_cast<const uint8_t*>(first) + static_cast<std::size_t>(index) * stride);
+}
+
+/**
+ * Download the textures the Voodoo renderer draws with, replacing the logo texture from the pack with
+ * @p logo_path if it's set
+ */
+static bool download_voodoo_textures(const char* logo_path)
+{
+    Gu3dfInfo* logo = (logo_path != nullptr && logo_3df_file.open(logo_path)) ? logo_3df_file.info() : splash_pack.texture("text");
+    Gu3dfInfo* hilite = splash_pack.texture("hilite");
+    Gu3dfInfo* shadow = splash_pack.texture("shadow");
+
+    if(logo == nullptr || hilite == nullptr || shadow == nullptr)
+    {
+        log(LogLevel::ERROR, "The splash pack is missing the text, hilite or shadow texture!\n");
+        return false;
+    }
+
+    return voodoo_logo_texture.download(logo) && voodoo_hilite_texture.download(hilite) && voodoo_shadow_texture.download(shadow);
+}
+
+/**
+ * @p state, with the color being the iterated color times @p texture (GR_COLORCOMBINE_TEXTURE_TIMES_ITRGB)
+ */
+static GrState voodoo_modulate(GrState state, const CVoodooTexture& texture, GrTextureClampMode clamp)
+{
+    state.color_function = GrCombineFunction::GR_COMBINE_FUNCTION_SCALE_OTHER;
+    state.color_factor = GrCombineFactor::GR_COMBINE_FACTOR_LOCAL;
+    state.color_local = GrCombineLocal::GR_COMBINE_LOCAL_ITERATED;
+    state.color_other = GrCombineOther::GR_COMBINE_OTHER_TEXTURE;
+    state.texture = &texture;
+    state.clamp_s = clamp;
+    state.clamp_t = clamp;
+    return state;
+}
+
+/**
+ * Draw @p frame through the emulated Voodoo pipeline, the way a Glide application of the time would.
+ *
+ * The vertices are lit on the CPU with the same lights and materials as logo.frag, and Gouraud shaded.
+ * The shields' texture coordinates were made for the shadow texture, which they're modulated by in
+ * place of the shadow map. The 3D is modulated by the marbled texture, then drawn again with the hilite
+ * texture added on top, looked up by how close each vertex reflects light 0 into the camera.
+ */
+static void draw_voodoo_frame(CVoodooRenderer& voodoo, int frame, const glm::mat4* models)
+{
+    static constexpr float AMBIENT = 0.3f;
+    static constexpr GrColor_t SPECULAR = 0xff999999;    // 0.6, as logo.frag has it
+    const glm::mat4 view_projection = projection * view;
+    const glm::vec3 eye = glm::vec3(glm::inverse(view)[3]);
+    const bool depth_test = frame > 20;
+    std::vector<GrClipVertex> vertices;
+    std::vector<GrClipVertex> hilites;
+    std::vector<bool> facing_light;
+    GrState state;
+
+    state.depth_mode = voodoo_depth_mode;
+    state.depth_function = depth_test ? GrCmpFnc::GR_CMP_LEQUAL : GrCmpFnc::GR_CMP_ALWAYS;
+    state.depth_mask = depth_test;
+    state.cull_mode = GrCullMode::GR_CULL_POSITIVE;     // Back faces, with y going down the screen
+
+    GrState hilite = voodoo_modulate(state, voodoo_hilite_texture, GrTextureClampMode::GR_TEXTURECLAMP_CLAMP);
+    hilite.color_local = GrCombineLocal::GR_COMBINE_LOCAL_CONSTANT;
+    hilite.constant_color = SPECULAR;
+    hilite.src_blend = GrAlphaBlendFnc::GR_BLEND_ONE;
+    hilite.dst_blend = GrAlphaBlendFnc::GR_BLEND_ONE;
+    hilite.depth_mask = false;
+
+    voodoo.buffer_clear(0x00000000, 0xffff);
+    for(int mesh = 0; mesh < NUM_MESHES; mesh++)
+    {
+        const SoftMesh& soft_mesh = soft_meshes[mesh];
+        const glm::mat4& model = models[mesh];
+        const glm::mat3 normal_matrix = glm::mat3(glm::transpose(model));
+        // The shields are what the logo's shadow falls on
+        const bool shadowed = !soft_mesh.casts_shadow;
+        int current_material = -1;
+        bool has_hilites = false;
+
+        vertices.resize(soft_mesh.num_vertices);
+        hilites.resize(soft_mesh.num_vertices);
+        facing_light.assign(soft_mesh.num_vertices, false);
+        for(int i = 0; i < soft_mesh.num_vertices; i++)
+        {
+            const float* p = vertex_attribute(soft_mesh.positions, i, soft_mesh.stride);
+            const float* n = vertex_attribute(soft_mesh.normals, i, soft_mesh.stride);
+            const float* c = vertex_attribute(soft_mesh.colors, i, soft_mesh.stride);
+            const float* st = vertex_attribute(soft_mesh.texcoords, i, soft_mesh.stride);
+            const int material = *vertex_attribute(soft_mesh.materials, i, soft_mesh.stride);
+            const glm::vec4 world = model * glm::vec4(p[0], p[1], p[2], 1.0f);
+            const glm::vec3 position(world);
+            const glm::vec3 normal = glm::normalize(normal_matrix * glm::vec3(n[0], n[1], n[2]));
+            const glm::vec3 to_light0 = glm::normalize(light_positions[0] - position);
+            const float diffuse0 = std::max(glm::dot(normal, to_light0), 0.0f);
+            const glm::vec3 color(c[0], c[1], c[2]);
+            glm::vec3 lit;
+
+            if(material == 0)
+            {
+                const float diffuse1 = std::max(glm::dot(normal, glm::normalize(light_positions[1] - position)), 0.0f);
+                lit = (AMBIENT + diffuse0 + diffuse1 * 0.5f) * 0.8f * color;
+            }
+            else
+                lit = (AMBIENT + 1.0f) * diffuse0 * 0.7f * color;
+
+            lit = glm::min(lit, glm::vec3(1.0f)) * 255.0f;
+
+            GrClipVertex& v = vertices[i];
+            v.clip = view_projection * world;
+            v.r = lit.r;
+            v.g = lit.g;
+            v.b = lit.b;
+            v.a = 255.0f;
+            v.s = st[0];
+            v.t = st[1];
+
+            if(material != 0)
+                continue;
+
+            // Centre the hilite texture on the direction to light 0, and look it up by where the
+            // vertex reflects the camera to. The texture has a stray texel in a corner, so keep to
+            // the empty border around the spot.
+            static constexpr float HILITE_MIN = 16.0f;
+            static constexpr float HILITE_MAX = 240.0f;
+            const glm::vec3 reflected = glm::reflect(glm::normalize(position - eye), normal);
+            const glm::vec3 across = glm::normalize(glm::cross(to_light0, glm::vec3(0.0f, 1.0f, 0.0f)));
+            const glm::vec3 up = glm::cross(across, to_light0);
+
+            hilites[i] = v;
+            hilites[i].s = glm::clamp(128.0f + 256.0f * glm::dot(reflected, across), HILITE_MIN, HILITE_MAX);
+            hilites[i].t = glm::clamp(128.0f + 256.0f * glm::dot(reflected, up), HILITE_MIN, HILITE_MAX);
+            facing_light[i] = glm::dot(reflected, to_light0) > 0.0f;
+            has_hilites |= facing_light[i];
+        }
+
+        for(int t = 0; t + 2 < soft_mesh.num_indices; t += 3)
+        {
+            const uint32_t* index = soft_mesh.indices + t;
+            const int material = *vertex_attribute(soft_mesh.materials, index[2], soft_mesh.stride);
+
+            if(material != current_material)
+            {
+                if(shadowed)
+                    voodoo.set_state(voodoo_modulate(state, voodoo_shadow_texture, GrTextureClampMode::GR_TEXTURECLAMP_CLAMP));
+                else if(material == 0)
+                    voodoo.set_state(voodoo_modulate(state, voodoo_logo_texture, GrTextureClampMode::GR_TEXTURECLAMP_WRAP));
+                else
+                    voodoo.set_state(state);
+                current_material = material;
+            }
+
+            voodoo.draw_triangle_clipped(vertices[index[0]], vertices[index[1]], vertices[index[2]]);
+        }
+
+        if(!has_hilites)
             continue;
+
+        // Only triangles reflecting towards light 0 at every corner can reach the spot, and behind
+        // the light the texture coordinates fold back over it
+        voodoo.set_state(hilite);
+        for(int t = 0; t + 2 < soft_mesh.num_indices; t += 3)
+        {
+            const uint32_t* index = soft_mesh.indices + t;
+
+            if(*vertex_attribute(soft_mesh.materials, index[2], soft_mesh.stride) == 0 &&
+               facing_light[index[0]] && facing_light[index[1]] && facing_light[index[2]])
+                voodoo.draw_triangle_clipped(hilites[index[0]], hilites[index[1]], hilites[index[2]]);
+        }
+    }
+}
+
+/**
+ * Renders a keyframe on the CPU into render_width * render_height RGBA8 pixels, bottom row first
+ */
+using CpuFrameRenderer = std::function<void(int frame, uint8_t* pixels)>;
+
+/**
+ * A software renderer on @p pool
+ */
+static CpuFrameRenderer soft_frame_renderer(CWorkerPool& pool)
+{
+    std::shared_ptr<CSoftRenderer> renderer = std::make_shared<CSoftRenderer>(render_width, render_height, SHADOW_WIDTH, SHADOW_HEIGHT, pool);
+
+    return [renderer](int frame, uint8_t* pixels)
+    {
+        glm::mat4 models[NUM_MESHES];
+
+        pose_meshes(frame, models);
+        renderer->render(soft_scene(models, frame), pixels);
+    };
+}
+
+/**
+ * A Voodoo renderer on @p pool
+ */
+static CpuFrameRenderer voodoo_frame_renderer(CWorkerPool& pool)
+{
+    std::shared_ptr<CVoodooRenderer> renderer = std::make_shared<CVoodooRenderer>(render_width, render_height, pool);
+
+    return [renderer](int frame, uint8_t* pixels)
+    {
+        glm::mat4 models[NUM_MESHES];
+
+        pose_meshes(frame, models);
+        draw_voodoo_frame(*renderer, frame, models);
+        renderer->render(pixels);
+    };
+}
+
+/**
+ * Render the whole animation on the CPU on 1..N threads, and log the frame rate of each
+ *
+ * @param name      What to log it as
+ * @param create    Makes the renderer for a pool of threads
+ *
+ * @return 0, or 1 if any thread count renders differently to one thread
+ */
+static int bench_cpu_renderer(const char* name, const std::function<CpuFrameRenderer(CWorkerPool& pool)>& create)
+{
+    const std::size_t frame_size = static_cast<std::size_t>(render_width) * render_height * 4;
+    const int max_threads = std::max(4, static_cast<int>(std::thread::hardware_concurrency()));
+    std::vector<uint8_t> reference(frame_size * (total_num_frames + 1));
+    std::vector<uint8_t> pixels(frame_size);
+    double single_fps = 0.0;
+    int ret = 0;
+
+    log(LogLevel::INFO, "%s: rendering %d frames at %dx%d, 1..%d threads\n", name, total_num_frames + 1, render_width, render_height, max_threads);
+
+    for(int threads = 1; threads <= max_threads; threads++)
+    {
+        CWorkerPool pool(threads);
+        CpuFrameRenderer render = create(pool);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::chrono::duration<double> elapsed;
+        int frames = 0;
+        bool same = true;
+
+        // At least a loop of the animation and a second, so short runs don't throw the rate off
+        do
+        {
+            for(int frame = 0; frame <= total_num_frames; frame++)
+            {
+                const bool first_loop = frames <= total_num_frames;
+                uint8_t* out = (threads == 1 && first_loop) ? &reference[frame_size * frame] : pixels.data();
+
+                render(frame, out);
+                if(threads > 1 && first_loop)
+                    same &= std::memcmp(out, &reference[frame_size * frame], frame_size) == 0;
+                frames++;
+            }
+
+            elapsed = std::chrono::steady_clock::now() - start;
+        } while(elapsed.count() < 1.0);
+
+        if(!same)
+        {
+            log(LogLevel::ERROR, "%s on %d threads: output differs from one thread!\n", name, threads);
+            ret = 1;
+        }
+
+        double fps = frames / elapsed.count();
+        if(threads == 1)
+            single_fps = fps;
+
+        log(LogLevel::INFO, "%s %2d threads %8.1f frames/s %6.2fx\n", name, threads, fps, fps / single_fps);
+    }
+
+    return ret;
+}
+
+/**
+ * Render keyframes @p first to @p last on the CPU, straight into @p pipeline's buffers
+ */
+static void render_cpu_frames(const CpuFrameRenderer& render, int first, int last, CFramePipeline& pipeline)
+{
+    for(int frame = first; frame <= last && pipeline.ok(); frame++)
+    {
+        uint8_t* pixels = pipeline.acquire();
+
+        render(frame, pixels);
+        pipeline.submit(pixels, frame);
+    }
+    pipeline.finish();
+}
+
+/**
+ * Render keyframes @p first to @p last into @p headless's framebuffer, and hand each one to @p pipeline.
+ * Reading a frame back overlaps drawing the next one. Stops early if the pipeline fails.
+ */
+static void render_frames(CShader& shadow_pass_shader, CShader& pass2, CShadowCache& shadow_cache, CGpuProfiler& profiler, CHeadlessContext& headless,
+                          int first, int last, CFramePipeline& pipeline)
+{
+    const std::size_t frame_size = static_cast<std::size_t>(render_width) * render_height * 4;
+    CFrameReadback readback(render_width, render_height);
+
+    // The mapped pixel buffer has to go back to GL straight away, so hand the encoders a copy
+    CFrameReadback::Callback submit_frame = [&](int frame, const uint8_t* rgba)
+    {
+        uint8_t* pixels = pipeline.acquire();
+
+        std::memcpy(pixels, rgba, frame_size);
+        pipeline.submit(pixels, frame);
+    };
+
+    for(int frame = first; frame <= last && pipeline.ok(); frame++)
+    {
+        glm::mat4 models[NUM_MESHES];
+
+        pose_meshes(frame, models);
+        profiler.begin_frame(frame);
+        draw_frame(shadow_pass_shader, pass2, shadow_cache, profiler, frame, models, false, headless.framebuffer());
+        headless.present();
+        readback.read(headless.resolved_framebuffer(), frame, submit_frame);
+        shadow_cache.update();
+    }
+    readback.finish(submit_frame);
+    pipeline.finish();
+}
+
+/**
+ * Renders keyframes first to last into a pipeline, with the GPU or the software renderer
+ */
+using FrameRenderer = std::function<void(int first, int last, CFramePipeline& pipeline)>;
+
+/**
+ * Write keyframes @p first to @p last to @p dir as frame_NNN.<format>, encoded on @p threads threads
+ * (0 for one per CPU)
+ */
+static bool export_frames(const FrameRenderer& render, const std::string& dir, ImageFormat format, int first, int last, int threads)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int written = 0;
+
+    if(mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST)
+    {
+        log(LogLevel::ERROR, "Unable to create %s: %s\n", dir.c_str(), std::strerror(errno));
+        return false;
+    }
+
+    CFramePipeline pipeline(threads, static_cast<std::size_t>(render_width) * render_height * 4,
+        [&](int, const uint8_t* rgba, std::vector<uint8_t>& out)
+        {
+            return encode_image(format, rgba, render_width, render_height, out);
+        },
+        [&](int frame, const std::vector<uint8_t>& data)
+        {
+            char name[32];
+
+            std::snprintf(name, sizeof(name), "/frame_%03d.%s", frame, image_format_extension(format));
+            bool ok = write_file(dir + name, data);
+
+            written += ok;
+            return ok;
+        });
+
+    render(first, last, pipeline);
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    log(LogLevel::INFO, "Exported %d frames (%dx%d %s) to %s in %.2fs, %.1f frames/s (%d encoder threads)\n", written, render_width, render_height,
+        image_format_extension(format), dir.c_str(), elapsed.count(), written / elapsed.count(), pipeline.num_threads());
+    return written == last - first + 1;
+}
+
+/**
+ * Stream keyframes @p first to @p last to @p path ("-" for stdout) as one video at the original frame
+ * rate, @p loops times over
+ */
+static bool stream_frames(const FrameRenderer& render, const std::string& path, StreamFormat format, int first, int last, int loops, int threads)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    CStreamOutput output;
+    int written = 0;
+
+    if(!output.open(path))
+        return false;
+
+    // A keyframe every 30ms is 100/3 frames a second
+    std::string header = stream_header(format, render_width, render_height, 100, 3);
+    if(!output.write(header.data(), header.size()))
+        return false;
+
+    CFramePipeline pipeline(threads, static_cast<std::size_t>(render_width) * render_height * 4,
+        [&](int, const uint8_t* rgba, std::vector<uint8_t>& out)
+        {
+            return encode_stream_frame(format, rgba, render_width, render_height, out);
+        },
+        [&](int, const std::vector<uint8_t>& data)
+        {
+            bool ok = output.write(data.data(), data.size());
+
+            written += ok;
+            return ok;
+        });
+
+    for(int loop = 0; loop < loops && pipeline.ok(); loop++)
+        render(first, last, pipeline);
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    log(LogLevel::INFO, "Streamed %d frames (%dx%d %s, %.1f MiB) in %.2fs, %.1f frames/s (%d encoder threads)\n", written, render_width, render_height,
+        format == StreamFormat::Y4M ? "y4m" : "rgba", output.bytes_written() / (1024.0 * 1024.0), elapsed.count(), written / elapsed.count(), pipeline.num_threads());
+    return pipeline.ok();
+}
+
+static void create_texture(Texture& tex, Gu3dfInfo* texinfo)
+{
+    glGenTextures(1, &tex.tex);
+    tex.texinfo = texinfo;
+    log(LogLevel::INFO, "Created a new texture! format == 0x%x, width = %d height = %d slod 0x%x, llod 0x%x\n",     tex.texinfo->header.format, 
+                                                                                                                    tex.texinfo->header.width, 
+                                                                                                                    tex.texinfo->header.height,
+                                                                                                                    tex.texinfo->header.small_lod,
+                                                                                                                    tex.texinfo->header.large_lod);
+}
+
+static bool create_texture(Texture& tex, const char* name)
+{
+    Gu3dfInfo* texinfo = splash_pack.texture(name);
+
+    if(texinfo == nullptr)
+    {
+        log(LogLevel::ERROR, "The splash pack has no %s texture!\n", name);
+        return false;
+    }
+
+    create_texture(tex, texinfo);
+    return true;
+}
+
+/**
+ * Create the textures, replacing the logo texture from the pack with @p logo_path if it's set
+ */
+bool create_textures(const char* logo_path)
+{
+    bool created = true;
+
+    // The 3Dfx logo "marbled" texture
+    if(logo_path != nullptr && logo_3df_file.open(logo_path))
+        create_texture(logo_3d_texture, logo_3df_file.info());
+    else
+        created &= create_texture(logo_3d_texture, "text");
+
+    // Specular highlight and shadow textures
+    created &= create_texture(specular_texture, "hilite");
+    created &= create_texture(shadow_texture, "shadow");
+    return created;
+}
+
+/**
+ * Map the splash pack, and check it has every object the splash draws
+ */
+static bool load_splash_pack(const char* path)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    if(!splash_pack.open(path))
+        return false;
+
+    for(const MeshDesc& desc : splash_meshes)
+    {
+        if(desc.object < 0 || desc.object >= splash_pack.num_objects())
+        {
+            log(LogLevel::ERROR, "%s has no object %d for the %s!\n", path, desc.object, desc.name);
+            return false;
         }
+    }
+
+    if(splash_pack.num_frames() == 0)
+    {
+        log(LogLevel::ERROR, "%s has no animation!\n", path);
+        return false;
+    }
+
+    total_num_frames = splash_pack.num_frames() - 1;
+    animation.load(&splash_pack.matrix(0, 0), splash_pack.num_frames(), splash_pack.num_objects());
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    log(LogLevel::INFO, "Loaded the splash pack in %.3fms\n", elapsed.count());
+    return true;
+}
+
+/**
+ * Turn vsync on or off to suit @p mode, falling back to plain vsync, then to a fixed rate, if the driver
+ * won't do what was asked.
+ *
+ * @param rate  Frame rate to pace at. With vsync, set to the display's refresh rate.
+ */
+static PacingMode setup_swap_interval(SDL_Window* hwnd, PacingMode mode, double& rate)
+{
+    if(mode == PacingMode::ADAPTIVE_VSYNC && SDL_GL_SetSwapInterval(-1) < 0)
+    {
+        log(LogLevel::WARN, "Adaptive vsync isn't supported, using vsync: %s\n", SDL_GetError());
+        mode = PacingMode::VSYNC;
+    }
 
-        if(play)
-            frame++;
+    if(mode == PacingMode::VSYNC && SDL_GL_SetSwapInterval(1) < 0)
+    {
+        log(LogLevel::WARN, "Unable to turn on vsync, pacing at %.2f fps instead: %s\n", rate, SDL_GetError());
+        mode = PacingMode::FIXED_RATE;
+    }
+
+    if(mode == PacingMode::VSYNC || mode == PacingMode::ADAPTIVE_VSYNC)
+    {
+        SDL_DisplayMode display_mode;
 
-        SDL_GL_SwapWindow(hwnd);
-        SDL_Delay(30);
+        rate = 60.0;
+        if(SDL_GetWindowDisplayMode(hwnd, &display_mode) == 0 && display_mode.refresh_rate > 0)
+            rate = display_mode.refresh_rate;
+    }
+    else
+    {
+        // Otherwise the driver's default swap interval would pace us too
+        SDL_GL_SetSwapInterval(0);
     }
+
+    return mode;
+}
+
+/**
+ * 3Dfx Splash
+ * 
+ * Draws the iconic 3Dfx splash screen (the pre-STB logo) in OpenGl 3.3
+ */
+int main(int argc, char** argv)
+{
+    std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+    bool gpu_palette_decode = true;
+    bool verify_gpu_decode = false;
+    bool verify_compact = false;
+    bool stream_textures = true;
+    const char* logo_path = nullptr;
+    const char* pack_path = "splash.pak";
+    const char* gpu_csv_path = nullptr;
+    PacingMode pacing = PacingMode::FIXED_RATE;
+    bool keyframe_playback = false;
+    bool verify_animation = false;
+    double frame_rate = 1000.0 / 30.0;
+    bool headless = false;
+    int max_frames = 0;
+    const char* export_dir = nullptr;
+    ImageFormat export_format = ImageFormat::PNG;
+    int export_first = 0;
+    int export_last = -1;
+    int export_threads = 0;
+    const char* stream_path = nullptr;
+    StreamFormat stream_format = StreamFormat::Y4M;
+    int stream_loops = 1;
+    bool soft_render = false;
+    bool voodoo_render = false;
+    bool bench_soft = false;
+    bool bench_voodoo = false;
+    bool verify_soft = false;
+    int soft_threads = 0;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(std::strcmp(argv[i], "--bench-decode") == 0)
+            return bench_decoders();
+        else if(std::strcmp(argv[i], "--cpu-decode") == 0)
+            gpu_palette_decode = false;
+        else if(std::strcmp(argv[i], "--verify-gpu-decode") == 0)
+            verify_gpu_decode = true;
+        else if(std::strcmp(argv[i], "--texture") == 0 && i + 1 < argc)
+            logo_path = argv[++i];
+        else if(std::strcmp(argv[i], "--pack") == 0 && i + 1 < argc)
+            pack_path = argv[++i];
+        else if(std::strcmp(argv[i], "--no-stream") == 0)
+            stream_textures = false;
+        else if(std::strcmp(argv[i], "--compact-vertices") == 0)
+            compact_vertices = true;
+        else if(std::strcmp(argv[i], "--verify-compact") == 0)
+            verify_compact = true;
+        else if(std::strcmp(argv[i], "--optimize-meshes") == 0)
+            optimize_meshes = true;
+        else if(std::strcmp(argv[i], "--keyframes") == 0)
+            keyframe_playback = true;
+        else if(std::strcmp(argv[i], "--verify-animation") == 0)
+            verify_animation = true;
+        else if(std::strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+            frame_rate = std::atof(argv[++i]);
+        else if(std::strcmp(argv[i], "--vsync") == 0)
+            pacing = PacingMode::VSYNC;
+        else if(std::strcmp(argv[i], "--adaptive-vsync") == 0)
+            pacing = PacingMode::ADAPTIVE_VSYNC;
+        else if(std::strcmp(argv[i], "--gpu-csv") == 0 && i + 1 < argc)
+            gpu_csv_path = argv[++i];
+        else if(std::strcmp(argv[i], "--headless") == 0)
+            headless = true;
+        else if(std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            max_frames = std::max(0, std::atoi(argv[++i]));
+        else if(std::strcmp(argv[i], "--export") == 0 && i + 1 < argc)
+            export_dir = argv[++i];
+        else if(std::strcmp(argv[i], "--export-format") == 0 && i + 1 < argc)
+        {
+            if(!parse_image_format(argv[++i], export_format))
+            {
+                log(LogLevel::ERROR, "Unknown image format %s (png, ppm or raw)\n", argv[i]);
+                return 1;
+            }
+        }
+        else if(std::strcmp(argv[i], "--export-frames") == 0 && i + 1 < argc)
+        {
+            if(std::sscanf(argv[++i], "%d-%d", &export_first, &export_last) == 1)
+                export_last = export_first;
+        }
+        else if(std::strcmp(argv[i], "--stream") == 0 && i + 1 < argc)
+            stream_path = argv[++i];
+        else if(std::strcmp(argv[i], "--stream-format") == 0 && i + 1 < argc)
+        {
+            if(!parse_stream_format(argv[++i], stream_format))
+            {
+                log(LogLevel::ERROR, "Unknown stream format %s (y4m or rgba)\n", argv[i]);
+                return 1;
+            }
+        }
+        else if(std::strcmp(argv[i], "--stream-loops") == 0 && i + 1 < argc)
+            stream_loops = std::max(1, std::atoi(argv[++i]));
+        else if(std::strcmp(argv[i], "--export-threads") == 0 && i + 1 < argc)
+            export_threads = std::max(0, std::atoi(argv[++i]));
+        else if(std::strcmp(argv[i], "--export-size") == 0 && i + 1 < argc)
+        {
+            if(std::sscanf(argv[++i], "%dx%d", &render_width, &render_height) != 2 || render_width <= 0 || render_height <= 0)
+            {
+                log(LogLevel::ERROR, "Export size should look like 1920x1080, not %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if(std::strcmp(argv[i], "--soft") == 0)
+            soft_render = true;
+        else if(std::strcmp(argv[i], "--soft-threads") == 0 && i + 1 < argc)
+            soft_threads = std::max(0, std::atoi(argv[++i]));
+        else if(std::strcmp(argv[i], "--bench-soft") == 0)
+            bench_soft = true;
+        else if(std::strcmp(argv[i], "--verify-soft") == 0)
+            verify_soft = true;
+        else if(std::strcmp(argv[i], "--voodoo") == 0)
+            voodoo_render = true;
+        else if(std::strcmp(argv[i], "--bench-voodoo") == 0)
+            bench_voodoo = true;
+        else if(std::strcmp(argv[i], "--voodoo-zbuffer") == 0)
+            voodoo_depth_mode = GrDepthBufferMode::GR_DEPTHBUFFER_ZBUFFER;
+        else if(std::strcmp(argv[i], "--shadow-cache") == 0 && i + 1 < argc)
+            shadow_cache_entries = std::max(0, std::atoi(argv[++i]));
+        else
+            log(LogLevel::WARN, "Unknown argument %s\n", argv[i]);
+    }
+
+    if(!load_splash_pack(pack_path))
+        return 1;
+
+    // Exporting and streaming are done offscreen, with every texture there from the first frame
+    if(export_dir != nullptr || stream_path != nullptr)
+    {
+        if(export_dir != nullptr && stream_path != nullptr)
+        {
+            log(LogLevel::ERROR, "Export frames or stream them, not both at once\n");
+            return 1;
+        }
+
+        if(export_last < 0)
+            export_last = total_num_frames;
+        if(export_first < 0 || export_first > export_last || export_last > total_num_frames)
+        {
+            log(LogLevel::ERROR, "Can't export frames %d-%d, the animation has frames 0-%d\n", export_first, export_last, total_num_frames);
+            return 1;
+        }
+
+        headless = true;
+        stream_textures = false;
+    }
+
+    if(!headless && !bench_soft && !bench_voodoo && (render_width != scr_width || render_height != scr_height))
+    {
+        log(LogLevel::WARN, "The window is always %dx%d, --export-size only applies offscreen\n", scr_width, scr_height);
+        render_width = scr_width;
+        render_height = scr_height;
+    }
+
+    if(verify_animation)
+    {
+        static constexpr float MAX_ERROR = 1e-5f;
+        float error = animation.verify(&splash_pack.matrix(0, 0));
+
+        log(error <= MAX_ERROR ? LogLevel::INFO : LogLevel::ERROR, "Animation: the decomposed keyframes are within %g of the original matrices (%g allowed)\n", error, MAX_ERROR);
+        if(error > MAX_ERROR)
+            return 1;
+    }
+
+    // The software and Voodoo renderers need no GL at all
+    if(soft_render || voodoo_render || bench_soft || bench_voodoo)
+    {
+        const bool voodoo = voodoo_render || bench_voodoo;
+
+        if(!bench_soft && !bench_voodoo && export_dir == nullptr && stream_path == nullptr)
+        {
+            log(LogLevel::ERROR, "The software and Voodoo renderers only render offscreen, with --export or --stream\n");
+            return 1;
+        }
+
+        setup_materials();
+        build_geometry();
+        setup_camera();
+        setup_soft_meshes();
+        if(voodoo && !download_voodoo_textures(logo_path))
+            return 1;
+
+        if(bench_soft || bench_voodoo)
+        {
+            int ret = 0;
+
+            if(bench_soft)
+                ret |= bench_cpu_renderer("Software renderer", soft_frame_renderer);
+            if(bench_voodoo)
+                ret |= bench_cpu_renderer("Voodoo renderer", voodoo_frame_renderer);
+            return ret;
+        }
+
+        CWorkerPool pool(soft_threads);
+        CpuFrameRenderer draw = voodoo ? voodoo_frame_renderer(pool) : soft_frame_renderer(pool);
+        FrameRenderer render = [&](int first, int last, CFramePipeline& pipeline)
+        {
+            render_cpu_frames(draw, first, last, pipeline);
+        };
+
+        log(LogLevel::INFO, "Rendering on the CPU with %d threads, %s\n", pool.size(), voodoo ? "emulating a Voodoo" : "like the shaders");
+        if(export_dir != nullptr)
+            return export_frames(render, export_dir, export_format, export_first, export_last, export_threads) ? 0 : 1;
+
+        return stream_frames(render, stream_path, stream_format, export_first, export_last, stream_loops, export_threads) ? 0 : 1;
+    }
+
+    // OpenGL setup
+    CHeadlessContext headless_context;
+    SDL_Window* hwnd = nullptr;
+
+    if(headless)
+    {
+        if(!headless_context.create_context())
+            return 1;
+
+        // Nobody can close a window that isn't there, so stop after a loop of the animation unless told otherwise
+        if(max_frames == 0)
+            max_frames = total_num_frames + 1;
+
+        if(pacing != PacingMode::FIXED_RATE)
+        {
+            log(LogLevel::WARN, "There's no vsync without a display, pacing at %.2f fps instead\n", frame_rate);
+            pacing = PacingMode::FIXED_RATE;
+        }
+    }
+    else
+    {
+        SDL_Init(SDL_INIT_VIDEO);
+        SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+        SDL_GL_SetAttribute(SDL_GL_ACCELERATED_VISUAL, 1);
+        SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
+        SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
+        SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 8);
+        SDL_GL_SetAttribute(SDL_GL_ALPHA_SIZE, 8);
+
+        SDL_GL_SetAttribute( SDL_GL_CONTEXT_MAJOR_VERSION, 3 );
+        SDL_GL_SetAttribute( SDL_GL_CONTEXT_MINOR_VERSION, 3 );
+        SDL_GL_SetAttribute( SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE );
+
+        // Enable MSAA
+        SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 1);
+        SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 16); // 16x MSAA
+
+        hwnd = SDL_CreateWindow("3Dfx Splash", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, scr_width, scr_height, SDL_WINDOW_OPENGL);
+        SDL_GLContext context = SDL_GL_CreateContext(hwnd);
+    }
+
+    // GLEW looks for a GLX display after loading the GL entry points, which a headless context doesn't have
+    GLenum glew_status = glewInit();
+    if(glew_status != GLEW_OK && !(headless && glew_status == GLEW_ERROR_NO_GLX_DISPLAY))
+    {
+        log(LogLevel::ERROR, "Unable to initialize GLEW: %s\n", reinterpret_cast<const char*>(glewGetErrorString(glew_status)));
+        return 1;
+    }
+
+    if(headless)
+    {
+        if(!headless_context.create_framebuffer(render_width, render_height, 16))
+            return 1;
+    }
+    else
+    {
+        pacing = setup_swap_interval(hwnd, pacing, frame_rate);
+    }
+
+    // Do OpenGL setup
+    glShadeModel(GL_FLAT);
+    glPointSize(5.0f);
+
+    // Enable Depth Testing
+    glEnable(GL_DEPTH_TEST);
+
+    // Enable backface culling
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+    glFrontFace(GL_CCW);
+
+    // Enable MSAA
+    glEnable(GL_MULTISAMPLE);
+
+    // Set up 3Dfx geometry
+    setup_materials();
+    if(!create_textures(logo_path))
+        return 1;
+    setup_geometry();
+    CShadowCache shadow_cache(shadow_cache_entries, SHADOW_WIDTH, SHADOW_HEIGHT);
+    CGpuProfiler profiler;
+    CFramePacer pacer(pacing, frame_rate);
+
+    if(gpu_csv_path != nullptr && !profiler.open_csv(gpu_csv_path))
+        return 1;
+
+    // Textures stream in while we start drawing, unless we have to check one before we start
+    CWorkerPool decode_pool;
+    CTexStreamer streamer(gpu_palette_decode, &decode_pool);
+    stream_textures &= !verify_gpu_decode && !verify_compact;
+    if(stream_textures)
+    {
+        streamer.queue(logo_3d_texture);
+        streamer.queue(specular_texture);
+        streamer.queue(shadow_texture);
+    }
+    else
+    {
+        download_texture(logo_3d_texture, gpu_palette_decode, &decode_pool);
+        download_texture(specular_texture, gpu_palette_decode, &decode_pool);
+        download_texture(shadow_texture, gpu_palette_decode, &decode_pool);
+    }
+
+    if(verify_gpu_decode && !verify_palette_decode(logo_3d_texture))
+        return 1;
+
+    bool running = true;
+    bool wireframe = false;
+    bool logo_textured = false;
+    bool play = true;
+    bool first_frame = true;
+    bool textures_ready = streamer.idle();
+    int frames_drawn = 0;
+    double position = 1.0;  // In keyframes
+    std::chrono::steady_clock::time_point last_time = std::chrono::steady_clock::now();
+    SDL_Event event;
+    CShader shadow_pass_shader("shaders/shadow");
+    CShader pass2("shaders/logo");
+
+    setup_camera();
+
+    // Compact vertices look their colors up by material
+    pass2.bind();
+    for(std::size_t i = 0; i < materials.size(); i++)
+        pass2.set_uniform<const glm::vec3&>("color_palette[" + std::to_string(i) + "]", materials[i]);
+    pass2.unbind();
+
+    if(verify_compact)
+    {
+        bool compact_requested = compact_vertices;
+
+        if(!verify_compact_vertices(shadow_pass_shader, pass2, shadow_cache, profiler))
+            return 1;
+        compact_vertices = compact_requested;
+    }
+
+    if(verify_soft && !verify_soft_renderer(shadow_pass_shader, pass2, shadow_cache, profiler))
+        return 1;
+
+    FrameRenderer render_gpu = [&](int first, int last, CFramePipeline& pipeline)
+    {
+        render_frames(shadow_pass_shader, pass2, shadow_cache, profiler, headless_context, first, last, pipeline);
+    };
+
+    if(export_dir != nullptr)
+    {
+        if(!export_frames(render_gpu, export_dir, export_format, export_first, export_last, export_threads))
+            return 1;
+
+        shadow_cache.log_stats();
+        return 0;
+    }
+
+    if(stream_path != nullptr)
+    {
+        if(!stream_frames(render_gpu, stream_path, stream_format, export_first, export_last, stream_loops, export_threads))
+            return 1;
+
+        shadow_cache.log_stats();
+        return 0;
+    }
+
+    while(running)
+    {
+        frame_stats = {};
+        streamer.update();
+        shadow_cache.update();
+        if(!textures_ready && streamer.idle())
+        {
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start_time;
+
+            log(LogLevel::INFO, "Every texture streamed in %.2fms after startup\n", elapsed.count());
+            textures_ready = true;
+        }
+
+        while(hwnd != nullptr && SDL_PollEvent(&event))
+        {
+            if(event.type == SDL_QUIT)
+                running = false;
+
+            if(event.type == SDL_KEYDOWN)
+            {
+                if(event.key.keysym.sym == SDLK_w)
+                {
+                    if(!wireframe)
+                        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+                    else
+                        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+                    wireframe = !wireframe;
+
+                    // The shadow pass is drawn in wireframe too
+                    shadow_cache.invalidate();
+                }
+
+                if(event.key.keysym.sym == SDLK_SPACE)
+                {
+                    position = animation.wrap(std::floor(position) + 1.0);
+                }
+
+                if(event.key.keysym.sym == SDLK_p)
+                {
+                    play = !play;
+                }
+
+                if(event.key.keysym.sym == SDLK_x)
+                {
+                    logo_textured = !logo_textured;
+                }
+
+                if(event.key.keysym.sym == SDLK_g)
+                {
+                    profiler.dump();
+                }
+
+                if(event.key.keysym.sym == SDLK_c)
+                {
+                    compact_vertices = !compact_vertices && splash_compact_vao != 0;
+                    log(LogLevel::INFO, "Drawing with %s vertices\n", compact_vertices ? "compact" : "full float");
+                }
+            }
+        }
+
+        // Play the animation back by time, so it runs at the same speed whatever the frame rate
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::chrono::duration<double> elapsed = now - last_time;
+        last_time = now;
+        if(play && !keyframe_playback)
+            position = animation.wrap(position + elapsed.count() * CAnimation::KEYFRAME_RATE);
+
+        glm::mat4 models[NUM_MESHES];
+        int frame = static_cast<int>(position);
+
+        pose_meshes(position, models);
+        profiler.begin_frame(frame);
+        draw_frame(shadow_pass_shader, pass2, shadow_cache, profiler, frame, models, logo_textured, headless ? headless_context.framebuffer() : 0);
+
+        // Or a keyframe a frame, like the original
+        if(play && keyframe_playback)
+            position = animation.wrap(position + 1.0);
+
+        profiler.begin("swap");
+        if(headless)
+            headless_context.present();
+        else
+            SDL_GL_SwapWindow(hwnd);
+        profiler.end();
+        if(first_frame)
+        {
+            // Wait for the GPU, so we time when the frame was actually done
+            glFinish();
+
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start_time;
+            log(LogLevel::INFO, "Time to first frame: %.2fms (textures %s)\n", elapsed.count(), stream_textures ? "streamed" : "uploaded up front");
+
+            log(LogLevel::INFO, "Geometry binds per frame: %d VAO for %d draws (a VAO and IBO per mesh would take %d VAO + %d IBO)\n",
+                frame_stats.vao_binds, frame_stats.draws, frame_stats.per_mesh_binds, frame_stats.per_mesh_binds);
+            first_frame = false;
+        }
+
+        if(max_frames > 0 && ++frames_drawn >= max_frames)
+            running = false;
+
+        pacer.end_frame();
+    }
+
+    pacer.log_stats();
+    shadow_cache.log_stats();
+    profiler.dump();
 }
\ No newline at end of file
@@ -0,0 +1,253 @@
+/**
+ * Binary asset pack holding the splash meshes, animation and textures
+ */
+#include "splashpack.h"
+#include "log.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(sizeof(Vert) == 32 && sizeof(Face) == 20 && sizeof(Matrix) == 64, "Pack layout depends on the splash data structs");
+
+static uint64_t align_up(uint64_t offset)
+{
+    return (offset + SPLASH_PACK_ALIGN - 1) & ~static_cast<uint64_t>(SPLASH_PACK_ALIGN - 1);
+}
+
+/**
+ * Size of a texture's texels, from its header
+ */
+static uint32_t texture_size(const Gu3dfHeader& header)
+{
+    TexMipLevel levels[TEX_MAX_MIP_LEVELS];
+    int num_levels = tex_mip_levels(&header, levels);
+
+    return num_levels == 0 ? 0 : levels[num_levels - 1].offset + levels[num_levels - 1].size;
+}
+
+bool write_splash_pack(const std::string& path, const std::vector<SplashObject>& objects, const Matrix* matrices, int num_frames,
+                       const std::vector<SplashTexture>& textures)
+{
+    std::vector<uint8_t> pack;
+    auto append = [&](const void* data, std::size_t size)
+    {
+        uint64_t offset = align_up(pack.size());
+
+        pack.resize(offset + size);
+        std::memcpy(pack.data() + offset, data, size);
+        return offset;
+    };
+
+    SplashPackHeader header = {};
+    std::vector<SplashPackObjectEntry> object_entries(objects.size());
+    std::vector<SplashPackTextureEntry> texture_entries(textures.size());
+
+    std::memcpy(header.magic, SPLASH_PACK_MAGIC, sizeof(header.magic));
+    header.version = SPLASH_PACK_VERSION;
+    header.num_objects = static_cast<uint32_t>(objects.size());
+    header.num_frames = static_cast<uint32_t>(num_frames);
+    header.num_textures = static_cast<uint32_t>(textures.size());
+    append(&header, sizeof(header));
+
+    for(std::size_t i = 0; i < objects.size(); i++)
+    {
+        object_entries[i].verts_offset = append(objects[i].verts, objects[i].num_verts * sizeof(Vert));
+        object_entries[i].faces_offset = append(objects[i].faces, objects[i].num_faces * sizeof(Face));
+        object_entries[i].num_verts = static_cast<uint32_t>(objects[i].num_verts);
+        object_entries[i].num_faces = static_cast<uint32_t>(objects[i].num_faces);
+    }
+
+    header.matrices_offset = append(matrices, num_frames * objects.size() * sizeof(Matrix));
+
+    for(std::size_t i = 0; i < textures.size(); i++)
+    {
+        SplashPackTextureEntry& entry = texture_entries[i];
+        const Gu3dfInfo* info = textures[i].info;
+
+        if(std::strlen(textures[i].name) >= sizeof(entry.name))
+        {
+            log(LogLevel::ERROR, "Texture name %s is too long for a pack\n", textures[i].name);
+            return false;
+        }
+
+        std::strncpy(entry.name, textures[i].name, sizeof(entry.name));
+        entry.header = info->header;
+        entry.table = info->table;
+        entry.mem_required = texture_size(info->header);
+        entry.data_offset = append(info->data, entry.mem_required);
+    }
+
+    header.objects_offset = append(object_entries.data(), object_entries.size() * sizeof(SplashPackObjectEntry));
+    header.textures_offset = append(texture_entries.data(), texture_entries.size() * sizeof(SplashPackTextureEntry));
+    header.size = pack.size();
+    std::memcpy(pack.data(), &header, sizeof(header));
+
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if(file == nullptr)
+    {
+        log(LogLevel::ERROR, "Unable to open %s for writing: %s\n", path.c_str(), std::strerror(errno));
+        return false;
+    }
+
+    bool written = std::fwrite(pack.data(), 1, pack.size(), file) == pack.size();
+    written &= (std::fclose(file) == 0);
+    if(!written)
+    {
+        log(LogLevel::ERROR, "Unable to write %s\n", path.c_str());
+        return false;
+    }
+
+    log(LogLevel::INFO, "Wrote %s: %zu objects, %d frames, %zu textures, %zu bytes\n", path.c_str(), objects.size(), num_frames, textures.size(), pack.size());
+    return true;
+}
+
+CSplashPack::~CSplashPack()
+{
+    close();
+}
+
+bool CSplashPack::open(const std::string& path)
+{
+    struct stat st;
+    int fd;
+
+    close();
+
+    fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        log(LogLevel::ERROR, "Unable to open %s: %s\n", path.c_str(), std::strerror(errno));
+        return false;
+    }
+
+    if(fstat(fd, &st) < 0 || static_cast<std::size_t>(st.st_size) < sizeof(SplashPackHeader))
+    {
+        log(LogLevel::ERROR, "Unable to stat %s, or it is too small to be a pack\n", path.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    mapping_size = static_cast<std::size_t>(st.st_size);
+    mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(mapping == MAP_FAILED)
+    {
+        log(LogLevel::ERROR, "Unable to map %s: %s\n", path.c_str(), std::strerror(errno));
+        mapping = nullptr;
+        mapping_size = 0;
+        return false;
+    }
+
+    if(!validate(path))
+    {
+        close();
+        return false;
+    }
+
+    log(LogLevel::INFO, "Mapped %s: %d objects, %d frames, %zu textures, %zu bytes\n", path.c_str(), num_objects(), frames, textures.size(), mapping_size);
+    return true;
+}
+
+void CSplashPack::close()
+{
+    if(mapping != nullptr)
+        munmap(mapping, mapping_size);
+
+    mapping = nullptr;
+    mapping_size = 0;
+    frames = 0;
+    matrices = nullptr;
+    objects.clear();
+    texture_names.clear();
+    textures.clear();
+}
+
+Gu3dfInfo* CSplashPack::texture(const char* name)
+{
+    for(std::size_t i = 0; i < textures.size(); i++)
+    {
+        if(texture_names[i] == name)
+            return &textures[i];
+    }
+
+    return nullptr;
+}
+
+bool CSplashPack::in_file(uint64_t offset, uint64_t size) const
+{
+    return offset % SPLASH_PACK_ALIGN == 0 && offset <= mapping_size && size <= mapping_size - offset;
+}
+
+bool CSplashPack::validate(const std::string& path)
+{
+    const uint8_t* file = static_cast<const uint8_t*>(mapping);
+    const SplashPackHeader& header = *static_cast<const SplashPackHeader*>(mapping);
+
+    if(std::memcmp(header.magic, SPLASH_PACK_MAGIC, sizeof(header.magic)) != 0)
+    {
+        log(LogLevel::ERROR, "%s is not a splash pack!\n", path.c_str());
+        return false;
+    }
+
+    if(header.version != SPLASH_PACK_VERSION)
+    {
+        log(LogLevel::ERROR, "%s is version %u, expected %u (or was written on a host of the other endianness)\n", path.c_str(), header.version, SPLASH_PACK_VERSION);
+        return false;
+    }
+
+    // Counts are multiplied by struct sizes below, so keep them small enough not to overflow
+    if(header.size != mapping_size || header.num_objects > 0xffff || header.num_frames > 0xffff || header.num_textures > 0xffff ||
+       !in_file(header.objects_offset, header.num_objects * sizeof(SplashPackObjectEntry)) ||
+       !in_file(header.matrices_offset, static_cast<uint64_t>(header.num_frames) * header.num_objects * sizeof(Matrix)) ||
+       !in_file(header.textures_offset, header.num_textures * sizeof(SplashPackTextureEntry)))
+    {
+        log(LogLevel::ERROR, "%s is truncated or corrupt\n", path.c_str());
+        return false;
+    }
+
+    frames = static_cast<int>(header.num_frames);
+    matrices = reinterpret_cast<const Matrix*>(file + header.matrices_offset);
+
+    const SplashPackObjectEntry* object_entries = reinterpret_cast<const SplashPackObjectEntry*>(file + header.objects_offset);
+    for(uint32_t i = 0; i < header.num_objects; i++)
+    {
+        const SplashPackObjectEntry& entry = object_entries[i];
+
+        if(!in_file(entry.verts_offset, static_cast<uint64_t>(entry.num_verts) * sizeof(Vert)) ||
+           !in_file(entry.faces_offset, static_cast<uint64_t>(entry.num_faces) * sizeof(Face)))
+        {
+            log(LogLevel::ERROR, "%s: object %u is outside of the file\n", path.c_str(), i);
+            return false;
+        }
+
+        objects.push_back({reinterpret_cast<const Vert*>(file + entry.verts_offset), static_cast<int>(entry.num_verts),
+                           reinterpret_cast<const Face*>(file + entry.faces_offset), static_cast<int>(entry.num_faces)});
+    }
+
+    const SplashPackTextureEntry* texture_entries = reinterpret_cast<const SplashPackTextureEntry*>(file + header.textures_offset);
+    for(uint32_t i = 0; i < header.num_textures; i++)
+    {
+        const SplashPackTextureEntry& entry = texture_entries[i];
+        Gu3dfInfo info;
+
+        if(entry.mem_required == 0 || texture_size(entry.header) != entry.mem_required || !in_file(entry.data_offset, entry.mem_required))
+        {
+            log(LogLevel::ERROR, "%s: texture %u is invalid or outside of the file\n", path.c_str(), i);
+            return false;
+        }
+
+        info.header = entry.header;
+        info.table = entry.table;
+        info.mem_required = entry.mem_required;
+        // Gu3dfInfo wants a mutable pointer, but nothing ever writes through it (the mapping is read only)
+        info.data = const_cast<uint8_t*>(file + entry.data_offset);
+        textures.push_back(info);
+        texture_names.emplace_back(entry.name, strnlen(entry.name, sizeof(entry.name)));
+    }
+
+    return true;
+}
@@ -0,0 +1,138 @@
+/**
+ * Binary asset pack holding the splash meshes, animation and textures
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "3dftex.h"
+#include "types.h"
+
+static constexpr char SPLASH_PACK_MAGIC[8] = {'3', 'D', 'F', 'X', 'P', 'A', 'C', 'K'};
+static constexpr uint32_t SPLASH_PACK_VERSION = 1;
+static constexpr std::size_t SPLASH_PACK_ALIGN = 16;    /**< Every array in the pack starts on this */
+
+/**
+ * Start of a pack file. Everything in the pack is stored the way the host lays it out in memory
+ * (little endian), so it can be used straight from the mapping.
+ */
+struct SplashPackHeader
+{
+    char magic[8];              /**< @ref SPLASH_PACK_MAGIC */
+    uint32_t version;           /**< @ref SPLASH_PACK_VERSION, also tells us the endianness matches */
+    uint32_t num_objects;
+    uint32_t num_frames;        /**< Frames of animation, each with a matrix per object */
+    uint32_t num_textures;
+    uint64_t size;              /**< Size of the whole pack in bytes */
+    uint64_t objects_offset;    /**< SplashPackObjectEntry[num_objects] */
+    uint64_t matrices_offset;   /**< Matrix[num_frames][num_objects] */
+    uint64_t textures_offset;   /**< SplashPackTextureEntry[num_textures] */
+};
+
+struct SplashPackObjectEntry
+{
+    uint64_t verts_offset;      /**< Vert[num_verts] */
+    uint64_t faces_offset;      /**< Face[num_faces] */
+    uint32_t num_verts;
+    uint32_t num_faces;
+};
+
+struct SplashPackTextureEntry
+{
+    char name[16];
+    Gu3dfHeader header;
+    GuTexTable table;
+    uint32_t mem_required;
+    uint32_t pad;
+    uint64_t data_offset;       /**< mem_required bytes of texels, largest level first */
+};
+
+/**
+ * One object's geometry, in the same form as the splash data tables
+ */
+struct SplashObject
+{
+    const Vert* verts;
+    int num_verts;
+    const Face* faces;
+    int num_faces;
+};
+
+/**
+ * A named texture to put in a pack
+ */
+struct SplashTexture
+{
+    const char* name;
+    const Gu3dfInfo* info;      /**< mem_required is ignored, and worked out from the header */
+};
+
+/**
+ * Write a pack file.
+ *
+ * @param matrices  num_frames * objects.size() matrices, a row of objects per frame
+ *
+ * @return false (and logs why) if the file can't be written
+ */
+bool write_splash_pack(const std::string& path, const std::vector<SplashObject>& objects, const Matrix* matrices, int num_frames,
+                       const std::vector<SplashTexture>& textures);
+
+/**
+ * A pack file mapped into memory.
+ *
+ * Opening it only checks the header and that everything it points to is inside the file; vertices,
+ * faces, matrices and texels are all used in place.
+ */
+class CSplashPack final
+{
+public:
+    CSplashPack() = default;
+    ~CSplashPack();
+
+    CSplashPack(const CSplashPack&) = delete;
+    CSplashPack& operator=(const CSplashPack&) = delete;
+
+    /**
+     * Map a pack. Anything previously opened is closed first.
+     *
+     * @return false (and logs why) if it can't be mapped or isn't a valid pack.
+     */
+    bool open(const std::string& path);
+
+    /**
+     * Unmap the pack. Everything it handed out is invalid afterwards.
+     */
+    void close();
+
+    int num_objects() const { return static_cast<int>(objects.size()); }
+    int num_frames() const { return frames; }
+
+    /**
+     * Geometry of an object
+     */
+    const SplashObject& object(int index) const { return objects[index]; }
+
+    /**
+     * Model matrix of an object on a frame
+     */
+    const Matrix& matrix(int frame, int object) const { return matrices[frame * objects.size() + object]; }
+
+    /**
+     * Texture called @p name, or nullptr if there isn't one. data points into the mapping.
+     */
+    Gu3dfInfo* texture(const char* name);
+
+private:
+    bool validate(const std::string& path);
+    bool in_file(uint64_t offset, uint64_t size) const;
+
+    void* mapping = nullptr;
+    std::size_t mapping_size = 0;
+    int frames = 0;
+    const Matrix* matrices = nullptr;
+    std::vector<SplashObject> objects;
+    std::vector<std::string> texture_names;
+    std::vector<Gu3dfInfo> textures;
+};
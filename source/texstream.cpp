@@ -0,0 +1,208 @@
+/**
+ * Asynchronous texture streaming
+ */
+#include "texstream.h"
+#include "3dftex.h"
+#include "log.hpp"
+
+CTexStreamer::CTexStreamer(bool _gpu_palette_decode, CWorkerPool* _pool)
+: gpu_palette_decode(_gpu_palette_decode), pool(_pool)
+{
+    for(Slot& slot : slots)
+    {
+        glGenBuffers(1, &slot.pbo);
+        slot.busy = false;
+    }
+
+    worker = std::thread(&CTexStreamer::worker_main, this);
+}
+
+CTexStreamer::~CTexStreamer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+
+    wake.notify_one();
+    worker.join();
+
+    // Anything still mapped has to be unmapped before the buffer goes away
+    for(std::unique_ptr<Job>& job : jobs)
+    {
+        if(job->state == Job::State::FILLING && job->slot >= 0)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slots[job->slot].pbo);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        else if(job->state == Job::State::UPLOADING)
+        {
+            glDeleteSync(job->fence);
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    for(Slot& slot : slots)
+        glDeleteBuffers(1, &slot.pbo);
+}
+
+void CTexStreamer::queue(Texture& tex)
+{
+    std::unique_ptr<Job> job(new Job);
+
+    job->tex = &tex;
+    job->state = Job::State::WAITING;
+    job->slot = -1;
+    job->dst = nullptr;
+    job->filled = false;
+    job->fence = nullptr;
+    job->queued = std::chrono::steady_clock::now();
+
+    tex.ready = false;
+    tex.failed = false;
+    if(!plan_texture_upload(tex, gpu_palette_decode, job->plan))
+    {
+        log(LogLevel::ERROR, "Unable to stream a texture in, it won't be drawn\n");
+        tex.failed = true;
+        return;
+    }
+
+    // The texture is complete (if blank) from here on, so it's safe to draw with straight away
+    allocate_texture_levels(tex, job->plan);
+    jobs.push_back(std::move(job));
+    update();
+}
+
+void CTexStreamer::start_filling(Job& job)
+{
+    for(int i = 0; i < RING_SIZE && job.slot < 0; i++)
+    {
+        if(!slots[i].busy)
+            job.slot = i;
+    }
+
+    if(job.slot < 0)
+        return;
+
+    // Orphan the old storage, so we never have to wait on the GPU to finish reading it
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slots[job.slot].pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, job.plan.size, nullptr, GL_STREAM_DRAW);
+    job.dst = static_cast<uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, job.plan.size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if(job.dst != nullptr)
+    {
+        slots[job.slot].busy = true;
+    }
+    else
+    {
+        log(LogLevel::WARN, "Unable to map a pixel buffer, streaming through a staging copy instead\n");
+        job.slot = -1;
+        job.staging.resize(job.plan.size);
+        job.dst = job.staging.data();
+    }
+
+    job.state = Job::State::FILLING;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fill_queue.push_back(&job);
+    }
+    wake.notify_one();
+}
+
+void CTexStreamer::update()
+{
+    for(auto it = jobs.begin(); it != jobs.end();)
+    {
+        Job& job = **it;
+
+        if(job.state == Job::State::WAITING)
+            start_filling(job);
+
+        if(job.state == Job::State::FILLING && job.filled.load(std::memory_order_acquire))
+        {
+            bool uploaded = true;
+
+            if(job.slot >= 0)
+            {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slots[job.slot].pbo);
+                uploaded = (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE);
+                if(uploaded)
+                    upload_texture_levels(*job.tex, job.plan, nullptr);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            }
+            else
+            {
+                upload_texture_levels(*job.tex, job.plan, job.staging.data());
+            }
+
+            if(uploaded)
+            {
+                job.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                job.state = Job::State::UPLOADING;
+            }
+            else
+            {
+                // The buffer contents were lost, so go round again
+                log(LogLevel::WARN, "Pixel buffer was corrupted while streaming, retrying\n");
+                slots[job.slot].busy = false;
+                job.slot = -1;
+                job.filled = false;
+                job.state = Job::State::WAITING;
+            }
+        }
+
+        if(job.state == Job::State::UPLOADING)
+        {
+            GLenum status = glClientWaitSync(job.fence, 0, 0);
+
+            if(status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+            {
+                std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - job.queued;
+
+                glDeleteSync(job.fence);
+                if(job.slot >= 0)
+                    slots[job.slot].busy = false;
+
+                job.tex->ready = true;
+                log(LogLevel::INFO, "Streamed %s texture in %.2fms\n", tex_format_name(job.tex->texinfo->header.format), elapsed.count());
+                it = jobs.erase(it);
+                continue;
+            }
+        }
+
+        ++it;
+    }
+}
+
+void CTexStreamer::finish()
+{
+    while(!idle())
+    {
+        update();
+        if(!idle())
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+void CTexStreamer::worker_main()
+{
+    for(;;)
+    {
+        Job* job;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            wake.wait(lock, [this]() { return quit || !fill_queue.empty(); });
+            if(quit)
+                return;
+
+            job = fill_queue.front();
+            fill_queue.pop_front();
+        }
+
+        fill_texture_levels(*job->tex, job->plan, job->dst, pool);
+        job->filled.store(true, std::memory_order_release);
+    }
+}
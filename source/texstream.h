@@ -0,0 +1,118 @@
+/**
+ * Asynchronous texture streaming
+ */
+#pragma once
+
+#include <GL/glew.h>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "texture.h"
+
+/**
+ * Streams textures in over a few frames instead of blocking on them before the first one.
+ *
+ * @ref queue allocates a texture's storage straight away, and hands it to a worker thread that
+ * decodes every level into a mapped pixel buffer from a small ring. @ref update (once a frame, on the
+ * render thread) issues the uploads from the buffers the worker has finished with, and fences them so a
+ * buffer is only reused once the GPU has read it. Textures have @ref Texture::ready set once their
+ * upload has completed.
+ *
+ * Everything except the worker runs on the thread that owns the GL context.
+ */
+class CTexStreamer final
+{
+public:
+    static constexpr int RING_SIZE = 3; /**< Pixel buffers in flight */
+
+public:
+    /**
+     * Constructor
+     *
+     * @param gpu_palette_decode    See @ref download_texture
+     * @param pool                  See @ref download_texture. Only the worker thread uses it.
+     */
+    explicit CTexStreamer(bool gpu_palette_decode, CWorkerPool* pool = nullptr);
+
+    /**
+     * Destructor. Waits for the worker, so the GL context must still be current.
+     */
+    ~CTexStreamer();
+
+    CTexStreamer(const CTexStreamer&) = delete;
+    CTexStreamer& operator=(const CTexStreamer&) = delete;
+
+    /**
+     * Allocate a texture and start streaming its texels in. @p tex must stay alive until it's ready.
+     * If its header is invalid, @p tex is marked @ref Texture::failed instead and never becomes ready.
+     */
+    void queue(Texture& tex);
+
+    /**
+     * Upload whatever the worker has finished, and retire uploads the GPU is done with.
+     * Call once a frame.
+     */
+    void update();
+
+    /**
+     * Block until every queued texture is ready.
+     */
+    void finish();
+
+    /**
+     * True once every queued texture is ready.
+     */
+    bool idle() const { return jobs.empty(); }
+
+private:
+    /**
+     * One texture on its way to the GPU
+     */
+    struct Job
+    {
+        enum class State
+        {
+            WAITING,        /**< Waiting for a free pixel buffer */
+            FILLING,        /**< The worker is filling it */
+            UPLOADING       /**< Upload issued, waiting on the fence */
+        };
+
+        Texture* tex;
+        TexUploadPlan plan;
+        State state;
+        int slot;                               /**< Pixel buffer, or -1 if it didn't fit in one */
+        uint8_t* dst;                           /**< Mapped buffer (or staging) the worker fills */
+        std::vector<uint8_t> staging;           /**< Used when the buffer can't be mapped */
+        std::atomic<bool> filled;
+        GLsync fence;
+        std::chrono::steady_clock::time_point queued;
+    };
+
+    /**
+     * A pixel buffer in the ring
+     */
+    struct Slot
+    {
+        GLuint pbo;
+        bool busy;
+    };
+
+    void start_filling(Job& job);
+    void worker_main();
+
+    bool gpu_palette_decode;
+    CWorkerPool* pool;
+    Slot slots[RING_SIZE];
+    std::deque<std::unique_ptr<Job>> jobs;      /**< In the order they were queued */
+
+    std::thread worker;
+    std::mutex mutex;                           /**< Protects fill_queue and quit */
+    std::condition_variable wake;
+    std::deque<Job*> fill_queue;
+    bool quit = false;
+};
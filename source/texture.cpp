@@ -0,0 +1,348 @@
+/**
+ *
+ */
+#include "texture.h"
+#include "3dftex.h"
+#include "log.hpp"
+#include "shader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+static const GlTexFormat gl_format_rgba8 = {"GL_RGBA8", GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, {GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA}, 4, false};
+
+GlTexFormat negotiate_tex_format(GrTextureFormat_t format)
+{
+    switch(static_cast<GrTextureFormat>(format))
+    {
+    case GrTextureFormat::GR_TEXFMT_RGB_565:
+        // GL_RGB565 only became a valid internal format with ARB_ES2_compatibility
+        if(GLEW_ARB_ES2_compatibility)
+            return {"GL_RGB565", GL_RGB565, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, {GL_RED, GL_GREEN, GL_BLUE, GL_ONE}, 2, true};
+        return {"GL_RGB5", GL_RGB5, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, {GL_RED, GL_GREEN, GL_BLUE, GL_ONE}, 2, true};
+    case GrTextureFormat::GR_TEXFMT_ARGB_1555:
+        return {"GL_RGB5_A1", GL_RGB5_A1, GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV, {GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA}, 2, true};
+    case GrTextureFormat::GR_TEXFMT_ARGB_4444:
+        return {"GL_RGBA4", GL_RGBA4, GL_BGRA, GL_UNSIGNED_SHORT_4_4_4_4_REV, {GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA}, 2, true};
+    case GrTextureFormat::GR_TEXFMT_INTENSITY_8:
+        return {"GL_R8", GL_R8, GL_RED, GL_UNSIGNED_BYTE, {GL_RED, GL_RED, GL_RED, GL_ONE}, 1, true};
+    case GrTextureFormat::GR_TEXFMT_ALPHA_8:
+        // Glide replicates the alpha value into the color channels
+        return {"GL_R8", GL_R8, GL_RED, GL_UNSIGNED_BYTE, {GL_RED, GL_RED, GL_RED, GL_RED}, 1, true};
+    case GrTextureFormat::GR_TEXFMT_ALPHA_INTENSITY_88:
+        // Intensity is the low byte, so it ends up in red
+        return {"GL_RG8", GL_RG8, GL_RG, GL_UNSIGNED_BYTE, {GL_RED, GL_RED, GL_RED, GL_GREEN}, 2, true};
+    default:
+        return gl_format_rgba8;
+    }
+}
+
+bool plan_texture_upload(Texture& tex, bool gpu_palette_decode, TexUploadPlan& plan)
+{
+    const Gu3dfHeader& header = tex.texinfo->header;
+
+    plan.gl_format = negotiate_tex_format(header.format);
+    plan.num_levels = tex_mip_levels(&header, plan.src_levels);
+    plan.min_filter = GL_LINEAR_MIPMAP_LINEAR;
+    plan.mag_filter = GL_LINEAR;
+    plan.size = 0;
+
+    if(plan.num_levels == 0)
+    {
+        log(LogLevel::ERROR, "Unsupported texture format 0x%x or LOD range 0x%x..0x%x!\n", header.format, header.large_lod, header.small_lod);
+        return false;
+    }
+
+    const TexMipLevel& smallest = plan.src_levels[plan.num_levels - 1];
+    if(static_cast<std::size_t>(smallest.offset) + smallest.size > tex.texinfo->mem_required)
+    {
+        log(LogLevel::ERROR, "LOD range 0x%x..0x%x needs %u bytes, but the texture only has %u!\n", header.large_lod, header.small_lod,
+            smallest.offset + smallest.size, tex.texinfo->mem_required);
+        return false;
+    }
+
+    if(plan.src_levels[0].width != static_cast<int>(header.width) || plan.src_levels[0].height != static_cast<int>(header.height))
+        log(LogLevel::WARN, "Texture is %dx%d, but its LOD and aspect ratio say %dx%d\n", header.width, header.height, plan.src_levels[0].width, plan.src_levels[0].height);
+
+    tex.indexed = gpu_palette_decode && !plan.gl_format.native && tex_format_bpp(header.format) == 1;
+    if(tex.indexed)
+    {
+        // Integer textures can't be filtered, the shader does that itself
+        plan.gl_format = {"GL_R8UI", GL_R8UI, GL_RED_INTEGER, GL_UNSIGNED_BYTE, {GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA}, 1, true};
+        plan.min_filter = GL_NEAREST_MIPMAP_NEAREST;
+        plan.mag_filter = GL_NEAREST;
+
+        if(tex.palette == 0)
+            glGenTextures(1, &tex.palette);
+        update_texture_palette(tex);
+    }
+
+    // If the file only has the one level, we decode it and box filter the rest of the chain ourselves.
+    // There's no cheap way to box filter packed texels, so this always ends up as RGBA8
+    plan.generate_mips = (plan.num_levels == 1 && !tex.indexed);
+    if(plan.generate_mips)
+    {
+        int width = plan.src_levels[0].width;
+        int height = plan.src_levels[0].height;
+
+        plan.gl_format = gl_format_rgba8;
+        for(plan.num_levels = 1; width > 1 || height > 1; plan.num_levels++)
+        {
+            width = std::max(width / 2, 1);
+            height = std::max(height / 2, 1);
+        }
+    }
+
+    for(int level = 0; level < plan.num_levels; level++)
+    {
+        TexMipLevel& mip = plan.levels[level];
+
+        mip.width = std::max(plan.src_levels[0].width >> level, 1);
+        mip.height = std::max(plan.src_levels[0].height >> level, 1);
+        mip.offset = static_cast<FxU32>(plan.size);
+        mip.size = mip.width * mip.height * plan.gl_format.bytes_per_texel;
+        plan.size += mip.size;
+    }
+
+    log(LogLevel::INFO, "Uploading %dx%d %s texture as %s%s\n", plan.levels[0].width,
+                                                               plan.levels[0].height,
+                                                               tex_format_name(header.format),
+                                                               plan.gl_format.name,
+                                                               tex.indexed ? " + 256 entry palette" : (plan.gl_format.native ? "" : " (expanded on the CPU)"));
+    return true;
+}
+
+void fill_texture_levels(const Texture& tex, const TexUploadPlan& plan, uint8_t* dst, CWorkerPool* pool)
+{
+    const uint8_t* texels = static_cast<const uint8_t*>(tex.texinfo->data);
+
+    if(plan.generate_mips)
+    {
+        const TexMipLevel* levels = plan.levels;
+        int num_texels = levels[0].width * levels[0].height;
+
+        if(pool != nullptr && num_texels >= PARALLEL_DECODE_TEXELS)
+            decode_3df_parallel(tex.texinfo, texels, reinterpret_cast<uint32_t*>(dst), num_texels, *pool);
+        else
+            decode_3df(tex.texinfo, texels, reinterpret_cast<uint32_t*>(dst), num_texels);
+        for(int level = 1; level < plan.num_levels; level++)
+        {
+            rgba8_box_downsample(reinterpret_cast<const uint32_t*>(dst + levels[level - 1].offset),
+                                 levels[level - 1].width,
+                                 levels[level - 1].height,
+                                 reinterpret_cast<uint32_t*>(dst + levels[level].offset));
+        }
+        return;
+    }
+
+    for(int level = 0; level < plan.num_levels; level++)
+    {
+        const TexMipLevel& src = plan.src_levels[level];
+        const TexMipLevel& mip = plan.levels[level];
+        CWorkerPool* level_pool = (mip.width * mip.height >= PARALLEL_DECODE_TEXELS) ? pool : nullptr;
+
+        if(plan.gl_format.native)
+        {
+            std::memcpy(dst + mip.offset, texels + src.offset, mip.size);
+        }
+        else
+        {
+            // First we need to work out what format the texture is, and then do some
+            // fuckery like 'decompressing' the texture. What kind of fucked up
+            // format is this shit??
+            if(!decode_3df_level(tex.texinfo, src, dst + mip.offset, mip.size, level_pool))
+                std::memset(dst + mip.offset, 0, mip.size);
+        }
+    }
+}
+
+void allocate_texture_levels(Texture& tex, const TexUploadPlan& plan)
+{
+    const GlTexFormat& gl_format = plan.gl_format;
+
+    glBindTexture(GL_TEXTURE_2D, tex.tex);
+    for(int level = 0; level < plan.num_levels; level++)
+        glTexImage2D(GL_TEXTURE_2D, level, gl_format.internal_format, plan.levels[level].width, plan.levels[level].height, 0, gl_format.format, gl_format.type, nullptr);
+
+    tex.levels = plan.num_levels;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, plan.num_levels - 1);
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, gl_format.swizzle);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, plan.min_filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, plan.mag_filter);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void upload_texture_levels(Texture& tex, const TexUploadPlan& plan, const void* pixels)
+{
+    const GlTexFormat& gl_format = plan.gl_format;
+
+    glBindTexture(GL_TEXTURE_2D, tex.tex);
+    std::size_t rgba8_size = 0;
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for(int level = 0; level < plan.num_levels; level++)
+    {
+        const TexMipLevel& mip = plan.levels[level];
+        const std::size_t rgba8_level_size = static_cast<std::size_t>(mip.width) * mip.height * 4;
+
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, mip.width, mip.height, gl_format.format, gl_format.type, static_cast<const uint8_t*>(pixels) + mip.offset);
+        log(LogLevel::INFO, "    level %d: %dx%d, %u bytes (%zu as RGBA8)\n", level, mip.width, mip.height, mip.size, rgba8_level_size);
+        rgba8_size += rgba8_level_size;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    log(LogLevel::INFO, "    %d levels, %zu bytes (%zu as RGBA8)\n", plan.num_levels, plan.size, rgba8_size);
+}
+
+/**
+ * Fill every level of a texture straight into a mapped pixel unpack buffer, and upload them from it.
+ * Saves us a staging copy, as well as the allocation for it.
+ *
+ * @return false if the buffer couldn't be mapped and nothing was uploaded
+ */
+static bool upload_texture_levels_pbo(Texture& tex, const TexUploadPlan& plan, CWorkerPool* pool)
+{
+    GLuint pbo;
+    bool filled = false;
+
+    glGenBuffers(1, &pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, plan.size, nullptr, GL_STREAM_DRAW);
+
+    uint8_t* mapped = static_cast<uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, plan.size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+    if(mapped != nullptr)
+    {
+        fill_texture_levels(tex, plan, mapped, pool);
+
+        // The buffer contents are undefined if this fails (e.g the display mode changed under us)
+        filled = (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE);
+    }
+
+    if(filled)
+        upload_texture_levels(tex, plan, nullptr);
+    else
+        log(LogLevel::WARN, "Unable to fill a pixel buffer, falling back to a staging copy\n");
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &pbo); // The texture has its own copy once the upload has been issued
+    return filled;
+}
+
+void download_texture(Texture& tex, bool gpu_palette_decode, CWorkerPool* pool)
+{
+    TexUploadPlan plan;
+
+    tex.failed = !plan_texture_upload(tex, gpu_palette_decode, plan);
+    if(tex.failed)
+        return;
+
+    allocate_texture_levels(tex, plan);
+
+    // Texels that go up as they are stored can come straight from the file
+    if(plan.gl_format.native && !plan.generate_mips)
+    {
+        upload_texture_levels(tex, plan, tex.texinfo->data);
+    }
+    else if(!upload_texture_levels_pbo(tex, plan, pool))
+    {
+        std::vector<uint8_t> data(plan.size);
+
+        fill_texture_levels(tex, plan, data.data(), pool);
+        upload_texture_levels(tex, plan, data.data());
+    }
+
+    tex.ready = true;
+}
+
+void update_texture_palette(const Texture& tex)
+{
+    uint32_t palette[256];
+
+    if(!tex.indexed || !tex_format_palette(tex.texinfo, palette))
+        return;
+
+    glBindTexture(GL_TEXTURE_2D, tex.palette);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 256, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, palette);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+bool verify_palette_decode(const Texture& tex)
+{
+    const Gu3dfHeader& header = tex.texinfo->header;
+    GLsizei num_texels = header.width * header.height;
+    std::vector<uint32_t> reference(num_texels);
+    std::vector<uint32_t> gpu(num_texels);
+    CShader shader("shaders/palette_decode");
+    GLuint fbo, color, vao;
+    GLint viewport[4];
+    int mismatches = 0;
+
+    if(!tex.indexed)
+    {
+        log(LogLevel::WARN, "verify_palette_decode(): %s texture isn't decoded on the GPU\n", tex_format_name(header.format));
+        return true;
+    }
+
+    if(shader.load_status() != CShader::LoadStatus::SUCCESS)
+        return false;
+
+    decode_3df(tex.texinfo, tex.texinfo->data, reference.data(), num_texels);
+
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGenFramebuffers(1, &fbo);
+    glGenTextures(1, &color);
+    glGenVertexArrays(1, &vao);
+
+    glBindTexture(GL_TEXTURE_2D, color);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, header.width, header.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color, 0);
+    glViewport(0, 0, header.width, header.height);
+
+    // One fullscreen triangle, each fragment decodes the texel under it
+    glDisable(GL_DEPTH_TEST);
+    shader.bind();
+    shader.set_uniform<GLint>("indices", 0);
+    shader.set_uniform<GLint>("palette", 1);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, tex.tex);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, tex.palette);
+    glBindVertexArray(vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    shader.unbind();
+
+    glReadPixels(0, 0, header.width, header.height, GL_RGBA, GL_UNSIGNED_BYTE, gpu.data());
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindVertexArray(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glEnable(GL_DEPTH_TEST);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteTextures(1, &color);
+    glDeleteFramebuffers(1, &fbo);
+
+    for(GLsizei i = 0; i < num_texels; i++)
+    {
+        if(reference[i] != gpu[i])
+        {
+            if(mismatches == 0)
+                log(LogLevel::ERROR, "GPU decode of texel (%d, %d) is 0x%08x, expected 0x%08x\n", i % header.width, i / header.width, gpu[i], reference[i]);
+            mismatches++;
+        }
+    }
+
+    log(mismatches == 0 ? LogLevel::INFO : LogLevel::ERROR, "GPU palette decode of %dx%d %s texture: %d/%d texels differ from the CPU decoder\n", header.width,
+                                                                                                                                                header.height,
+                                                                                                                                                tex_format_name(header.format),
+                                                                                                                                                mismatches,
+                                                                                                                                                num_texels);
+    return mismatches == 0;
+}
@@ -0,0 +1,111 @@
+/**
+ * Texture upload
+ */
+#pragma once
+
+#include <GL/glew.h>
+#include <cstddef>
+#include "types.h"
+
+class CWorkerPool;
+
+/**
+ * How a Glide texture format is handed to OpenGL
+ */
+struct GlTexFormat
+{
+    const char* name;       /**< Name of the internal format (for logging) */
+    GLint internal_format;  /**< Internal format we ask OpenGL to store the texture in */
+    GLenum format;          /**< Format of the data we upload */
+    GLenum type;            /**< Type of the data we upload */
+    GLint swizzle[4];       /**< Texture swizzle to get back to RGBA */
+    int bytes_per_texel;    /**< Size of one uploaded texel */
+    bool native;            /**< True if the .3df texels can be uploaded as-is */
+};
+
+/**
+ * Pick the cheapest OpenGL format that can hold a Glide texture format.
+ *
+ * Formats that OpenGL understands directly (16-bit packed, intensity and alpha) are uploaded as-is,
+ * everything else is expanded to RGBA8 on the CPU by @ref decode_3df.
+ */
+GlTexFormat negotiate_tex_format(GrTextureFormat_t format);
+
+/**
+ * Levels with at least this many texels are decoded over a worker pool, if there is one. That's 256x256,
+ * the largest a Voodoo can sample; anything smaller is decoded before the workers would have woken up.
+ */
+static constexpr int PARALLEL_DECODE_TEXELS = 256 * 256;
+
+/**
+ * Everything needed to upload a texture, worked out up front so that the texels can be filled in
+ * off the render thread.
+ */
+struct TexUploadPlan
+{
+    GlTexFormat gl_format;                          /**< Format the levels are uploaded in */
+    TexMipLevel src_levels[TEX_MAX_MIP_LEVELS];     /**< Levels in the .3df data */
+    TexMipLevel levels[TEX_MAX_MIP_LEVELS];         /**< Uploaded levels, offsets are into the upload buffer */
+    int num_levels;                                 /**< Number of uploaded levels */
+    GLint min_filter;
+    GLint mag_filter;
+    bool generate_mips;                             /**< The data only has level 0, the rest are box filtered */
+    std::size_t size;                               /**< Size of every uploaded level, back to back */
+};
+
+/**
+ * Work out how a texture gets uploaded. Indexed textures get their palette uploaded here.
+ *
+ * @return false (and logs why) if the texture header is invalid.
+ */
+bool plan_texture_upload(Texture& tex, bool gpu_palette_decode, TexUploadPlan& plan);
+
+/**
+ * Decode, copy or generate every level of a texture into @p dst, laid out as @p plan says.
+ * Makes no GL calls, so can be run on any thread (e.g into a buffer mapped by the render thread).
+ *
+ * @param dst   Destination, @p plan.size bytes
+ * @param pool  If not null, levels of at least @ref PARALLEL_DECODE_TEXELS are decoded over it
+ */
+void fill_texture_levels(const Texture& tex, const TexUploadPlan& plan, uint8_t* dst, CWorkerPool* pool = nullptr);
+
+/**
+ * Allocate the storage of every level of a texture and set its parameters, without any texels.
+ */
+void allocate_texture_levels(Texture& tex, const TexUploadPlan& plan);
+
+/**
+ * Upload every level of a texture into the storage from @ref allocate_texture_levels.
+ *
+ * @param pixels    Texels laid out as @p plan says, or an offset into the bound GL_PIXEL_UNPACK_BUFFER
+ */
+void upload_texture_levels(Texture& tex, const TexUploadPlan& plan, const void* pixels);
+
+/**
+ * Upload a texture to OpenGL, converting it if there is no native equivalent of its format.
+ *
+ * Every mipmap level the .3df data carries is uploaded. If it only has one, the rest of the chain is
+ * generated on the CPU with @ref rgba8_box_downsample.
+ *
+ * @param tex                   Texture to upload
+ * @param gpu_palette_decode    Upload 8-bit palettized formats (YIQ422, P8, RGB332 and AI44) as raw
+ *                              GL_R8UI indices plus a 256x1 palette texture, to be decoded in the shader.
+ *                              This is a quarter of the size of the RGBA8 expansion.
+ * @param pool                  Worker pool to decode large levels over, see @ref fill_texture_levels
+ */
+void download_texture(Texture& tex, bool gpu_palette_decode, CWorkerPool* pool = nullptr);
+
+/**
+ * Re-upload the palette of an indexed texture, e.g after its NCC table has changed.
+ * The indices themselves are left alone.
+ */
+void update_texture_palette(const Texture& tex);
+
+/**
+ * Check that decoding an indexed texture on the GPU gives the same texels as @ref decode_3df.
+ *
+ * Every texel is decoded into an offscreen framebuffer by shaders/palette_decode, then read back.
+ *
+ * @return true if every texel matches.
+ */
+bool verify_palette_decode(const Texture& tex);
@@ -23,6 +23,11 @@ typedef struct
 {
     Gu3dfInfo* texinfo;
     GLuint tex;
+    GLuint palette;             /* 256x1 palette texture when the texels are decoded on the GPU */
+    bool indexed;               /* tex holds raw 8-bit indices into palette */
+    int levels;                 /* number of mipmap levels uploaded */
+    bool ready;                 /* every level has been uploaded (textures can be streamed in) */
+    bool failed;                /* the texture couldn't be uploaded, so it will never be ready */
 } Texture;
 
 
@@ -0,0 +1,306 @@
+/**
+ * Streaming frames out as uncompressed video
+ */
+#include "videostream.h"
+#include "frameexport.h"
+#include "log.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+bool parse_stream_format(const char* name, StreamFormat& format)
+{
+    if(std::strcmp(name, "y4m") == 0)
+        format = StreamFormat::Y4M;
+    else if(std::strcmp(name, "rgba") == 0)
+        format = StreamFormat::RGBA;
+    else
+        return false;
+
+    return true;
+}
+
+// BT.601 limited range in 8.8 fixed point, the usual integer approximation
+static inline uint8_t rgb_to_y(int r, int g, int b)
+{
+    return static_cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+static inline uint8_t rgb_to_u(int r, int g, int b)
+{
+    return static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+}
+
+static inline uint8_t rgb_to_v(int r, int g, int b)
+{
+    return static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+/**
+ * Luma of pixels [@p x, @p width) of a row
+ */
+static void yuv420_luma_scalar(const uint8_t* src, int x, int width, uint8_t* y_row)
+{
+    for(; x < width; x++)
+        y_row[x] = rgb_to_y(src[x * 4], src[x * 4 + 1], src[x * 4 + 2]);
+}
+
+/**
+ * Chroma samples [@p cx, chroma width) of chroma row @p cy
+ */
+static void yuv420_chroma_scalar(const uint8_t* rgba, int width, int height, int cy, int cx, uint8_t* u_row, uint8_t* v_row)
+{
+    const std::size_t stride = static_cast<std::size_t>(width) * 4;
+    const uint8_t* row0 = rgba + (height - 1 - cy * 2) * stride;
+    const uint8_t* row1 = rgba + (height - 1 - std::min(cy * 2 + 1, height - 1)) * stride;
+    const int chroma_width = (width + 1) / 2;
+
+    for(; cx < chroma_width; cx++)
+    {
+        int x0 = cx * 2 * 4;
+        int x1 = std::min(cx * 2 + 1, width - 1) * 4;
+        int rgb[3];
+
+        for(int c = 0; c < 3; c++)
+            rgb[c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2;
+
+        u_row[cx] = rgb_to_u(rgb[0], rgb[1], rgb[2]);
+        v_row[cx] = rgb_to_v(rgb[0], rgb[1], rgb[2]);
+    }
+}
+
+static void rgba_to_yuv420_scalar(const uint8_t* rgba, int width, int height, uint8_t* y, uint8_t* u, uint8_t* v)
+{
+    const std::size_t stride = static_cast<std::size_t>(width) * 4;
+    const int chroma_width = (width + 1) / 2;
+
+    for(int row = 0; row < height; row++)
+        yuv420_luma_scalar(rgba + (height - 1 - row) * stride, 0, width, y + row * width);
+
+    for(int cy = 0; cy < (height + 1) / 2; cy++)
+        yuv420_chroma_scalar(rgba, width, height, cy, 0, u + cy * chroma_width, v + cy * chroma_width);
+}
+
+#ifdef HAVE_X86_SIMD
+/**
+ * Sum of each pixel's RGB times @p coeffs (R, G, B, 0 repeated), for 4 pixels widened to two vectors of 16-bit channels
+ */
+__attribute__((target("sse4.1")))
+static inline __m128i weigh_rgb(__m128i lo, __m128i hi, __m128i coeffs)
+{
+    return _mm_hadd_epi32(_mm_madd_epi16(lo, coeffs), _mm_madd_epi16(hi, coeffs));
+}
+
+/**
+ * Average RGBA of the 2x2 blocks under 4 pixels of @p a and @p b, as two pixels of 16-bit channels
+ */
+__attribute__((target("sse4.1")))
+static inline __m128i box_average(__m128i a, __m128i b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+
+    lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+    hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+    return _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_set1_epi16(2)), 2);
+}
+
+/**
+ * Same arithmetic as the scalar version, 8 pixels of luma and 4 chroma samples at a time
+ */
+__attribute__((target("sse4.1")))
+static void rgba_to_yuv420_sse41(const uint8_t* rgba, int width, int height, uint8_t* y, uint8_t* u, uint8_t* v)
+{
+    const std::size_t stride = static_cast<std::size_t>(width) * 4;
+    const int chroma_width = (width + 1) / 2;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(128);
+    const __m128i y_coeffs = _mm_setr_epi16(66, 129, 25, 0, 66, 129, 25, 0);
+    const __m128i u_coeffs = _mm_setr_epi16(-38, -74, 112, 0, -38, -74, 112, 0);
+    const __m128i v_coeffs = _mm_setr_epi16(112, -94, -18, 0, 112, -94, -18, 0);
+
+    for(int row = 0; row < height; row++)
+    {
+        const uint8_t* src = rgba + (height - 1 - row) * stride;
+        uint8_t* y_row = y + row * width;
+        int x = 0;
+
+        for(; x + 8 <= width; x += 8)
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4 + 16));
+            __m128i ya = weigh_rgb(_mm_unpacklo_epi8(a, zero), _mm_unpackhi_epi8(a, zero), y_coeffs);
+            __m128i yb = weigh_rgb(_mm_unpacklo_epi8(b, zero), _mm_unpackhi_epi8(b, zero), y_coeffs);
+
+            ya = _mm_add_epi32(_mm_srli_epi32(_mm_add_epi32(ya, round), 8), _mm_set1_epi32(16));
+            yb = _mm_add_epi32(_mm_srli_epi32(_mm_add_epi32(yb, round), 8), _mm_set1_epi32(16));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(y_row + x), _mm_packus_epi16(_mm_packs_epi32(ya, yb), zero));
+        }
+
+        yuv420_luma_scalar(src, x, width, y_row);
+    }
+
+    for(int cy = 0; cy < (height + 1) / 2; cy++)
+    {
+        uint8_t* u_row = u + cy * chroma_width;
+        uint8_t* v_row = v + cy * chroma_width;
+        int cx = 0;
+
+        // A last row on its own is left to the scalar code, which repeats it
+        if(cy * 2 + 1 < height)
+        {
+            const uint8_t* row0 = rgba + (height - 1 - cy * 2) * stride;
+            const uint8_t* row1 = row0 - stride;
+
+            for(; cx * 2 + 8 <= width; cx += 4)
+            {
+                __m128i s0 = box_average(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + cx * 8)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + cx * 8)));
+                __m128i s1 = box_average(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + cx * 8 + 16)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + cx * 8 + 16)));
+                __m128i us = weigh_rgb(s0, s1, u_coeffs);
+                __m128i vs = weigh_rgb(s0, s1, v_coeffs);
+
+                us = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(us, round), 8), round);
+                vs = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(vs, round), 8), round);
+
+                __m128i packed = _mm_packus_epi16(_mm_packs_epi32(us, vs), zero);
+                int32_t u4 = _mm_cvtsi128_si32(packed);
+                int32_t v4 = _mm_cvtsi128_si32(_mm_srli_si128(packed, 4));
+                std::memcpy(u_row + cx, &u4, 4);
+                std::memcpy(v_row + cx, &v4, 4);
+            }
+        }
+
+        yuv420_chroma_scalar(rgba, width, height, cy, cx, u_row, v_row);
+    }
+}
+#endif
+
+void rgba_to_yuv420(const uint8_t* rgba, int width, int height, uint8_t* y, uint8_t* u, uint8_t* v, SimdLevel level)
+{
+    if(level > simd_level_detect())
+        level = simd_level_detect();
+
+    switch(level)
+    {
+#ifdef HAVE_X86_SIMD
+    case SimdLevel::AVX2:   // No AVX2 kernel, the SSE4.1 one already converts far faster than a pipe takes the frames
+    case SimdLevel::SSE41:
+        rgba_to_yuv420_sse41(rgba, width, height, y, u, v);
+        break;
+#endif
+    default:
+        rgba_to_yuv420_scalar(rgba, width, height, y, u, v);
+        break;
+    }
+}
+
+void rgba_to_yuv420(const uint8_t* rgba, int width, int height, uint8_t* y, uint8_t* u, uint8_t* v)
+{
+    rgba_to_yuv420(rgba, width, height, y, u, v, simd_level_detect());
+}
+
+std::string stream_header(StreamFormat format, int width, int height, int fps_num, int fps_den)
+{
+    char header[128];
+
+    if(format != StreamFormat::Y4M)
+        return std::string();
+
+    // C420jpeg is 4:2:0 with the chroma centred between the pixels, which is what the box average gives
+    std::snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n", width, height, fps_num, fps_den);
+    return header;
+}
+
+bool encode_stream_frame(StreamFormat format, const uint8_t* rgba, int width, int height, std::vector<uint8_t>& out)
+{
+    static const char frame_header[] = "FRAME\n";
+
+    if(format == StreamFormat::RGBA)
+        return encode_image(ImageFormat::RAW, rgba, width, height, out);
+
+    const std::size_t luma_size = static_cast<std::size_t>(width) * height;
+    const std::size_t chroma_size = static_cast<std::size_t>((width + 1) / 2) * ((height + 1) / 2);
+    const std::size_t header_size = sizeof(frame_header) - 1;
+
+    out.resize(header_size + luma_size + chroma_size * 2);
+    std::memcpy(out.data(), frame_header, header_size);
+
+    uint8_t* y = &out[header_size];
+    rgba_to_yuv420(rgba, width, height, y, y + luma_size, y + luma_size + chroma_size);
+    return true;
+}
+
+CStreamOutput::~CStreamOutput()
+{
+    if(owns_fd)
+        ::close(fd);
+}
+
+bool CStreamOutput::open(const std::string& _path)
+{
+    struct stat st;
+
+    path = _path;
+    if(path == "-")
+    {
+        path = "stdout";
+        fd = STDOUT_FILENO;
+        owns_fd = false;
+    }
+    else
+    {
+        if(stat(path.c_str(), &st) == 0 && S_ISFIFO(st.st_mode))
+            log(LogLevel::INFO, "Waiting for something to read from %s\n", path.c_str());
+
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0)
+        {
+            log(LogLevel::ERROR, "Unable to open %s: %s\n", path.c_str(), std::strerror(errno));
+            return false;
+        }
+        owns_fd = true;
+    }
+
+    // We'd rather hear about a closed pipe from write() than be killed by it
+    std::signal(SIGPIPE, SIG_IGN);
+    return true;
+}
+
+bool CStreamOutput::write(const void* data, std::size_t size)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+
+    while(size > 0)
+    {
+        ssize_t n = ::write(fd, p, size);
+
+        if(n < 0 && errno == EINTR)
+            continue;
+
+        if(n < 0)
+        {
+            if(errno == EPIPE)
+                log(LogLevel::ERROR, "Whatever was reading %s has gone away\n", path.c_str());
+            else
+                log(LogLevel::ERROR, "Unable to write to %s: %s\n", path.c_str(), std::strerror(errno));
+            return false;
+        }
+
+        p += n;
+        size -= static_cast<std::size_t>(n);
+        written += static_cast<uint64_t>(n);
+    }
+
+    return true;
+}
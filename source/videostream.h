@@ -0,0 +1,84 @@
+/**
+ * Streaming frames out as uncompressed video
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "3dftex.h"
+
+enum class StreamFormat
+{
+    Y4M,    /**< YUV4MPEG2, 4:2:0 BT.601 limited range, which anything that reads video takes as is */
+    RGBA    /**< Bare RGBA8 frames, top row first */
+};
+
+/**
+ * Stream format from its name ("y4m" or "rgba")
+ */
+bool parse_stream_format(const char* name, StreamFormat& format);
+
+/**
+ * Convert RGBA8 to planar 4:2:0 YUV (BT.601, limited range). Each chroma sample is the average of the
+ * 2x2 pixels it covers, and odd sizes repeat the last column and row.
+ *
+ * @param rgba      Pixels, bottom row first the way glReadPixels returns them. The planes come out top row first.
+ * @param y         width * height bytes
+ * @param u         ((width + 1) / 2) * ((height + 1) / 2) bytes, and the same for @p v
+ * @param level     Kernel to use. Levels the CPU doesn't support fall back to the best one it does.
+ */
+void rgba_to_yuv420(const uint8_t* rgba, int width, int height, uint8_t* y, uint8_t* u, uint8_t* v, SimdLevel level);
+void rgba_to_yuv420(const uint8_t* rgba, int width, int height, uint8_t* y, uint8_t* u, uint8_t* v);
+
+/**
+ * What goes at the start of the stream, before the first frame (empty for raw RGBA)
+ *
+ * @param fps_num   Frame rate, as a fraction
+ * @param fps_den   Frame rate, as a fraction
+ */
+std::string stream_header(StreamFormat format, int width, int height, int fps_num, int fps_den);
+
+/**
+ * Encode one frame of the stream into @p out. Safe to call from several threads at once.
+ *
+ * @param rgba  RGBA8 pixels, bottom row first
+ */
+bool encode_stream_frame(StreamFormat format, const uint8_t* rgba, int width, int height, std::vector<uint8_t>& out);
+
+/**
+ * Where the stream goes: stdout, a FIFO or a plain file.
+ *
+ * Writes block until the reader has taken everything, so a slow encoder on the other end holds the
+ * renderer back instead of frames piling up. A reader that goes away is an error rather than a SIGPIPE.
+ */
+class CStreamOutput final
+{
+public:
+    CStreamOutput() = default;
+    ~CStreamOutput();
+
+    CStreamOutput(const CStreamOutput&) = delete;
+    CStreamOutput& operator=(const CStreamOutput&) = delete;
+
+    /**
+     * Open @p path for writing, or stdout if it's "-". Opening a FIFO waits for a reader.
+     */
+    bool open(const std::string& path);
+
+    /**
+     * Write all of @p data, however long the reader takes
+     */
+    bool write(const void* data, std::size_t size);
+
+    /**
+     * Bytes written so far
+     */
+    uint64_t bytes_written() const { return written; }
+
+private:
+    std::string path;
+    int fd = -1;
+    bool owns_fd = false;
+    uint64_t written = 0;
+};
@@ -0,0 +1,1044 @@
+/**
+ * Voodoo Graphics pipeline emulation
+ */
+#include "voodoo.h"
+#include "log.hpp"
+#include "workers.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Iterated parameters: color, Z, 1/w and the texture coordinates over w
+enum Param
+{
+    PARAM_R = 0,
+    PARAM_G,
+    PARAM_B,
+    PARAM_A,
+    PARAM_Z,
+    PARAM_W,
+    PARAM_S,
+    PARAM_T,
+    NUM_PARAMS
+};
+
+// Vertices are snapped to 12.4 fixed point
+static constexpr int SUBPIXEL_BITS = 4;
+static constexpr int SUBPIXEL_SCALE = 1 << SUBPIXEL_BITS;
+
+// How far past the edges of the framebuffer, in pixels, draw_triangle_clipped lets triangles reach
+static constexpr int GUARD_BAND = 1024;
+
+// Near, far, left, right, top and bottom; bit n of an outcode is plane n
+static constexpr int NUM_CLIP_PLANES = 6;
+
+// The 4x4 ordered dither matrix, indexed by [y & 3][x & 3]
+static const int dither_matrix[4][4] =
+{
+    { 0,  8,  2, 10},
+    {12,  4, 14,  6},
+    { 3, 11,  1,  9},
+    {15,  7, 13,  5}
+};
+
+/*
+** Four lanes of floats or ints, SSE2 where we have it
+*/
+#if defined(__SSE2__)
+struct F4 { __m128 v; };
+struct I4 { __m128i v; };
+
+static inline F4 f4(float x) { return {_mm_set1_ps(x)}; }
+static inline F4 f4(float a, float b, float c, float d) { return {_mm_setr_ps(a, b, c, d)}; }
+static inline F4 operator+(F4 a, F4 b) { return {_mm_add_ps(a.v, b.v)}; }
+static inline F4 operator-(F4 a, F4 b) { return {_mm_sub_ps(a.v, b.v)}; }
+static inline F4 operator*(F4 a, F4 b) { return {_mm_mul_ps(a.v, b.v)}; }
+static inline F4 operator/(F4 a, F4 b) { return {_mm_div_ps(a.v, b.v)}; }
+static inline F4 min(F4 a, F4 b) { return {_mm_min_ps(a.v, b.v)}; }
+static inline F4 max(F4 a, F4 b) { return {_mm_max_ps(a.v, b.v)}; }
+static inline I4 truncate(F4 a) { return {_mm_cvttps_epi32(a.v)}; }
+static inline I4 bits(F4 a) { return {_mm_castps_si128(a.v)}; }
+static inline F4 to_float(I4 a) { return {_mm_cvtepi32_ps(a.v)}; }
+static inline void store(float* dst, F4 a) { _mm_storeu_ps(dst, a.v); }
+static inline F4 load(const float* src) { return {_mm_loadu_ps(src)}; }
+
+static inline I4 i4(int x) { return {_mm_set1_epi32(x)}; }
+static inline I4 i4(uint32_t a, uint32_t b, uint32_t c, uint32_t d) { return {_mm_setr_epi32(static_cast<int>(a), static_cast<int>(b), static_cast<int>(c), static_cast<int>(d))}; }
+static inline I4 load(const int32_t* src) { return {_mm_loadu_si128(reinterpret_cast<const __m128i*>(src))}; }
+static inline I4 load(const uint32_t* src) { return {_mm_loadu_si128(reinterpret_cast<const __m128i*>(src))}; }
+static inline I4 operator+(I4 a, I4 b) { return {_mm_add_epi32(a.v, b.v)}; }
+static inline I4 operator-(I4 a, I4 b) { return {_mm_sub_epi32(a.v, b.v)}; }
+static inline I4 operator&(I4 a, I4 b) { return {_mm_and_si128(a.v, b.v)}; }
+static inline I4 operator|(I4 a, I4 b) { return {_mm_or_si128(a.v, b.v)}; }
+static inline I4 operator<<(I4 a, int n) { return {_mm_slli_epi32(a.v, n)}; }
+static inline I4 operator>>(I4 a, int n) { return {_mm_srli_epi32(a.v, n)}; }
+static inline I4 operator<(I4 a, I4 b) { return {_mm_cmplt_epi32(a.v, b.v)}; }
+static inline I4 operator>(I4 a, I4 b) { return {_mm_cmpgt_epi32(a.v, b.v)}; }
+static inline I4 operator==(I4 a, I4 b) { return {_mm_cmpeq_epi32(a.v, b.v)}; }
+static inline I4 operator~(I4 a) { return {_mm_xor_si128(a.v, _mm_set1_epi32(-1))}; }
+static inline I4 select(I4 mask, I4 a, I4 b) { return {_mm_or_si128(_mm_and_si128(mask.v, a.v), _mm_andnot_si128(mask.v, b.v))}; }
+static inline int movemask(I4 mask) { return _mm_movemask_ps(_mm_castsi128_ps(mask.v)); }
+static inline void store(int32_t* dst, I4 a) { _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), a.v); }
+/** Multiply the low and high 16 bits of each lane separately, keeping the low 16 bits of each product */
+static inline I4 mul16(I4 a, I4 b) { return {_mm_mullo_epi16(a.v, b.v)}; }
+
+static inline I4 load_u16(const uint16_t* src)
+{
+    return {_mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src)), _mm_setzero_si128())};
+}
+
+static inline void store_u16(uint16_t* dst, I4 a)
+{
+    // No unsigned 32 to 16 bit pack in SSE2, so shift into signed range and back
+    const __m128i bias = _mm_set1_epi32(0x8000);
+    __m128i packed = _mm_packs_epi32(_mm_sub_epi32(a.v, bias), _mm_sub_epi32(a.v, bias));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), _mm_xor_si128(packed, _mm_set1_epi16(-0x8000)));
+}
+#else
+struct F4 { float v[4]; };
+struct I4 { int32_t v[4]; };
+
+#define LANES(expr) for(int l = 0; l < 4; l++) { expr; }
+
+static inline F4 f4(float x) { return {{x, x, x, x}}; }
+static inline F4 f4(float a, float b, float c, float d) { return {{a, b, c, d}}; }
+static inline F4 operator+(F4 a, F4 b) { LANES(a.v[l] += b.v[l]) return a; }
+static inline F4 operator-(F4 a, F4 b) { LANES(a.v[l] -= b.v[l]) return a; }
+static inline F4 operator*(F4 a, F4 b) { LANES(a.v[l] *= b.v[l]) return a; }
+static inline F4 operator/(F4 a, F4 b) { LANES(a.v[l] /= b.v[l]) return a; }
+static inline F4 min(F4 a, F4 b) { LANES(a.v[l] = std::min(a.v[l], b.v[l])) return a; }
+static inline F4 max(F4 a, F4 b) { LANES(a.v[l] = std::max(a.v[l], b.v[l])) return a; }
+static inline I4 truncate(F4 a) { I4 r; LANES(r.v[l] = static_cast<int32_t>(a.v[l])) return r; }
+static inline I4 bits(F4 a) { I4 r; std::memcpy(r.v, a.v, sizeof(r.v)); return r; }
+static inline F4 to_float(I4 a) { F4 r; LANES(r.v[l] = static_cast<float>(a.v[l])) return r; }
+static inline void store(float* dst, F4 a) { std::memcpy(dst, a.v, sizeof(a.v)); }
+static inline F4 load(const float* src) { F4 r; std::memcpy(r.v, src, sizeof(r.v)); return r; }
+
+static inline I4 i4(int x) { return {{x, x, x, x}}; }
+static inline I4 i4(uint32_t a, uint32_t b, uint32_t c, uint32_t d) { return {{static_cast<int32_t>(a), static_cast<int32_t>(b), static_cast<int32_t>(c), static_cast<int32_t>(d)}}; }
+static inline I4 load(const int32_t* src) { I4 r; std::memcpy(r.v, src, sizeof(r.v)); return r; }
+static inline I4 load(const uint32_t* src) { I4 r; std::memcpy(r.v, src, sizeof(r.v)); return r; }
+static inline I4 operator+(I4 a, I4 b) { LANES(a.v[l] += b.v[l]) return a; }
+static inline I4 operator-(I4 a, I4 b) { LANES(a.v[l] -= b.v[l]) return a; }
+static inline I4 operator&(I4 a, I4 b) { LANES(a.v[l] &= b.v[l]) return a; }
+static inline I4 operator|(I4 a, I4 b) { LANES(a.v[l] |= b.v[l]) return a; }
+static inline I4 operator<<(I4 a, int n) { LANES(a.v[l] = static_cast<int32_t>(static_cast<uint32_t>(a.v[l]) << n)) return a; }
+static inline I4 operator>>(I4 a, int n) { LANES(a.v[l] = static_cast<int32_t>(static_cast<uint32_t>(a.v[l]) >> n)) return a; }
+static inline I4 operator<(I4 a, I4 b) { LANES(a.v[l] = a.v[l] < b.v[l] ? -1 : 0) return a; }
+static inline I4 operator>(I4 a, I4 b) { LANES(a.v[l] = a.v[l] > b.v[l] ? -1 : 0) return a; }
+static inline I4 operator==(I4 a, I4 b) { LANES(a.v[l] = a.v[l] == b.v[l] ? -1 : 0) return a; }
+static inline I4 operator~(I4 a) { LANES(a.v[l] = ~a.v[l]) return a; }
+static inline I4 select(I4 mask, I4 a, I4 b) { LANES(a.v[l] = (mask.v[l] & a.v[l]) | (~mask.v[l] & b.v[l])) return a; }
+static inline int movemask(I4 mask) { int m = 0; LANES(m |= (mask.v[l] < 0) << l) return m; }
+static inline void store(int32_t* dst, I4 a) { std::memcpy(dst, a.v, sizeof(a.v)); }
+static inline I4 mul16(I4 a, I4 b)
+{
+    LANES(const uint32_t x = static_cast<uint32_t>(a.v[l]); const uint32_t y = static_cast<uint32_t>(b.v[l]);
+          a.v[l] = static_cast<int32_t>((((x & 0xffff) * (y & 0xffff)) & 0xffff) | (((x >> 16) * (y >> 16)) << 16)))
+    return a;
+}
+static inline I4 load_u16(const uint16_t* src) { I4 r; LANES(r.v[l] = src[l]) return r; }
+static inline void store_u16(uint16_t* dst, I4 a) { LANES(dst[l] = static_cast<uint16_t>(a.v[l])) }
+
+#undef LANES
+#endif
+
+static inline F4 clamp255(F4 a)
+{
+    return min(max(a, f4(0.0f)), f4(255.0f));
+}
+
+/**
+ * Store the lanes of @p a whose bits are set in @p live
+ */
+static inline void store_u16_lanes(uint16_t* dst, I4 a, int live)
+{
+    if(live == 0xF)
+    {
+        store_u16(dst, a);
+        return;
+    }
+
+    int32_t lanes[4];
+    store(lanes, a);
+    for(int l = 0; live; l++, live >>= 1)
+    {
+        if(live & 1)
+            dst[l] = static_cast<uint16_t>(lanes[l]);
+    }
+}
+
+static inline int64_t floor_div(int64_t n, int64_t d)
+{
+    int64_t q = n / d;
+    return (n % d != 0 && n < 0) ? q - 1 : q;
+}
+
+/**
+ * How a combine unit is wired up for a Glide combine function and factor
+ */
+struct Combine
+{
+    bool zero_other;        /**< Use 0 instead of other */
+    bool sub_local;         /**< Subtract local from other */
+    int factor;             /**< GrCombineFactor, less the one minus bit */
+    bool one_minus;         /**< Scale by one minus the factor */
+    int add;                /**< 0 to add nothing, 1 to add local, 2 to add local alpha */
+    bool invert;            /**< Output one minus the result */
+};
+
+/**
+ * A @ref GrState, worked out into what the span loop needs
+ */
+struct CVoodooRenderer::Pipeline
+{
+    GrState state;
+    Combine tex_rgb;
+    Combine tex_alpha;
+    Combine color;
+    Combine alpha;
+    bool textured;          /**< The color or alpha combine reads the texture */
+    bool blend;             /**< Reads the framebuffer */
+    float constant[4];      /**< Constant color, r, g, b and a */
+};
+
+/**
+ * A triangle set up for rasterizing
+ */
+struct CVoodooRenderer::Triangle
+{
+    int64_t edge_a[3];      /**< Edge functions a * x + b * y + c, in subpixels, >= 0 inside */
+    int64_t edge_b[3];
+    int64_t edge_c[3];      /**< Less one for edges the fill rule leaves out */
+    int min_y, max_y;       /**< Rows whose pixel centres could be covered, inclusive */
+    float start[NUM_PARAMS];    /**< Parameters at the centre of pixel (0, 0) */
+    float dx[NUM_PARAMS];
+    float dy[NUM_PARAMS];
+    int pipeline;
+};
+
+static Combine decode_combine(GrCombineFunction function, GrCombineFactor factor, bool invert)
+{
+    Combine combine;
+
+    combine.zero_other = false;
+    combine.sub_local = false;
+    combine.add = 0;
+    combine.factor = static_cast<int>(factor) & 0x7;
+    combine.one_minus = (static_cast<int>(factor) & 0x8) != 0;
+    combine.invert = invert;
+
+    switch(function)
+    {
+    case GrCombineFunction::GR_COMBINE_FUNCTION_ZERO:
+        combine.zero_other = true;
+        break;
+    case GrCombineFunction::GR_COMBINE_FUNCTION_LOCAL:
+        combine.zero_other = true;
+        combine.add = 1;
+        break;
+    case GrCombineFunction::GR_COMBINE_FUNCTION_LOCAL_ALPHA:
+        combine.zero_other = true;
+        combine.add = 2;
+        break;
+    case GrCombineFunction::GR_COMBINE_FUNCTION_SCALE_OTHER:
+        break;
+    case GrCombineFunction::GR_COMBINE_FUNCTION_SCALE_OTHER_ADD_LOCAL:
+        combine.add = 1;
+        break;
+    case GrCombineFunction::GR_COMBINE_FUNCTION_SCALE_OTHER_ADD_LOCAL_ALPHA:
+        combine.add = 2;
+        break;
+    case GrCombineFunction::GR_COMBINE_FUNCTION_SCALE_OTHER_MINUS_LOCAL:
+        combine.sub_local = true;
+        break;
+    case GrCombineFunction::GR_COMBINE_FUNCTION_SCALE_OTHER_MINUS_LOCAL_ADD_LOCAL:
+        combine.sub_local = true;
+        combine.add = 1;
+        break;
+    case GrCombineFunction::GR_COMBINE_FUNCTION_SCALE_OTHER_MINUS_LOCAL_ADD_LOCAL_ALPHA:
+        combine.sub_local = true;
+        combine.add = 2;
+        break;
+    case GrCombineFunction::GR_COMBINE_FUNCTION_SCALE_MINUS_LOCAL_ADD_LOCAL:
+        combine.zero_other = true;
+        combine.sub_local = true;
+        combine.add = 1;
+        break;
+    case GrCombineFunction::GR_COMBINE_FUNCTION_SCALE_MINUS_LOCAL_ADD_LOCAL_ALPHA:
+        combine.zero_other = true;
+        combine.sub_local = true;
+        combine.add = 2;
+        break;
+    }
+
+    // Functions that only pass local through ignore the factor
+    if(combine.zero_other && !combine.sub_local)
+    {
+        combine.factor = 0;
+        combine.one_minus = false;
+    }
+    return combine;
+}
+
+static inline bool combine_uses(GrCombineFactor factor, GrCombineFactor what)
+{
+    return (static_cast<int>(factor) & 0x7) == static_cast<int>(what);
+}
+
+bool CVoodooTexture::download(const Gu3dfInfo* info)
+{
+    TexMipLevel mips[TEX_MAX_MIP_LEVELS];
+    const int num_mips = tex_mip_levels(&info->header, mips);
+
+    levels.clear();
+    if(num_mips == 0 || tex_format_bpp(info->header.format) == 0)
+    {
+        log(LogLevel::ERROR, "Can't download a texture with format 0x%x, LODs %d-%d\n", info->header.format, info->header.large_lod, info->header.small_lod);
+        return false;
+    }
+
+    levels.resize(num_mips);
+    for(int i = 0; i < num_mips; i++)
+    {
+        Level& level = levels[i];
+
+        level.width = mips[i].width;
+        level.height = mips[i].height;
+        level.width_shift = 0;
+        while((1 << level.width_shift) < level.width)
+            level.width_shift++;
+
+        // s and t run 0..256 along the longer side of the largest level, whatever its aspect ratio
+        level.scale = static_cast<float>(std::max(level.width, level.height)) / 256.0f;
+        level.texels.resize(static_cast<std::size_t>(level.width) * level.height);
+        if(!decode_3df_level(info, mips[i], level.texels.data(), level.texels.size() * sizeof(uint32_t)))
+        {
+            levels.clear();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+CVoodooRenderer::CVoodooRenderer(int width, int height, CWorkerPool& _pool)
+: pool(_pool), target_width(width), target_height(height)
+{
+    num_bands = (height + BAND_HEIGHT - 1) / BAND_HEIGHT;
+    color.resize(static_cast<std::size_t>(width) * height);
+    depth.resize(static_cast<std::size_t>(width) * height);
+    bins.resize(num_bands);
+    set_state(GrState());
+}
+
+CVoodooRenderer::~CVoodooRenderer() = default;
+
+void CVoodooRenderer::buffer_clear(GrColor_t _color, FxU16 _depth)
+{
+    clear_color = _color;
+    clear_depth = _depth;
+    triangles.clear();
+    for(std::vector<int>& bin : bins)
+        bin.clear();
+
+    // The state carries over to the new frame
+    pipelines.erase(pipelines.begin(), pipelines.end() - 1);
+}
+
+void CVoodooRenderer::set_state(const GrState& state)
+{
+    Pipeline pipe;
+
+    pipe.state = state;
+    pipe.tex_rgb = decode_combine(state.tex_rgb_function, state.tex_rgb_factor, state.tex_rgb_invert);
+    pipe.tex_alpha = decode_combine(state.tex_alpha_function, state.tex_alpha_factor, state.tex_alpha_invert);
+    pipe.color = decode_combine(state.color_function, state.color_factor, state.color_invert);
+    pipe.alpha = decode_combine(state.alpha_function, state.alpha_factor, state.alpha_invert);
+
+    const bool color_texture = (state.color_other == GrCombineOther::GR_COMBINE_OTHER_TEXTURE && !pipe.color.zero_other) ||
+                               combine_uses(state.color_factor, GrCombineFactor::GR_COMBINE_FACTOR_TEXTURE_ALPHA) ||
+                               combine_uses(state.color_factor, GrCombineFactor::GR_COMBINE_FACTOR_TEXTURE_RGB);
+    const bool alpha_texture = (state.alpha_other == GrCombineOther::GR_COMBINE_OTHER_TEXTURE && !pipe.alpha.zero_other) ||
+                               combine_uses(state.alpha_factor, GrCombineFactor::GR_COMBINE_FACTOR_TEXTURE_ALPHA);
+    pipe.textured = state.texture != nullptr && state.texture->num_levels() > 0 && (color_texture || alpha_texture);
+    pipe.blend = state.src_blend != GrAlphaBlendFnc::GR_BLEND_ONE || state.dst_blend != GrAlphaBlendFnc::GR_BLEND_ZERO;
+
+    pipe.constant[0] = static_cast<float>((state.constant_color >> 16) & 0xff);
+    pipe.constant[1] = static_cast<float>((state.constant_color >> 8) & 0xff);
+    pipe.constant[2] = static_cast<float>(state.constant_color & 0xff);
+    pipe.constant[3] = static_cast<float>(state.constant_color >> 24);
+    pipelines.push_back(pipe);
+}
+
+void CVoodooRenderer::draw_triangle(const GrVertex& a, const GrVertex& b, const GrVertex& c)
+{
+    const GrVertex* v[3] = {&a, &b, &c};
+    const GrState& state = pipelines.back().state;
+    int64_t sx[3];
+    int64_t sy[3];
+
+    for(int k = 0; k < 3; k++)
+    {
+        sx[k] = std::llround(v[k]->x * SUBPIXEL_SCALE);
+        sy[k] = std::llround(v[k]->y * SUBPIXEL_SCALE);
+    }
+
+    // Glide's area, with y going down the screen
+    const int64_t area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sy[1] - sy[0]) * (sx[2] - sx[0]);
+    if(area == 0)
+        return;
+    if(state.cull_mode == GrCullMode::GR_CULL_NEGATIVE && area < 0)
+        return;
+    if(state.cull_mode == GrCullMode::GR_CULL_POSITIVE && area > 0)
+        return;
+
+    // Wind every triangle the same way, so inside is where all three edge functions are positive
+    if(area < 0)
+    {
+        std::swap(v[1], v[2]);
+        std::swap(sx[1], sx[2]);
+        std::swap(sy[1], sy[2]);
+    }
+
+    Triangle tri;
+    int64_t min_sy = sy[0], max_sy = sy[0];
+
+    for(int e = 0; e < 3; e++)
+    {
+        const int a0 = e;
+        const int a1 = (e + 1) % 3;
+        const int64_t dx = sx[a1] - sx[a0];
+        const int64_t dy = sy[a1] - sy[a0];
+
+        tri.edge_a[e] = -dy;
+        tri.edge_b[e] = dx;
+        tri.edge_c[e] = dy * sx[a0] - dx * sy[a0];
+
+        // Top-left fill rule. Inside is the way (a, b) points, so a left edge has a > 0 and a top
+        // edge, with y going down, has b > 0
+        const bool top_left = tri.edge_a[e] > 0 || (tri.edge_a[e] == 0 && tri.edge_b[e] > 0);
+        if(!top_left)
+            tri.edge_c[e] -= 1;
+
+        min_sy = std::min(min_sy, sy[e]);
+        max_sy = std::max(max_sy, sy[e]);
+    }
+
+    const int half = SUBPIXEL_SCALE / 2;
+    tri.min_y = static_cast<int>(std::max<int64_t>(floor_div(min_sy - half + SUBPIXEL_SCALE - 1, SUBPIXEL_SCALE), 0));
+    tri.max_y = static_cast<int>(std::min<int64_t>(floor_div(max_sy - half, SUBPIXEL_SCALE), target_height - 1));
+    if(tri.min_y > tri.max_y)
+        return;
+
+    // Parameter gradients, from the snapped vertices the way the hardware's setup works them out
+    const double x0 = static_cast<double>(sx[0]) / SUBPIXEL_SCALE;
+    const double y0 = static_cast<double>(sy[0]) / SUBPIXEL_SCALE;
+    const double x1 = static_cast<double>(sx[1]) / SUBPIXEL_SCALE - x0;
+    const double y1 = static_cast<double>(sy[1]) / SUBPIXEL_SCALE - y0;
+    const double x2 = static_cast<double>(sx[2]) / SUBPIXEL_SCALE - x0;
+    const double y2 = static_cast<double>(sy[2]) / SUBPIXEL_SCALE - y0;
+    const double inv_area = 1.0 / (x1 * y2 - x2 * y1);
+
+    double values[3][NUM_PARAMS];
+    for(int k = 0; k < 3; k++)
+    {
+        values[k][PARAM_R] = v[k]->r;
+        values[k][PARAM_G] = v[k]->g;
+        values[k][PARAM_B] = v[k]->b;
+        values[k][PARAM_A] = v[k]->a;
+        values[k][PARAM_Z] = v[k]->ooz;
+        values[k][PARAM_W] = v[k]->oow;
+        values[k][PARAM_S] = v[k]->sow;
+        values[k][PARAM_T] = v[k]->tow;
+    }
+
+    for(int p = 0; p < NUM_PARAMS; p++)
+    {
+        const double d1 = values[1][p] - values[0][p];
+        const double d2 = values[2][p] - values[0][p];
+        const double dx = (d1 * y2 - d2 * y1) * inv_area;
+        const double dy = (d2 * x1 - d1 * x2) * inv_area;
+
+        tri.dx[p] = static_cast<float>(dx);
+        tri.dy[p] = static_cast<float>(dy);
+        tri.start[p] = static_cast<float>(values[0][p] + (0.5 - x0) * dx + (0.5 - y0) * dy);
+    }
+
+    tri.pipeline = static_cast<int>(pipelines.size()) - 1;
+
+    const int index = static_cast<int>(triangles.size());
+    triangles.push_back(tri);
+    for(int band = tri.min_y / BAND_HEIGHT; band <= tri.max_y / BAND_HEIGHT; band++)
+        bins[band].push_back(index);
+}
+
+/**
+ * Signed distance of a clip space position from a plane, positive inside
+ */
+static inline float clip_distance(const glm::vec4& p, int plane, float guard_x, float guard_y)
+{
+    switch(plane)
+    {
+    case 0:  return p.z + p.w;
+    case 1:  return p.w - p.z;
+    case 2:  return p.x + guard_x * p.w;
+    case 3:  return guard_x * p.w - p.x;
+    case 4:  return p.y + guard_y * p.w;
+    default: return guard_y * p.w - p.y;
+    }
+}
+
+void CVoodooRenderer::draw_triangle_clipped(const GrClipVertex& a, const GrClipVertex& b, const GrClipVertex& c)
+{
+    // NDC that reaches the edge of the guard band
+    const float guard_x = 1.0f + 2.0f * GUARD_BAND / target_width;
+    const float guard_y = 1.0f + 2.0f * GUARD_BAND / target_height;
+    GrClipVertex polygon[2][3 + NUM_CLIP_PLANES];
+    GrClipVertex* poly = polygon[0];
+    int count = 3;
+    int crossed = 0;
+    int inside = ~0;
+
+    poly[0] = a;
+    poly[1] = b;
+    poly[2] = c;
+    for(int k = 0; k < 3; k++)
+    {
+        int code = 0;
+        for(int plane = 0; plane < NUM_CLIP_PLANES; plane++)
+        {
+            if(clip_distance(poly[k].clip, plane, guard_x, guard_y) < 0.0f)
+                code |= 1 << plane;
+        }
+        crossed |= code;
+        inside &= code;
+    }
+
+    if(inside)
+        return;
+
+    // Sutherland-Hodgman, against only the planes the triangle crosses
+    for(int plane = 0; plane < NUM_CLIP_PLANES && count >= 3; plane++)
+    {
+        if(!(crossed & (1 << plane)))
+            continue;
+
+        GrClipVertex* out = (poly == polygon[0]) ? polygon[1] : polygon[0];
+        int out_count = 0;
+
+        for(int k = 0; k < count; k++)
+        {
+            const GrClipVertex& p = poly[k];
+            const GrClipVertex& q = poly[(k + 1) % count];
+            const float dp = clip_distance(p.clip, plane, guard_x, guard_y);
+            const float dq = clip_distance(q.clip, plane, guard_x, guard_y);
+
+            if(dp >= 0.0f)
+                out[out_count++] = p;
+
+            if((dp >= 0.0f) != (dq >= 0.0f))
+            {
+                const float f = dp / (dp - dq);
+                GrClipVertex& v = out[out_count++];
+                v.clip = p.clip + (q.clip - p.clip) * f;
+                v.r = p.r + (q.r - p.r) * f;
+                v.g = p.g + (q.g - p.g) * f;
+                v.b = p.b + (q.b - p.b) * f;
+                v.a = p.a + (q.a - p.a) * f;
+                v.s = p.s + (q.s - p.s) * f;
+                v.t = p.t + (q.t - p.t) * f;
+            }
+        }
+
+        poly = out;
+        count = out_count;
+    }
+
+    if(count < 3)
+        return;
+
+    // Project to the viewport, with the origin in the upper left like Glide's default
+    GrVertex window[3 + NUM_CLIP_PLANES];
+    for(int k = 0; k < count; k++)
+    {
+        const GrClipVertex& p = poly[k];
+        GrVertex& v = window[k];
+        const float oow = 1.0f / p.clip.w;
+
+        v.x = (p.clip.x * oow * 0.5f + 0.5f) * target_width;
+        v.y = (0.5f - p.clip.y * oow * 0.5f) * target_height;
+        v.ooz = (p.clip.z * oow * 0.5f + 0.5f) * 65535.0f;
+        v.oow = oow;
+        v.r = p.r;
+        v.g = p.g;
+        v.b = p.b;
+        v.a = p.a;
+        v.sow = p.s * oow;
+        v.tow = p.t * oow;
+    }
+
+    // The clipped polygon is convex, so fan it out from the first vertex
+    for(int k = 1; k + 1 < count; k++)
+        draw_triangle(window[0], window[k], window[k + 1]);
+}
+
+void CVoodooRenderer::render(uint8_t* rgba)
+{
+    pool.parallel_for(num_bands, [&](int band)
+    {
+        raster_band(band);
+
+        // Scan out the band, expanding RGB565 the way the RAMDAC does
+        const int y0 = band * BAND_HEIGHT;
+        const int y1 = std::min(y0 + BAND_HEIGHT, target_height);
+        for(int y = y0; y < y1; y++)
+        {
+            const uint16_t* src = &color[static_cast<std::size_t>(y) * target_width];
+            uint8_t* dst = rgba + static_cast<std::size_t>(target_height - 1 - y) * target_width * 4;
+
+            for(int x = 0; x < target_width; x++, dst += 4)
+            {
+                const uint32_t r = src[x] >> 11;
+                const uint32_t g = (src[x] >> 5) & 0x3f;
+                const uint32_t b = src[x] & 0x1f;
+
+                dst[0] = static_cast<uint8_t>((r << 3) | (r >> 2));
+                dst[1] = static_cast<uint8_t>((g << 2) | (g >> 4));
+                dst[2] = static_cast<uint8_t>((b << 3) | (b >> 2));
+                dst[3] = 255;
+            }
+        }
+    });
+}
+
+void CVoodooRenderer::raster_band(int band)
+{
+    const int y0 = band * BAND_HEIGHT;
+    const int y1 = std::min(y0 + BAND_HEIGHT, target_height) - 1;
+    const std::size_t first = static_cast<std::size_t>(y0) * target_width;
+    const std::size_t last = static_cast<std::size_t>(y1 + 1) * target_width;
+    const uint32_t r = (clear_color >> 16) & 0xff;
+    const uint32_t g = (clear_color >> 8) & 0xff;
+    const uint32_t b = clear_color & 0xff;
+
+    // grBufferClear doesn't dither
+    std::fill(color.begin() + first, color.begin() + last, static_cast<uint16_t>(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3)));
+    std::fill(depth.begin() + first, depth.begin() + last, clear_depth);
+
+    for(int index : bins[band])
+    {
+        const Triangle& tri = triangles[index];
+        raster_triangle(tri, pipelines[tri.pipeline], std::max(tri.min_y, y0), std::min(tri.max_y, y1));
+    }
+}
+
+/**
+ * Four texels, one per lane, split into channels of 0..255
+ */
+struct Texels
+{
+    F4 r, g, b, a;
+};
+
+static inline Texels unpack_texels(I4 t)
+{
+    const I4 mask = i4(0xff);
+
+    return {to_float(t & mask), to_float((t >> 8) & mask), to_float((t >> 16) & mask), to_float(t >> 24)};
+}
+
+/**
+ * Blend RGBA8888 texels, @p f out of 256 of the way from @p a to @p b. The weights go in both halves
+ * of each lane, so 16 bit multiplies blend two channels at a time.
+ */
+static inline I4 lerp_texels(I4 a, I4 b, I4 f)
+{
+    const I4 mask = i4(0x00ff00ff);
+    const I4 weight_b = f | (f << 16);
+    const I4 weight_a = i4(0x01000100) - weight_b;
+    const I4 rb = ((mul16(a & mask, weight_a) + mul16(b & mask, weight_b)) >> 8) & mask;
+    const I4 ag = ((mul16((a >> 8) & mask, weight_a) + mul16((b >> 8) & mask, weight_b)) >> 8) & mask;
+
+    return rb | (ag << 8);
+}
+
+/**
+ * @p v clamped to 0..@p limit, or wrapped if @p wrap (@p limit + 1 is a power of two)
+ */
+static inline I4 address_texels(I4 v, I4 limit, bool wrap)
+{
+    if(wrap)
+        return v & limit;
+
+    return select(v < i4(0), i4(0), select(v > limit, limit, v));
+}
+
+/**
+ * Look up the texels at @p s, @p t in each lane's level of @p texture, for the lanes set in @p live
+ */
+static inline I4 fetch_texels(const CVoodooTexture& texture, const GrState& state, I4 level, F4 s, F4 t, int live)
+{
+    // Texel coordinates in 1/256ths, biased so they're positive for anything on screen
+    static constexpr int BIAS = 4096;
+    const bool bilinear = state.filter == GrTextureFilterMode::GR_TEXTUREFILTER_BILINEAR;
+    const F4 offset = f4(bilinear ? BIAS - 0.5f : BIAS);
+    const F4 limit = f4(BIAS * 2.0f);
+    int32_t level_lanes[4];
+    float scale[4];
+    int32_t wrap_x[4];
+    int32_t wrap_y[4];
+    int32_t width[4];
+
+    store(level_lanes, level);
+    for(int l = 0; l < 4; l++)
+    {
+        const CVoodooTexture::Level& lane_level = texture.level(level_lanes[l]);
+        scale[l] = lane_level.scale;
+        wrap_x[l] = lane_level.width - 1;
+        wrap_y[l] = lane_level.height - 1;
+        width[l] = lane_level.width;
+    }
+
+    const F4 lane_scale = load(scale);
+    const I4 fu = truncate(min(max(s * lane_scale + offset, f4(0.0f)), limit) * f4(256.0f));
+    const I4 fv = truncate(min(max(t * lane_scale + offset, f4(0.0f)), limit) * f4(256.0f));
+    const I4 u = (fu >> 8) - i4(BIAS);
+    const I4 v = (fv >> 8) - i4(BIAS);
+    const bool wrap_s = state.clamp_s == GrTextureClampMode::GR_TEXTURECLAMP_WRAP;
+    const bool wrap_t = state.clamp_t == GrTextureClampMode::GR_TEXTURECLAMP_WRAP;
+    const I4 x0 = address_texels(u, load(wrap_x), wrap_s);
+    const I4 x1 = address_texels(u + i4(1), load(wrap_x), wrap_s);
+    // Rows are at most 256 texels, so 16 bit multiplies find them
+    const I4 row0 = mul16(address_texels(v, load(wrap_y), wrap_t), load(width));
+    const I4 row1 = mul16(address_texels(v + i4(1), load(wrap_y), wrap_t), load(width));
+    int32_t index[4][4];
+    const uint32_t* lane_texels[4];
+
+    store(index[0], row0 + x0);
+    store(index[1], row0 + x1);
+    store(index[2], row1 + x0);
+    store(index[3], row1 + x1);
+    for(int l = 0; l < 4; l++)
+    {
+        // Dead lanes may be anywhere, so they read the first texel
+        lane_texels[l] = texture.level(level_lanes[l]).texels.data();
+        if(!(live & (1 << l)))
+        {
+            for(int corner = 0; corner < 4; corner++)
+                index[corner][l] = 0;
+        }
+    }
+
+    // Gather a corner of each lane's 2x2 footprint
+    const auto gather = [&](int corner)
+    {
+        return i4(lane_texels[0][index[corner][0]], lane_texels[1][index[corner][1]], lane_texels[2][index[corner][2]], lane_texels[3][index[corner][3]]);
+    };
+
+    if(!bilinear)
+        return gather(0);
+
+    const I4 frac_u = fu & i4(0xff);
+    const I4 top = lerp_texels(gather(0), gather(1), frac_u);
+    const I4 bottom = lerp_texels(gather(2), gather(3), frac_u);
+    return lerp_texels(top, bottom, fv & i4(0xff));
+}
+
+/**
+ * A combine unit's factor, 0..1
+ */
+static inline F4 combine_factor(const Combine& combine, F4 local, F4 local_alpha, F4 other_alpha, F4 texture_alpha, F4 texture)
+{
+    F4 factor;
+    switch(combine.factor)
+    {
+    case 1:  factor = local; break;
+    case 2:  factor = other_alpha; break;
+    case 3:  factor = local_alpha; break;
+    case 4:  factor = texture_alpha; break;
+    case 5:  factor = texture; break;
+    default: factor = f4(0.0f); break;
+    }
+
+    factor = factor * f4(1.0f / 255.0f);
+    return combine.one_minus ? f4(1.0f) - factor : factor;
+}
+
+/**
+ * One channel through a combine unit
+ */
+static inline F4 combine_channel(const Combine& combine, F4 other, F4 local, F4 local_alpha, F4 factor)
+{
+    F4 result = combine.zero_other ? f4(0.0f) : other;
+
+    if(combine.sub_local)
+        result = result - local;
+
+    result = result * factor;
+    if(combine.add == 1)
+        result = result + local;
+    else if(combine.add == 2)
+        result = result + local_alpha;
+
+    result = clamp255(result);
+    return combine.invert ? f4(255.0f) - result : result;
+}
+
+/**
+ * An alpha blending factor for one channel, 0..1
+ */
+static inline F4 blend_factor(GrAlphaBlendFnc function, bool source, F4 src, F4 src_alpha, F4 dst)
+{
+    // The framebuffer has no alpha, so the destination's is always 1
+    switch(function)
+    {
+    case GrAlphaBlendFnc::GR_BLEND_ZERO:                return f4(0.0f);
+    case GrAlphaBlendFnc::GR_BLEND_SRC_ALPHA:           return src_alpha * f4(1.0f / 255.0f);
+    case GrAlphaBlendFnc::GR_BLEND_SRC_COLOR:           return (source ? dst : src) * f4(1.0f / 255.0f);
+    case GrAlphaBlendFnc::GR_BLEND_DST_ALPHA:           return f4(1.0f);
+    case GrAlphaBlendFnc::GR_BLEND_ONE:                 return f4(1.0f);
+    case GrAlphaBlendFnc::GR_BLEND_ONE_MINUS_SRC_ALPHA: return f4(1.0f) - src_alpha * f4(1.0f / 255.0f);
+    case GrAlphaBlendFnc::GR_BLEND_ONE_MINUS_SRC_COLOR: return f4(1.0f) - (source ? dst : src) * f4(1.0f / 255.0f);
+    case GrAlphaBlendFnc::GR_BLEND_ONE_MINUS_DST_ALPHA: return f4(0.0f);
+    case GrAlphaBlendFnc::GR_BLEND_ALPHA_SATURATE:      return f4(0.0f);
+    }
+    return f4(0.0f);
+}
+
+/**
+ * 1/w as the W buffer stores it: a 4.12 float, of how many leading zeros 1/w has in .32 fixed
+ * point and the 12 bits after the first one, inverted so it grows with w. 1/w of 1 or more is 0,
+ * and less than 2^-16 is 0xffff.
+ */
+static inline I4 wbuffer_depth(F4 oow)
+{
+    const I4 b = bits(oow);
+    const I4 exponent = i4(126) - (b >> 23);
+    const I4 mantissa = (b >> 11) & i4(0xfff);
+    I4 value = ((exponent << 12) | (i4(0xfff) - mantissa)) + i4(1);
+
+    value = select(value > i4(0xffff), i4(0xffff), value);
+    value = select(b < i4(0x37800000), i4(0xffff), value);
+    return select(b > i4(0x3f7fffff), i4(0), value);
+}
+
+static inline I4 depth_compare(GrCmpFnc function, I4 value, I4 buffer)
+{
+    switch(function)
+    {
+    case GrCmpFnc::GR_CMP_NEVER:    return i4(0);
+    case GrCmpFnc::GR_CMP_LESS:     return value < buffer;
+    case GrCmpFnc::GR_CMP_EQUAL:    return value == buffer;
+    case GrCmpFnc::GR_CMP_LEQUAL:   return ~(value > buffer);
+    case GrCmpFnc::GR_CMP_GREATER:  return value > buffer;
+    case GrCmpFnc::GR_CMP_NOTEQUAL: return ~(value == buffer);
+    case GrCmpFnc::GR_CMP_GEQUAL:   return ~(value < buffer);
+    case GrCmpFnc::GR_CMP_ALWAYS:   return i4(-1);
+    }
+    return i4(-1);
+}
+
+void CVoodooRenderer::raster_triangle(const Triangle& tri, const Pipeline& pipe, int y0, int y1)
+{
+    const GrState& state = pipe.state;
+    const bool depth_buffer = state.depth_mode != GrDepthBufferMode::GR_DEPTHBUFFER_DISABLE;
+    const bool wbuffer = state.depth_mode == GrDepthBufferMode::GR_DEPTHBUFFER_WBUFFER;
+    const bool write_depth = depth_buffer && state.depth_mask;
+    const bool alpha_depth = state.alpha_local == GrCombineLocal::GR_COMBINE_LOCAL_DEPTH;
+    const CVoodooTexture* texture = pipe.textured ? state.texture : nullptr;
+    const int max_level = texture ? (state.mipmap == GrMipMapMode::GR_MIPMAP_NEAREST ? texture->num_levels() - 1 : 0) : 0;
+    const float level0_scale = texture ? texture->level(0).scale : 0.0f;
+    const F4 ramp = f4(0.0f, 1.0f, 2.0f, 3.0f);
+    const F4 constant_r = f4(pipe.constant[0]);
+    const F4 constant_g = f4(pipe.constant[1]);
+    const F4 constant_b = f4(pipe.constant[2]);
+    const F4 constant_a = f4(pipe.constant[3]);
+    // Dithering turns 0..255 into 16ths of a 5 or 6 bit step, then adds the matrix before truncating
+    const F4 scale5 = f4(31.0f * 16.0f / 255.0f);
+    const F4 scale6 = f4(63.0f * 16.0f / 255.0f);
+
+    for(int y = y0; y <= y1; y++)
+    {
+        // The span of pixel centres inside every edge
+        const int64_t py = static_cast<int64_t>(y) * SUBPIXEL_SCALE + SUBPIXEL_SCALE / 2;
+        int64_t left = 0;
+        int64_t right = target_width - 1;
+
+        for(int e = 0; e < 3; e++)
+        {
+            const int64_t a = tri.edge_a[e];
+            const int64_t k = tri.edge_b[e] * py + tri.edge_c[e] + a * (SUBPIXEL_SCALE / 2);
+
+            // a * 16x + k >= 0
+            if(a > 0)
+                left = std::max(left, -floor_div(k, a * SUBPIXEL_SCALE));
+            else if(a < 0)
+                right = std::min(right, floor_div(k, -a * SUBPIXEL_SCALE));
+            else if(k < 0)
+                right = -1;
+        }
+
+        if(left > right)
+            continue;
+
+        const int x0 = static_cast<int>(left);
+        const int x1 = static_cast<int>(right);
+        const float fx = static_cast<float>(x0);
+        const float fy = static_cast<float>(y);
+        F4 params[NUM_PARAMS];
+        F4 steps[NUM_PARAMS];
+
+        for(int p = 0; p < NUM_PARAMS; p++)
+        {
+            params[p] = f4(tri.start[p] + fx * tri.dx[p] + fy * tri.dy[p]) + ramp * f4(tri.dx[p]);
+            steps[p] = f4(tri.dx[p] * 4.0f);
+        }
+
+        // The dither matrix for the lanes of this row
+        const int* dither_row = dither_matrix[y & 3];
+        const F4 dither = state.dither ? f4(static_cast<float>(dither_row[x0 & 3]), static_cast<float>(dither_row[(x0 + 1) & 3]),
+                                            static_cast<float>(dither_row[(x0 + 2) & 3]), static_cast<float>(dither_row[(x0 + 3) & 3]))
+                                       : f4(8.0f);
+
+        uint16_t* color_row = &color[static_cast<std::size_t>(y) * target_width];
+        uint16_t* depth_row = &depth[static_cast<std::size_t>(y) * target_width];
+
+        for(int x = x0; x <= x1; x += 4)
+        {
+            const int lanes = std::min(4, x1 - x + 1);
+            int live = (1 << lanes) - 1;
+            I4 depth_value = i4(0);
+
+            if(depth_buffer || alpha_depth)
+            {
+                depth_value = wbuffer ? wbuffer_depth(params[PARAM_W]) : truncate(min(max(params[PARAM_Z], f4(0.0f)), f4(65535.0f)));
+                if(depth_buffer)
+                {
+                    I4 buffer;
+                    if(lanes == 4)
+                        buffer = load_u16(depth_row + x);
+                    else
+                    {
+                        uint16_t tail[4] = {0, 0, 0, 0};
+                        std::memcpy(tail, depth_row + x, lanes * sizeof(uint16_t));
+                        buffer = load_u16(tail);
+                    }
+                    live &= movemask(depth_compare(state.depth_function, depth_value, buffer));
+                }
+            }
+
+            if(live)
+            {
+                const F4 iter_r = clamp255(params[PARAM_R]);
+                const F4 iter_g = clamp255(params[PARAM_G]);
+                const F4 iter_b = clamp255(params[PARAM_B]);
+                const F4 iter_a = clamp255(params[PARAM_A]);
+                Texels tex = {f4(0.0f), f4(0.0f), f4(0.0f), f4(0.0f)};
+
+                if(texture)
+                {
+                    // Perspective correct s and t, and the level of detail from how fast they change
+                    // across the screen in texels of the largest level
+                    const F4 w = f4(1.0f) / params[PARAM_W];
+                    const F4 s = params[PARAM_S] * w;
+                    const F4 t = params[PARAM_T] * w;
+                    const F4 dsdx = (f4(tri.dx[PARAM_S]) - s * f4(tri.dx[PARAM_W])) * w;
+                    const F4 dtdx = (f4(tri.dx[PARAM_T]) - t * f4(tri.dx[PARAM_W])) * w;
+                    const F4 dsdy = (f4(tri.dy[PARAM_S]) - s * f4(tri.dy[PARAM_W])) * w;
+                    const F4 dtdy = (f4(tri.dy[PARAM_T]) - t * f4(tri.dy[PARAM_W])) * w;
+                    const F4 rho2 = max(dsdx * dsdx + dtdx * dtdx, dsdy * dsdy + dtdy * dtdy) * f4(level0_scale * level0_scale);
+                    // log2 from the float's bits, exponent and linear mantissa, like the LOD hardware
+                    const F4 lod = (to_float(bits(rho2)) * f4(1.0f / (1 << 23)) - f4(127.0f)) * f4(0.5f) + f4(state.lod_bias + 0.5f);
+                    const I4 level = truncate(min(max(lod, f4(0.0f)), f4(static_cast<float>(max_level))));
+
+                    // TMU0 combine, with nothing upstream
+                    const Texels texel = unpack_texels(fetch_texels(*texture, state, level, s, t, live));
+                    const F4 tex_rgb_factor_r = combine_factor(pipe.tex_rgb, texel.r, texel.a, f4(0.0f), texel.a, f4(0.0f));
+                    const F4 tex_rgb_factor_g = combine_factor(pipe.tex_rgb, texel.g, texel.a, f4(0.0f), texel.a, f4(0.0f));
+                    const F4 tex_rgb_factor_b = combine_factor(pipe.tex_rgb, texel.b, texel.a, f4(0.0f), texel.a, f4(0.0f));
+                    const F4 tex_alpha_factor = combine_factor(pipe.tex_alpha, texel.a, texel.a, f4(0.0f), texel.a, f4(0.0f));
+
+                    tex.r = combine_channel(pipe.tex_rgb, f4(0.0f), texel.r, texel.a, tex_rgb_factor_r);
+                    tex.g = combine_channel(pipe.tex_rgb, f4(0.0f), texel.g, texel.a, tex_rgb_factor_g);
+                    tex.b = combine_channel(pipe.tex_rgb, f4(0.0f), texel.b, texel.a, tex_rgb_factor_b);
+                    tex.a = combine_channel(pipe.tex_alpha, f4(0.0f), texel.a, texel.a, tex_alpha_factor);
+                }
+
+                // Color and alpha combine
+                const bool color_constant = state.color_local == GrCombineLocal::GR_COMBINE_LOCAL_CONSTANT;
+                const F4 local_r = color_constant ? constant_r : iter_r;
+                const F4 local_g = color_constant ? constant_g : iter_g;
+                const F4 local_b = color_constant ? constant_b : iter_b;
+                F4 other_r, other_g, other_b;
+
+                switch(state.color_other)
+                {
+                case GrCombineOther::GR_COMBINE_OTHER_ITERATED: other_r = iter_r; other_g = iter_g; other_b = iter_b; break;
+                case GrCombineOther::GR_COMBINE_OTHER_TEXTURE:  other_r = tex.r; other_g = tex.g; other_b = tex.b; break;
+                default:                                        other_r = constant_r; other_g = constant_g; other_b = constant_b; break;
+                }
+
+                F4 local_a, other_a;
+                switch(state.alpha_local)
+                {
+                case GrCombineLocal::GR_COMBINE_LOCAL_ITERATED: local_a = iter_a; break;
+                case GrCombineLocal::GR_COMBINE_LOCAL_CONSTANT: local_a = constant_a; break;
+                default:                                        local_a = to_float(depth_value >> 8); break;
+                }
+
+                switch(state.alpha_other)
+                {
+                case GrCombineOther::GR_COMBINE_OTHER_ITERATED: other_a = iter_a; break;
+                case GrCombineOther::GR_COMBINE_OTHER_TEXTURE:  other_a = tex.a; break;
+                default:                                        other_a = constant_a; break;
+                }
+
+                F4 out_r = combine_channel(pipe.color, other_r, local_r, local_a, combine_factor(pipe.color, local_r, local_a, other_a, tex.a, tex.r));
+                F4 out_g = combine_channel(pipe.color, other_g, local_g, local_a, combine_factor(pipe.color, local_g, local_a, other_a, tex.a, tex.g));
+                F4 out_b = combine_channel(pipe.color, other_b, local_b, local_a, combine_factor(pipe.color, local_b, local_a, other_a, tex.a, tex.b));
+                const F4 out_a = combine_channel(pipe.alpha, other_a, local_a, local_a, combine_factor(pipe.alpha, local_a, local_a, other_a, tex.a, tex.a));
+
+                I4 old_color = i4(0);
+                if(pipe.blend)
+                {
+                    if(lanes == 4)
+                        old_color = load_u16(color_row + x);
+                    else
+                    {
+                        uint16_t tail[4] = {0, 0, 0, 0};
+                        std::memcpy(tail, color_row + x, lanes * sizeof(uint16_t));
+                        old_color = load_u16(tail);
+                    }
+
+                    const I4 r5 = old_color >> 11;
+                    const I4 g6 = (old_color >> 5) & i4(0x3f);
+                    const I4 b5 = old_color & i4(0x1f);
+                    const F4 dst_r = to_float((r5 << 3) | (r5 >> 2));
+                    const F4 dst_g = to_float((g6 << 2) | (g6 >> 4));
+                    const F4 dst_b = to_float((b5 << 3) | (b5 >> 2));
+
+                    out_r = clamp255(out_r * blend_factor(state.src_blend, true, out_r, out_a, dst_r) + dst_r * blend_factor(state.dst_blend, false, out_r, out_a, dst_r));
+                    out_g = clamp255(out_g * blend_factor(state.src_blend, true, out_g, out_a, dst_g) + dst_g * blend_factor(state.dst_blend, false, out_g, out_a, dst_g));
+                    out_b = clamp255(out_b * blend_factor(state.src_blend, true, out_b, out_a, dst_b) + dst_b * blend_factor(state.dst_blend, false, out_b, out_a, dst_b));
+                }
+
+                // Dither down to RGB565
+                const I4 r = truncate(out_r * scale5 + dither) >> 4;
+                const I4 g = truncate(out_g * scale6 + dither) >> 4;
+                const I4 b = truncate(out_b * scale5 + dither) >> 4;
+
+                store_u16_lanes(color_row + x, (r << 11) | (g << 5) | b, live);
+                if(write_depth)
+                    store_u16_lanes(depth_row + x, depth_value, live);
+            }
+
+            for(int p = 0; p < NUM_PARAMS; p++)
+                params[p] = params[p] + steps[p];
+        }
+    }
+}
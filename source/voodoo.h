@@ -0,0 +1,327 @@
+/**
+ * Voodoo Graphics pipeline emulation
+ */
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "3dftex.h"
+
+class CWorkerPool;
+
+typedef FxU32 GrColor_t;        /* ARGB8888, GR_COLORFORMAT_ARGB */
+
+/*
+** Glide state enums (from glide.h), for the parts of the pipeline we emulate
+*/
+enum class GrCombineFunction : FxI32
+{
+    GR_COMBINE_FUNCTION_ZERO                                    = 0x0,
+    GR_COMBINE_FUNCTION_NONE                                    = GR_COMBINE_FUNCTION_ZERO,
+    GR_COMBINE_FUNCTION_LOCAL                                   = 0x1,
+    GR_COMBINE_FUNCTION_LOCAL_ALPHA                             = 0x2,
+    GR_COMBINE_FUNCTION_SCALE_OTHER                             = 0x3,
+    GR_COMBINE_FUNCTION_BLEND_OTHER                             = GR_COMBINE_FUNCTION_SCALE_OTHER,
+    GR_COMBINE_FUNCTION_SCALE_OTHER_ADD_LOCAL                   = 0x4,
+    GR_COMBINE_FUNCTION_SCALE_OTHER_ADD_LOCAL_ALPHA             = 0x5,
+    GR_COMBINE_FUNCTION_SCALE_OTHER_MINUS_LOCAL                 = 0x6,
+    GR_COMBINE_FUNCTION_SCALE_OTHER_MINUS_LOCAL_ADD_LOCAL       = 0x7,
+    GR_COMBINE_FUNCTION_BLEND                                   = GR_COMBINE_FUNCTION_SCALE_OTHER_MINUS_LOCAL_ADD_LOCAL,
+    GR_COMBINE_FUNCTION_SCALE_OTHER_MINUS_LOCAL_ADD_LOCAL_ALPHA = 0x8,
+    GR_COMBINE_FUNCTION_SCALE_MINUS_LOCAL_ADD_LOCAL             = 0x9,
+    GR_COMBINE_FUNCTION_BLEND_LOCAL                             = GR_COMBINE_FUNCTION_SCALE_MINUS_LOCAL_ADD_LOCAL,
+    GR_COMBINE_FUNCTION_SCALE_MINUS_LOCAL_ADD_LOCAL_ALPHA       = 0x10
+};
+
+enum class GrCombineFactor : FxI32
+{
+    GR_COMBINE_FACTOR_ZERO                  = 0x0,
+    GR_COMBINE_FACTOR_NONE                  = GR_COMBINE_FACTOR_ZERO,
+    GR_COMBINE_FACTOR_LOCAL                 = 0x1,
+    GR_COMBINE_FACTOR_OTHER_ALPHA           = 0x2,
+    GR_COMBINE_FACTOR_LOCAL_ALPHA           = 0x3,
+    GR_COMBINE_FACTOR_TEXTURE_ALPHA         = 0x4,
+    GR_COMBINE_FACTOR_DETAIL_FACTOR         = GR_COMBINE_FACTOR_TEXTURE_ALPHA,
+    GR_COMBINE_FACTOR_LOD_FRACTION          = 0x5,      /* Texture combine only */
+    GR_COMBINE_FACTOR_TEXTURE_RGB           = GR_COMBINE_FACTOR_LOD_FRACTION,   /* Color combine only */
+    GR_COMBINE_FACTOR_ONE                   = 0x8,
+    GR_COMBINE_FACTOR_ONE_MINUS_LOCAL       = 0x9,
+    GR_COMBINE_FACTOR_ONE_MINUS_OTHER_ALPHA = 0xa,
+    GR_COMBINE_FACTOR_ONE_MINUS_LOCAL_ALPHA = 0xb,
+    GR_COMBINE_FACTOR_ONE_MINUS_TEXTURE_ALPHA = 0xc,
+    GR_COMBINE_FACTOR_ONE_MINUS_DETAIL_FACTOR = GR_COMBINE_FACTOR_ONE_MINUS_TEXTURE_ALPHA,
+    GR_COMBINE_FACTOR_ONE_MINUS_LOD_FRACTION = 0xd
+};
+
+enum class GrCombineLocal : FxI32
+{
+    GR_COMBINE_LOCAL_ITERATED   = 0x0,
+    GR_COMBINE_LOCAL_CONSTANT   = 0x1,
+    GR_COMBINE_LOCAL_NONE       = GR_COMBINE_LOCAL_CONSTANT,
+    GR_COMBINE_LOCAL_DEPTH      = 0x2
+};
+
+enum class GrCombineOther : FxI32
+{
+    GR_COMBINE_OTHER_ITERATED   = 0x0,
+    GR_COMBINE_OTHER_TEXTURE    = 0x1,
+    GR_COMBINE_OTHER_CONSTANT   = 0x2,
+    GR_COMBINE_OTHER_NONE       = GR_COMBINE_OTHER_CONSTANT
+};
+
+enum class GrAlphaBlendFnc : FxI32
+{
+    GR_BLEND_ZERO                   = 0x0,
+    GR_BLEND_SRC_ALPHA              = 0x1,
+    GR_BLEND_SRC_COLOR              = 0x2,
+    GR_BLEND_DST_COLOR              = GR_BLEND_SRC_COLOR,
+    GR_BLEND_DST_ALPHA              = 0x3,
+    GR_BLEND_ONE                    = 0x4,
+    GR_BLEND_ONE_MINUS_SRC_ALPHA    = 0x5,
+    GR_BLEND_ONE_MINUS_SRC_COLOR    = 0x6,
+    GR_BLEND_ONE_MINUS_DST_COLOR    = GR_BLEND_ONE_MINUS_SRC_COLOR,
+    GR_BLEND_ONE_MINUS_DST_ALPHA    = 0x7,
+    GR_BLEND_ALPHA_SATURATE         = 0xf
+};
+
+enum class GrCmpFnc : FxI32
+{
+    GR_CMP_NEVER    = 0x0,
+    GR_CMP_LESS     = 0x1,
+    GR_CMP_EQUAL    = 0x2,
+    GR_CMP_LEQUAL   = 0x3,
+    GR_CMP_GREATER  = 0x4,
+    GR_CMP_NOTEQUAL = 0x5,
+    GR_CMP_GEQUAL   = 0x6,
+    GR_CMP_ALWAYS   = 0x7
+};
+
+enum class GrDepthBufferMode : FxI32
+{
+    GR_DEPTHBUFFER_DISABLE  = 0x0,
+    GR_DEPTHBUFFER_ZBUFFER  = 0x1,
+    GR_DEPTHBUFFER_WBUFFER  = 0x2
+};
+
+enum class GrCullMode : FxI32
+{
+    GR_CULL_DISABLE     = 0x0,
+    GR_CULL_NEGATIVE    = 0x1,
+    GR_CULL_POSITIVE    = 0x2
+};
+
+enum class GrTextureClampMode : FxI32
+{
+    GR_TEXTURECLAMP_WRAP    = 0x0,
+    GR_TEXTURECLAMP_CLAMP   = 0x1
+};
+
+enum class GrTextureFilterMode : FxI32
+{
+    GR_TEXTUREFILTER_POINT_SAMPLED  = 0x0,
+    GR_TEXTUREFILTER_BILINEAR       = 0x1
+};
+
+enum class GrMipMapMode : FxI32
+{
+    GR_MIPMAP_DISABLE   = 0x0,      /* no mip mapping */
+    GR_MIPMAP_NEAREST   = 0x1       /* use nearest mipmap */
+};
+
+/**
+ * A vertex in screen space, the way Glide takes it: x and y in pixels from the upper left corner, and
+ * everything else already divided by w, ready to iterate linearly across the triangle
+ */
+struct GrVertex
+{
+    float x, y;
+    float ooz;                  /**< Depth for the Z buffer, 0..65535 */
+    float oow;                  /**< 1/w, for the W buffer and perspective correction */
+    float r, g, b, a;           /**< Iterated color, 0..255 */
+    float sow, tow;             /**< Glide texture coordinates (0..256 across the texture) times oow */
+};
+
+/**
+ * A vertex before projection, for @ref CVoodooRenderer::draw_triangle_clipped
+ */
+struct GrClipVertex
+{
+    glm::vec4 clip;             /**< Clip space position */
+    float r, g, b, a;           /**< 0..255 */
+    float s, t;                 /**< Glide texture coordinates */
+};
+
+/**
+ * A texture downloaded to TMU memory.
+ *
+ * Every mipmap level is kept decoded to RGBA8888: NCC and palettized texels go through their table once
+ * when the texture is downloaded, the way the TMU decodes them ahead of its filter.
+ */
+class CVoodooTexture final
+{
+public:
+    struct Level
+    {
+        int width;
+        int height;
+        int width_shift;        /**< log2(width) */
+        float scale;            /**< Texels per unit of s and t */
+        std::vector<uint32_t> texels;
+    };
+
+public:
+    /**
+     * Decode every level of @p info.
+     *
+     * @return false (and logs why) if the header or format are invalid
+     */
+    bool download(const Gu3dfInfo* info);
+
+    int num_levels() const { return static_cast<int>(levels.size()); }
+    const Level& level(int index) const { return levels[index]; }
+
+private:
+    std::vector<Level> levels;
+};
+
+/**
+ * The Glide state a triangle is drawn with. The defaults draw plain Gouraud shaded triangles, with
+ * no texture, depth buffer or blending.
+ */
+struct GrState
+{
+    // grColorCombine
+    GrCombineFunction color_function = GrCombineFunction::GR_COMBINE_FUNCTION_SCALE_OTHER;
+    GrCombineFactor color_factor = GrCombineFactor::GR_COMBINE_FACTOR_ONE;
+    GrCombineLocal color_local = GrCombineLocal::GR_COMBINE_LOCAL_ITERATED;
+    GrCombineOther color_other = GrCombineOther::GR_COMBINE_OTHER_ITERATED;
+    bool color_invert = false;
+
+    // grAlphaCombine
+    GrCombineFunction alpha_function = GrCombineFunction::GR_COMBINE_FUNCTION_SCALE_OTHER;
+    GrCombineFactor alpha_factor = GrCombineFactor::GR_COMBINE_FACTOR_ONE;
+    GrCombineLocal alpha_local = GrCombineLocal::GR_COMBINE_LOCAL_NONE;
+    GrCombineOther alpha_other = GrCombineOther::GR_COMBINE_OTHER_CONSTANT;
+    bool alpha_invert = false;
+
+    // grTexCombine on TMU0. There's no TMU upstream of it, so its "other" is always zero.
+    GrCombineFunction tex_rgb_function = GrCombineFunction::GR_COMBINE_FUNCTION_LOCAL;
+    GrCombineFactor tex_rgb_factor = GrCombineFactor::GR_COMBINE_FACTOR_NONE;
+    GrCombineFunction tex_alpha_function = GrCombineFunction::GR_COMBINE_FUNCTION_LOCAL;
+    GrCombineFactor tex_alpha_factor = GrCombineFactor::GR_COMBINE_FACTOR_NONE;
+    bool tex_rgb_invert = false;
+    bool tex_alpha_invert = false;
+
+    GrColor_t constant_color = 0xffffffff;
+
+    // grTexSource, grTexClampMode, grTexFilterMode, grTexMipMapMode, grTexLodBiasValue
+    const CVoodooTexture* texture = nullptr;
+    GrTextureClampMode clamp_s = GrTextureClampMode::GR_TEXTURECLAMP_WRAP;
+    GrTextureClampMode clamp_t = GrTextureClampMode::GR_TEXTURECLAMP_WRAP;
+    GrTextureFilterMode filter = GrTextureFilterMode::GR_TEXTUREFILTER_BILINEAR;
+    GrMipMapMode mipmap = GrMipMapMode::GR_MIPMAP_NEAREST;
+    float lod_bias = 0.0f;
+
+    // grAlphaBlendFunction, for color only: the framebuffer has no alpha
+    GrAlphaBlendFnc src_blend = GrAlphaBlendFnc::GR_BLEND_ONE;
+    GrAlphaBlendFnc dst_blend = GrAlphaBlendFnc::GR_BLEND_ZERO;
+
+    // grDepthBufferMode, grDepthBufferFunction, grDepthMask
+    GrDepthBufferMode depth_mode = GrDepthBufferMode::GR_DEPTHBUFFER_DISABLE;
+    GrCmpFnc depth_function = GrCmpFnc::GR_CMP_LESS;
+    bool depth_mask = false;
+
+    GrCullMode cull_mode = GrCullMode::GR_CULL_DISABLE;
+    bool dither = true;         /**< grDitherMode GR_DITHER_4x4, otherwise GR_DITHER_DISABLE */
+};
+
+/**
+ * Draws triangles the way a Voodoo Graphics board does, on the CPU: a 16-bit RGB565 framebuffer with
+ * 4x4 ordered dithering, a 16-bit Z or W buffer (the W buffer holds 1/w as a 4.12 float, like the
+ * real one), perspective correct bilinear texturing from the nearest mipmap, and the Glide texture
+ * combine, color combine, alpha combine and alpha blending units.
+ *
+ * Triangles are set up as they're drawn, with their vertices snapped to 12.4 fixed point, and binned
+ * into bands of rows. @ref render then rasterizes the bands over a @ref CWorkerPool: each row of a
+ * triangle is a span worked out from its edges with the top-left fill rule, and is shaded four
+ * pixels at a time with SSE2. Bands keep their triangles in the order they were drawn, so the
+ * frame comes out the same however many threads there are.
+ *
+ * The combine arithmetic is done in float rather than the hardware's 8-bit fixed point, so it
+ * can be a bit off in the last bit before dithering.
+ */
+class CVoodooRenderer final
+{
+public:
+    static constexpr int BAND_HEIGHT = 16;
+
+public:
+    /**
+     * Constructor
+     *
+     * @param pool  Threads to render on. Must outlive the renderer.
+     */
+    CVoodooRenderer(int width, int height, CWorkerPool& pool);
+    ~CVoodooRenderer();
+
+    CVoodooRenderer(const CVoodooRenderer&) = delete;
+    CVoodooRenderer& operator=(const CVoodooRenderer&) = delete;
+
+    /**
+     * grBufferClear: start a new frame, cleared to @p color and @p depth. Throws away anything
+     * drawn since the last one.
+     */
+    void buffer_clear(GrColor_t color, FxU16 depth);
+
+    /**
+     * Draw the triangles after this with @p state
+     */
+    void set_state(const GrState& state);
+
+    /**
+     * grDrawTriangle. Nothing is clipped, only the pixels outside of the framebuffer are skipped.
+     */
+    void draw_triangle(const GrVertex& a, const GrVertex& b, const GrVertex& c);
+
+    /**
+     * guDrawTriangleWithClip: clip a triangle against the near and far planes and a guard band,
+     * project it to the viewport and draw it.
+     */
+    void draw_triangle_clipped(const GrClipVertex& a, const GrClipVertex& b, const GrClipVertex& c);
+
+    /**
+     * Rasterize everything drawn since @ref buffer_clear, and convert the framebuffer into @p rgba:
+     * width * height RGBA8 pixels, bottom row first like glReadPixels
+     */
+    void render(uint8_t* rgba);
+
+    /**
+     * The RGB565 framebuffer, top row first. Only up to date after @ref render.
+     */
+    const uint16_t* framebuffer() const { return color.data(); }
+
+    int width() const { return target_width; }
+    int height() const { return target_height; }
+
+private:
+    struct Triangle;
+    struct Pipeline;
+
+    void raster_band(int band);
+    void raster_triangle(const Triangle& tri, const Pipeline& pipe, int y0, int y1);
+
+    CWorkerPool& pool;
+    int target_width;
+    int target_height;
+    int num_bands;
+    std::vector<uint16_t> color;
+    std::vector<uint16_t> depth;
+    GrColor_t clear_color = 0;
+    FxU16 clear_depth = 0xffff;
+
+    std::vector<Pipeline> pipelines;            /**< Every state set this frame, decoded */
+    std::vector<Triangle> triangles;            /**< In the order they were drawn */
+    std::vector<std::vector<int>> bins;         /**< Per band, indices into triangles */
+};
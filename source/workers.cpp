@@ -0,0 +1,86 @@
+/**
+ * Worker thread pool
+ */
+#include "workers.h"
+#include <algorithm>
+
+CWorkerPool::CWorkerPool(int num_threads)
+{
+    if(num_threads <= 0)
+        num_threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+
+    for(int i = 1; i < num_threads; i++)
+        workers.emplace_back(&CWorkerPool::worker_main, this);
+}
+
+CWorkerPool::~CWorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+
+    wake.notify_all();
+    for(std::thread& worker : workers)
+        worker.join();
+}
+
+void CWorkerPool::run_items()
+{
+    for(int item = next_item.fetch_add(1); item < job_items; item = next_item.fetch_add(1))
+        (*job)(item);
+}
+
+void CWorkerPool::parallel_for(int num_items, const std::function<void(int)>& fn)
+{
+    if(num_items <= 0)
+        return;
+
+    // Not worth waking anybody up for
+    if(workers.empty() || num_items == 1)
+    {
+        for(int item = 0; item < num_items; item++)
+            fn(item);
+        return;
+    }
+
+    std::lock_guard<std::mutex> submit_lock(submit_mutex);
+    std::unique_lock<std::mutex> lock(mutex);
+
+    job = &fn;
+    job_items = num_items;
+    next_item = 0;
+    active = static_cast<int>(workers.size());
+    generation++;
+    lock.unlock();
+    wake.notify_all();
+
+    run_items();
+
+    lock.lock();
+    done.wait(lock, [this]() { return active == 0; });
+    job = nullptr;
+}
+
+void CWorkerPool::worker_main()
+{
+    uint64_t seen = 0;
+
+    for(;;)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        wake.wait(lock, [&]() { return quit || generation != seen; });
+        if(quit)
+            return;
+
+        seen = generation;
+        lock.unlock();
+
+        run_items();
+
+        lock.lock();
+        if(--active == 0)
+            done.notify_one();
+    }
+}
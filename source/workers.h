@@ -0,0 +1,62 @@
+/**
+ * Worker thread pool
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed set of worker threads that split a job of independent items between them.
+ *
+ * The thread calling @ref parallel_for works on the job too, so a pool of one thread has no workers
+ * and runs everything inline.
+ */
+class CWorkerPool final
+{
+public:
+    /**
+     * Constructor
+     *
+     * @param num_threads   Number of threads working on a job, including the caller. 0 picks one per CPU.
+     */
+    explicit CWorkerPool(int num_threads = 0);
+    ~CWorkerPool();
+
+    CWorkerPool(const CWorkerPool&) = delete;
+    CWorkerPool& operator=(const CWorkerPool&) = delete;
+
+    /**
+     * Call @p fn for every item in [0, @p num_items), spread over the pool, and wait for all of them.
+     *
+     * Items are handed out in order as threads become free, so @p fn must not depend on which
+     * thread runs which item. Jobs from different threads are run one after the other.
+     */
+    void parallel_for(int num_items, const std::function<void(int)>& fn);
+
+    /**
+     * Number of threads working on a job, including the caller
+     */
+    int size() const { return static_cast<int>(workers.size()) + 1; }
+
+private:
+    void worker_main();
+    void run_items();
+
+    std::vector<std::thread> workers;
+    std::mutex submit_mutex;                    /**< Serialises parallel_for callers */
+    std::mutex mutex;                           /**< Protects everything below */
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int)>* job = nullptr;
+    int job_items = 0;
+    std::atomic<int> next_item{0};
+    int active = 0;                             /**< Workers still on the current job */
+    uint64_t generation = 0;                    /**< Bumped for every job, so workers can tell a new one apart */
+    bool quit = false;
+};